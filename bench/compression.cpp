@@ -0,0 +1,112 @@
+/**
+ * @file compression.cpp
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Story compression benchmark: wire bytes against CPU time.
+ * @version 0.1
+ * @date 2024-11-23
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compression/lz.h"
+#include "networking/serialization.h"
+#include "src/vocabulary.h"
+
+static const size_t PLAYER_COUNTS[] = {4, 16, 64, 256, 1024};
+static const size_t REPETITIONS = 2000;
+
+static const std::vector<std::string> REPLIES{
+    "once",  "upon",   "a",     "time",  "there", "was",   "the",
+    "and",   "went",   "to",    "find",  "lost",  "magic", "sword",
+    "under", "bridge", "happy", "ever",  "after", "dragon",
+};
+
+static std::vector<char> make_story(size_t player_count) {
+    std::vector<std::string> story{};
+
+    story.push_back(OBJECTIVES[(size_t)rand() % OBJECTIVES.size()]);
+    story.push_back(NOUNS[(size_t)rand() % NOUNS.size()]);
+
+    for (size_t player_id = 0; player_id < player_count; ++player_id) {
+        story.push_back(REPLIES[(size_t)rand() % REPLIES.size()]);
+    }
+
+    std::vector<char> encoded{};
+    wire_encode(LATEST_WIRE_VERSION, encoded, story);
+
+    return encoded;
+}
+
+struct Measurement {
+    size_t bytes = 0;
+    double compress_us = 0;
+    double decompress_us = 0;
+};
+
+static Measurement measure(const std::vector<char>& story,
+                           std::string_view dictionary) {
+    using Clock = std::chrono::steady_clock;
+
+    std::string_view input(story.data(), story.size());
+
+    Measurement result{};
+    std::vector<char> compressed{};
+    std::vector<char> restored(story.size());
+
+    Clock::time_point start = Clock::now();
+    for (size_t rep = 0; rep < REPETITIONS; ++rep) {
+        compressed.clear();
+        lz_compress(input, dictionary, compressed);
+    }
+    Clock::time_point middle = Clock::now();
+    for (size_t rep = 0; rep < REPETITIONS; ++rep) {
+        lz_decompress(std::string_view(compressed.data(), compressed.size()),
+                      dictionary, restored.data(), restored.size());
+    }
+    Clock::time_point end = Clock::now();
+
+    if (restored != story) {
+        fprintf(stderr, "Round trip failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    result.bytes = compressed.size();
+    result.compress_us =
+        std::chrono::duration<double, std::micro>(middle - start).count() /
+        REPETITIONS;
+    result.decompress_us =
+        std::chrono::duration<double, std::micro>(end - middle).count() /
+        REPETITIONS;
+
+    return result;
+}
+
+int main() {
+    srand(42);
+
+    printf("%8s %8s | %8s %8s %8s | %8s %8s %8s\n", "players", "raw",
+           "plain", "comp us", "dec us", "dict", "comp us", "dec us");
+
+    for (size_t player_count : PLAYER_COUNTS) {
+        std::vector<char> story = make_story(player_count);
+
+        Measurement plain = measure(story, {});
+        Measurement with_dict = measure(story, vocabulary_dictionary());
+
+        printf("%8zu %8zu | %8zu %8.2f %8.2f | %8zu %8.2f %8.2f\n",
+               player_count, story.size(), plain.bytes, plain.compress_us,
+               plain.decompress_us, with_dict.bytes, with_dict.compress_us,
+               with_dict.decompress_us);
+    }
+
+    return 0;
+}
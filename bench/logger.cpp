@@ -0,0 +1,86 @@
+/**
+ * @file logger.cpp
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Caller-side cost of log_printf() with synchronous, background and
+ * binary writes.
+ * @version 0.1
+ * @date 2024-11-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <stdio.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "logger/logger.h"
+
+static const size_t THREAD_COUNTS[] = {1, 2, 4};
+
+// Bursts stay below the queue capacity, so that nothing is dropped.
+static const size_t BURST_SIZE = 1000;
+static const size_t BURST_COUNT = 20;
+static const int BURST_PAUSE_MS = 20;
+
+static double measure(size_t thread_count) {
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<double> totals(thread_count);
+    std::vector<std::thread> threads{};
+
+    for (size_t thread_id = 0; thread_id < thread_count; ++thread_id) {
+        threads.emplace_back([thread_id, &totals] {
+            for (size_t burst = 0; burst < BURST_COUNT; ++burst) {
+                Clock::time_point start = Clock::now();
+
+                for (size_t message = 0; message < BURST_SIZE; ++message) {
+                    log_printf(STATUS_REPORTS, "bench",
+                               "Client %zu registered %zu us after being "
+                               "accepted.\n",
+                               thread_id, message);
+                }
+
+                totals[thread_id] +=
+                    std::chrono::duration<double, std::nano>(Clock::now() -
+                                                             start)
+                        .count();
+
+                std::this_thread::sleep_for(
+                    std::chrono::milliseconds(BURST_PAUSE_MS));
+            }
+        });
+    }
+
+    for (std::thread& thread : threads) thread.join();
+
+    double total = 0;
+    for (double thread_total : totals) total += thread_total;
+
+    return total / (double)(thread_count * BURST_COUNT * BURST_SIZE);
+}
+
+int main() {
+    printf("%8s | %10s %10s %10s\n", "threads", "sync ns", "async ns",
+           "binary ns");
+
+    for (size_t thread_count : THREAD_COUNTS) {
+        set_async_logging(false);
+        double sync_ns = measure(thread_count);
+
+        set_async_logging(true);
+        double async_ns = measure(thread_count);
+
+        set_binary_logging(true);
+        double binary_ns = measure(thread_count);
+
+        set_async_logging(false);
+
+        printf("%8zu | %10.1f %10.1f %10.1f\n", thread_count, sync_ns,
+               async_ns, binary_ns);
+    }
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file udp_offload.cpp
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Loopback benchmark of UDP chunk trains: per-chunk syscalls against
+ * batching and segmentation offload.
+ * @version 0.1
+ * @date 2024-11-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "networking/basic_interface.h"
+
+static const size_t MESSAGE_SIZES[] = {4096, 32768, 262144};
+static const size_t MESSAGE_COUNT = 200;
+
+static const int SOCKET_BUFFER_SIZE = 8 << 20;  // bytes
+
+struct LoopbackConnection : public NetworkConnection<NetworkProtocol::UDP> {
+    LoopbackConnection(int sock, sockaddr_in peer) {
+        sock_ = sock;
+        conn_addr_ = peer;
+        set_close_on_destroy(false);
+        set_wire_version(LATEST_WIRE_VERSION);
+    }
+};
+
+struct Mode {
+    const char* name = "";
+    size_t batch = 1;
+    bool offload = false;
+};
+
+static const Mode MODES[] = {
+    {.name = "sendto", .batch = 1, .offload = false},
+    {.name = "mmsg", .batch = DEFAULT_DATAGRAM_BATCH, .offload = false},
+    {.name = "gso", .batch = DEFAULT_DATAGRAM_BATCH, .offload = true},
+};
+
+static int open_socket(sockaddr_in* address) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    *address = {};
+    address->sin_family = AF_INET;
+    address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t address_len = sizeof(*address);
+    bind(sock, (sockaddr*)address, address_len);
+    getsockname(sock, (sockaddr*)address, &address_len);
+
+    // Lost datagrams would stall the plain UDP receiver.
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER_SIZE,
+               sizeof(SOCKET_BUFFER_SIZE));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &SOCKET_BUFFER_SIZE,
+               sizeof(SOCKET_BUFFER_SIZE));
+
+    return sock;
+}
+
+static double measure(const Mode& mode, size_t message_size) {
+    using Clock = std::chrono::steady_clock;
+
+    sockaddr_in sender_address{};
+    sockaddr_in receiver_address{};
+    int sender_sock = open_socket(&sender_address);
+    int receiver_sock = open_socket(&receiver_address);
+
+    std::string message(message_size, '\0');
+    for (size_t id = 0; id < message_size; ++id) {
+        message[id] = (char)('a' + id % 26);
+    }
+
+    bool intact = true;
+
+    Clock::time_point start = Clock::now();
+
+    std::thread receiver([&] {
+        LoopbackConnection conn(receiver_sock, sender_address);
+        conn.set_datagram_batching(mode.batch, mode.batch);
+        conn.set_segmentation_offload(mode.offload);
+
+        for (size_t id = 0; id < MESSAGE_COUNT && intact; ++id) {
+            auto view = conn.receive_view();
+            intact = view && *view == message;
+        }
+    });
+
+    {
+        LoopbackConnection conn(sender_sock, receiver_address);
+        conn.set_datagram_batching(mode.batch, mode.batch);
+        conn.set_segmentation_offload(mode.offload);
+
+        for (size_t id = 0; id < MESSAGE_COUNT; ++id) conn.send(message);
+    }
+
+    receiver.join();
+
+    Clock::time_point end = Clock::now();
+
+    close(sender_sock);
+    close(receiver_sock);
+
+    if (!intact) {
+        fprintf(stderr, "Messages got corrupted in mode %s!\n", mode.name);
+        exit(EXIT_FAILURE);
+    }
+
+    return std::chrono::duration<double, std::micro>(end - start).count() /
+           MESSAGE_COUNT;
+}
+
+int main() {
+    printf("%10s", "bytes");
+    for (const Mode& mode : MODES) printf(" | %10s us", mode.name);
+    printf("\n");
+
+    for (size_t message_size : MESSAGE_SIZES) {
+        printf("%10zu", message_size);
+        for (const Mode& mode : MODES) {
+            printf(" | %13.1f", measure(mode, message_size));
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
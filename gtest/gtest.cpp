@@ -9,4 +9,682 @@
  *
  */
 
+#include <arpa/inet.h>
 #include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "compression/lz.h"
+#include "containers/mpsc_queue.h"
+#include "containers/spsc_queue.h"
+#include "containers/string_arena.h"
+#include "containers/timer_wheel.h"
+#include "networking/reliable_udp.h"
+#include "networking/serialization.h"
+#include "networking/udp_demux.h"
+#include "networking/wire_format.h"
+
+using Milliseconds = std::chrono::milliseconds;
+
+// Bytes that compress well but are not one long run.
+static std::string make_text(size_t size) {
+    static const char* WORDS[] = {"dragon ", "castle ", "skinny ", "pilot ",
+                                  "forest ", "wizard "};
+
+    std::mt19937 random(7);
+    std::string text{};
+
+    while (text.size() < size) text += WORDS[random() % 6];
+    text.resize(size);
+
+    return text;
+}
+
+static std::string make_noise(size_t size) {
+    std::mt19937 random(11);
+    std::string noise(size, '\0');
+
+    for (char& byte : noise) byte = (char)(random() & 0xff);
+
+    return noise;
+}
+
+static int bind_loopback(sockaddr_in* address) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    *address = {};
+    address->sin_family = AF_INET;
+    address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t len = sizeof(*address);
+    if (bind(sock, (sockaddr*)address, len) < 0 ||
+        getsockname(sock, (sockaddr*)address, &len) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static sockaddr_in make_address(uint32_t host, uint16_t port) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(host);
+    address.sin_port = htons(port);
+
+    return address;
+}
+
+TEST(Varint, RoundTrip) {
+    const uint64_t values[] = {0,          1,          127,       128,
+                               300,        16383,      16384,     UINT32_MAX,
+                               1ull << 56, UINT64_MAX - 1, UINT64_MAX};
+
+    for (uint64_t value : values) {
+        char encoded[MAX_VARINT_SIZE] = {};
+        size_t size = encode_varint(value, encoded);
+
+        uint64_t decoded = 0;
+        EXPECT_EQ(decode_varint({encoded, size}, &decoded), size);
+        EXPECT_EQ(decoded, value);
+    }
+
+    char encoded[MAX_VARINT_SIZE] = {};
+    EXPECT_EQ(encode_varint(127, encoded), 1u);
+    EXPECT_EQ(encode_varint(128, encoded), 2u);
+    EXPECT_EQ(encode_varint(UINT64_MAX, encoded), MAX_VARINT_SIZE);
+}
+
+TEST(Varint, RejectsMalformedInput) {
+    char encoded[MAX_VARINT_SIZE] = {};
+    size_t size = encode_varint(UINT64_MAX, encoded);
+
+    uint64_t decoded = 0;
+    for (size_t prefix = 0; prefix < size; ++prefix) {
+        EXPECT_EQ(decode_varint({encoded, prefix}, &decoded), 0u);
+    }
+
+    // The tenth byte only carries the top bit.
+    encoded[MAX_VARINT_SIZE - 1] = 2;
+    EXPECT_EQ(decode_varint({encoded, size}, &decoded), 0u);
+
+    // Continuation past the tenth byte.
+    char overlong[MAX_VARINT_SIZE + 1] = {};
+    memset(overlong, 0x80, MAX_VARINT_SIZE);
+    EXPECT_EQ(decode_varint({overlong, sizeof(overlong)}, &decoded), 0u);
+}
+
+TEST(Zigzag, RoundTrip) {
+    const int64_t values[] = {0, -1, 1, -64, 63, INT32_MIN, INT32_MAX,
+                              INT64_MIN, INT64_MAX};
+
+    for (int64_t value : values) {
+        EXPECT_EQ(zigzag_decode(zigzag_encode(value)), value);
+    }
+
+    // Small magnitudes of either sign stay small.
+    EXPECT_EQ(zigzag_encode(0), 0u);
+    EXPECT_EQ(zigzag_encode(-1), 1u);
+    EXPECT_EQ(zigzag_encode(1), 2u);
+    EXPECT_EQ(zigzag_encode(-64), 127u);
+    EXPECT_EQ(zigzag_encode(INT64_MIN), UINT64_MAX);
+}
+
+TEST(Lz, RoundTrip) {
+    const std::string dictionary = make_text(4096);
+
+    const std::string inputs[] = {
+        "",
+        "a",
+        std::string(100000, 'x'),
+        make_text(70000),
+        make_noise(5000),
+        dictionary.substr(100, 900),
+    };
+
+    for (const std::string& input : inputs) {
+        for (std::string_view dict : {std::string_view{}, {dictionary}}) {
+            std::vector<char> compressed{};
+            lz_compress(input, dict, compressed);
+
+            std::string output(input.size(), '\0');
+            ASSERT_TRUE(lz_decompress({compressed.data(), compressed.size()},
+                                      dict, output.data(), output.size()));
+            EXPECT_EQ(output, input);
+        }
+    }
+
+    // Data found in the dictionary shrinks to a few matches.
+    const std::string noise = make_noise(4096);
+
+    std::vector<char> compressed{};
+    lz_compress(noise.substr(100, 900), noise, compressed);
+    EXPECT_LT(compressed.size(), 50u);
+}
+
+TEST(Lz, RejectsMalformedInput) {
+    const std::string input = make_text(3000);
+
+    std::vector<char> compressed{};
+    lz_compress(input, {}, compressed);
+
+    std::string output(input.size(), '\0');
+
+    for (size_t prefix = 0; prefix < compressed.size(); ++prefix) {
+        // A block ending on a match closes with an empty token, dropping it
+        // loses nothing.
+        if (prefix + 1 == compressed.size() && compressed.back() == 0) {
+            continue;
+        }
+
+        EXPECT_FALSE(lz_decompress({compressed.data(), prefix}, {},
+                                   output.data(), output.size()))
+            << "prefix " << prefix;
+    }
+
+    std::string_view block(compressed.data(), compressed.size());
+    EXPECT_FALSE(lz_decompress(block, {}, output.data(), output.size() - 1));
+
+    std::string longer(input.size() + 1, '\0');
+    EXPECT_FALSE(lz_decompress(block, {}, longer.data(), longer.size()));
+
+    // Matches reaching before the start of the data.
+    const char far_match[] = {0x00, (char)0xff, 0x00};
+    EXPECT_FALSE(lz_decompress({far_match, sizeof(far_match)}, {},
+                               output.data(), LZ_MIN_MATCH));
+
+    // Random corruption must fail cleanly or decode to the right size.
+    std::mt19937 random(3);
+    for (int round = 0; round < 2000; ++round) {
+        std::vector<char> corrupted = compressed;
+        corrupted[random() % corrupted.size()] = (char)(random() & 0xff);
+
+        lz_decompress({corrupted.data(), corrupted.size()}, {},
+                      output.data(), output.size());
+    }
+}
+
+struct TestRecord {
+    uint16_t id = 0;
+    int32_t score = 0;
+    std::string name{};
+    std::vector<std::string> words{};
+    std::optional<double> ratio{};
+    std::pair<uint8_t, bool> flags{};
+
+    bool operator==(const TestRecord&) const = default;
+};
+
+TEST(Serialization, RoundTrip) {
+    TestRecord record = {
+        .id = 513,
+        .score = -70000,
+        .name = std::string(300, 'n'),
+        .words = {"dragon", "", make_text(200)},
+        .ratio = 0.25,
+        .flags = {7, true},
+    };
+
+    for (WireVersion version : {WireVersion::V1, LATEST_WIRE_VERSION}) {
+        std::vector<char> encoded{};
+        wire_encode(version, encoded, record);
+
+        auto decoded = wire_decode<TestRecord>(
+            {encoded.data(), encoded.size()}, version);
+
+        ASSERT_TRUE(decoded.has_value());
+        EXPECT_EQ(*decoded, record);
+    }
+
+    std::vector<char> fixed{};
+    std::vector<char> compact{};
+    wire_encode(WireVersion::V1, fixed, record);
+    wire_encode(LATEST_WIRE_VERSION, compact, record);
+
+    // Five lengths and counts, each at least two bytes shorter.
+    EXPECT_LE(compact.size() + 5 * 2, fixed.size());
+}
+
+TEST(Serialization, RejectsTruncatedInput) {
+    TestRecord record = {.name = "pilot", .words = {"skinny", "castle"}};
+
+    for (WireVersion version : {WireVersion::V1, LATEST_WIRE_VERSION}) {
+        std::vector<char> encoded{};
+        wire_encode(version, encoded, record);
+
+        for (size_t prefix = 0; prefix < encoded.size(); ++prefix) {
+            EXPECT_FALSE(
+                wire_decode<TestRecord>({encoded.data(), prefix}, version))
+                << "prefix " << prefix;
+        }
+
+        // Trailing bytes are rejected too.
+        encoded.push_back(0);
+        EXPECT_FALSE(wire_decode<TestRecord>({encoded.data(), encoded.size()},
+                                             version));
+    }
+
+    // Lengths past the input on the compact encoding.
+    char huge[MAX_VARINT_SIZE] = {};
+    size_t size = encode_varint(1ull << 40, huge);
+    EXPECT_FALSE(
+        wire_decode<std::string>({huge, size}, LATEST_WIRE_VERSION));
+}
+
+TEST(StringArena, MatchesVectorEncoding) {
+    StringArena arena{};
+    std::vector<std::string> words{};
+
+    // Past 127 strings the count takes a second byte.
+    for (size_t id = 0; id < 300; ++id) {
+        words.push_back(make_text(id % 150));
+        EXPECT_EQ(arena.append(words.back()), words.back());
+    }
+
+    for (size_t id = 0; id < words.size(); ++id) {
+        EXPECT_EQ(arena[id], words[id]);
+    }
+
+    for (WireVersion version : {WireVersion::V1, LATEST_WIRE_VERSION}) {
+        std::vector<char> expected{};
+        wire_encode(version, expected, words);
+
+        std::string_view encoded = arena.wire_encoded(version);
+        EXPECT_EQ(encoded, std::string_view(expected.data(), expected.size()));
+    }
+
+    arena.clear();
+    arena.append("dragon");
+
+    std::vector<char> expected{};
+    wire_encode(WireVersion::V1, expected, std::vector<std::string>{"dragon"});
+    EXPECT_EQ(arena.wire_encoded(WireVersion::V1),
+              std::string_view(expected.data(), expected.size()));
+}
+
+TEST(TimerWheel, ExpiresInOrderAcrossLevels) {
+    using Wheel = TimerWheel<uint64_t>;
+
+    Wheel::Clock::time_point origin = Wheel::Clock::now();
+    Wheel wheel(origin);
+
+    // Level boundaries, where timers cascade to the finer levels.
+    const uint64_t delays[] = {0,    1,      63,      64,       65,
+                               4095, 4096,   4097,    262143,   262144,
+                               270000, 16777216, 1073741824ull};
+
+    for (uint64_t delay : delays) {
+        wheel.arm(origin + Milliseconds(delay), delay);
+    }
+
+    EXPECT_EQ(wheel.size(), std::size(delays));
+
+    for (uint64_t delay : delays) {
+        std::vector<uint64_t> expired{};
+        auto collect = [&](Wheel::TimerId, uint64_t& value) {
+            expired.push_back(value);
+        };
+
+        if (delay > 0) {
+            wheel.advance(origin + Milliseconds(delay - 1), collect);
+            EXPECT_TRUE(expired.empty()) << "early at " << delay;
+        }
+
+        wheel.advance(origin + Milliseconds(delay), collect);
+        ASSERT_EQ(expired.size(), 1u) << "at " << delay;
+        EXPECT_EQ(expired[0], delay);
+    }
+
+    EXPECT_TRUE(wheel.empty());
+    EXPECT_EQ(wheel.timeout_ms(), -1);
+}
+
+TEST(TimerWheel, OverflowList) {
+    using Wheel = TimerWheel<int>;
+
+    Wheel::Clock::time_point origin = Wheel::Clock::now();
+    Wheel wheel(origin);
+
+    // Past the span of the top level.
+    const uint64_t far = (1ull << 36) + 12345;
+    const uint64_t farther = 3 * (1ull << 36) + 7;
+
+    wheel.arm(origin + Milliseconds(farther), 2);
+    wheel.arm(origin + Milliseconds(far), 1);
+
+    std::vector<int> expired{};
+    auto collect = [&](Wheel::TimerId, int& value) {
+        expired.push_back(value);
+    };
+
+    EXPECT_EQ(wheel.advance(origin + Milliseconds(far - 1), collect), 0u);
+    EXPECT_EQ(wheel.advance(origin + Milliseconds(far), collect), 1u);
+    EXPECT_EQ(wheel.advance(origin + Milliseconds(farther - 1), collect), 0u);
+    EXPECT_EQ(wheel.advance(origin + Milliseconds(farther), collect), 1u);
+
+    EXPECT_EQ(expired, (std::vector<int>{1, 2}));
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheel, CancelAndRearm) {
+    using Wheel = TimerWheel<int>;
+
+    Wheel::Clock::time_point origin = Wheel::Clock::now();
+    Wheel wheel(origin);
+
+    Wheel::TimerId first = wheel.arm(origin + Milliseconds(100), 1);
+    EXPECT_TRUE(wheel.is_armed(first));
+    EXPECT_TRUE(wheel.cancel(first));
+    EXPECT_FALSE(wheel.cancel(first));
+
+    // The node is reused, the old id must not match it.
+    Wheel::TimerId second = wheel.arm(origin + Milliseconds(100), 2);
+    EXPECT_NE(first, second);
+    EXPECT_FALSE(wheel.is_armed(first));
+
+    // Coarse slots on the way may wake the loop up earlier.
+    EXPECT_GT(wheel.timeout_ms(origin), 0);
+    EXPECT_LE(wheel.timeout_ms(origin), 100);
+
+    std::vector<int> expired{};
+    wheel.advance(origin + Milliseconds(100), [&](Wheel::TimerId, int& value) {
+        expired.push_back(value);
+
+        // Timers armed by the handler go out later.
+        if (value < 4) wheel.arm(origin + Milliseconds(100), value + 1);
+    });
+
+    EXPECT_EQ(expired, (std::vector<int>{2}));
+
+    wheel.advance(origin + Milliseconds(101), [&](Wheel::TimerId, int& value) {
+        expired.push_back(value);
+    });
+
+    EXPECT_EQ(expired, (std::vector<int>{2, 3}));
+    EXPECT_FALSE(wheel.is_armed(second));
+}
+
+TEST(SpscQueue, FifoAndCapacity) {
+    auto queue = std::make_unique<SpscQueue<int, 8>>();
+
+    for (int value = 0; value < 8; ++value) EXPECT_TRUE(queue->push(value));
+    EXPECT_FALSE(queue->push(8));
+
+    // Wraps around the ring a few times.
+    for (int value = 0; value < 100; ++value) {
+        EXPECT_EQ(queue->pop(), value);
+        EXPECT_TRUE(queue->push(value + 8));
+    }
+
+    for (int value = 100; value < 108; ++value) EXPECT_EQ(queue->pop(), value);
+    EXPECT_FALSE(queue->pop().has_value());
+}
+
+TEST(SpscQueue, TwoThreads) {
+    static const uint64_t COUNT = 200000;
+
+    auto queue = std::make_unique<SpscQueue<uint64_t, 1024>>();
+
+    std::thread producer([&queue]() {
+        for (uint64_t value = 0; value < COUNT; ++value) {
+            while (!queue->push(value)) std::this_thread::yield();
+        }
+    });
+
+    uint64_t expected = 0;
+    bool in_order = true;
+
+    while (expected < COUNT) {
+        std::optional<uint64_t> value = queue->pop();
+        if (!value) continue;
+
+        in_order = in_order && *value == expected;
+        ++expected;
+    }
+
+    producer.join();
+
+    EXPECT_TRUE(in_order);
+    EXPECT_FALSE(queue->pop().has_value());
+}
+
+TEST(MpscQueue, FifoAndCapacity) {
+    auto queue = std::make_unique<MpscQueue<std::string, 4>>();
+
+    for (int value = 0; value < 4; ++value) {
+        EXPECT_TRUE(queue->push(std::to_string(value)));
+    }
+    EXPECT_FALSE(queue->push("full"));
+
+    EXPECT_EQ(queue->pop(), "0");
+    EXPECT_TRUE(queue->push_with([](std::string& slot) { slot = "4"; }));
+
+    std::string seen{};
+    while (queue->pop_with([&seen](std::string& slot) { seen += slot; })) {
+    }
+
+    EXPECT_EQ(seen, "1234");
+    EXPECT_FALSE(queue->pop().has_value());
+}
+
+TEST(MpscQueue, ManyProducers) {
+    static const uint64_t PRODUCERS = 4;
+    static const uint64_t COUNT = 50000;  // per producer
+
+    auto queue = std::make_unique<MpscQueue<uint64_t, 256>>();
+
+    std::vector<std::thread> producers{};
+    for (uint64_t producer = 0; producer < PRODUCERS; ++producer) {
+        producers.emplace_back([&queue, producer]() {
+            for (uint64_t value = 0; value < COUNT; ++value) {
+                while (!queue->push(producer << 32 | value)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Elements of one producer keep their order.
+    std::vector<uint64_t> next(PRODUCERS, 0);
+    bool in_order = true;
+
+    for (uint64_t received = 0; received < PRODUCERS * COUNT;) {
+        std::optional<uint64_t> value = queue->pop();
+        if (!value) continue;
+
+        uint64_t producer = *value >> 32;
+        in_order = in_order && producer < PRODUCERS &&
+                   (*value & UINT32_MAX) == next[producer]++;
+        ++received;
+    }
+
+    for (std::thread& producer : producers) producer.join();
+
+    EXPECT_TRUE(in_order);
+    EXPECT_FALSE(queue->pop().has_value());
+}
+
+TEST(UdpDemux, DetachKeepsProbeChains) {
+    UdpDemux demux(-1);
+
+    static const size_t COUNT = 300;
+
+    std::vector<sockaddr_in> addresses{};
+    std::vector<int> slots{};
+    for (size_t id = 0; id < COUNT; ++id) {
+        addresses.push_back(
+            make_address(INADDR_LOOPBACK + (uint32_t)(id % 7),
+                         (uint16_t)(20000 + id * 13)));
+        slots.push_back(demux.attach(addresses.back()));
+    }
+
+    for (size_t id = 0; id < COUNT; ++id) {
+        EXPECT_EQ(demux.attach(addresses[id]), slots[id]);
+    }
+
+    // Every detach may shift the entries probed after it back.
+    std::mt19937 random(5);
+    std::vector<size_t> order(COUNT);
+    for (size_t id = 0; id < COUNT; ++id) order[id] = id;
+    std::shuffle(order.begin(), order.end(), random);
+
+    std::vector<bool> attached(COUNT, true);
+    for (size_t step = 0; step < COUNT / 2; ++step) {
+        size_t gone = order[step];
+        demux.detach(slots[gone]);
+        attached[gone] = false;
+
+        for (size_t id = 0; id < COUNT; ++id) {
+            ASSERT_EQ(demux.find(addresses[id]), attached[id] ? slots[id] : -1)
+                << "after " << step + 1 << " detaches";
+        }
+    }
+
+    // Freed slots are handed out again.
+    size_t gone = order[0];
+    int slot = demux.attach(addresses[gone]);
+    EXPECT_FALSE(demux.has_pending(slot));
+    EXPECT_EQ(demux.find(addresses[gone]), slot);
+}
+
+/**
+ * @brief Datagram forwarder between two loopback sockets, dropping some of
+ * the datagrams in either direction
+ *
+ */
+struct LossyRelay {
+    LossyRelay(const sockaddr_in& left, const sockaddr_in& right,
+               size_t drop_every)
+        : left_(left),
+          right_(right),
+          drop_every_(drop_every),
+          sock_(bind_loopback(&address_)),
+          thread_([this]() { run(); }) {}
+
+    LossyRelay(const LossyRelay&) = delete;
+    LossyRelay& operator=(const LossyRelay&) = delete;
+
+    ~LossyRelay() {
+        stop_ = true;
+        thread_.join();
+        close(sock_);
+    }
+
+    const sockaddr_in& address() const { return address_; }
+    size_t dropped() const { return dropped_; }
+
+   private:
+    void run() {
+        std::vector<char> datagram(65536);
+        size_t counts[2] = {};
+
+        while (!stop_) {
+            pollfd request = {.fd = sock_, .events = POLLIN, .revents = 0};
+            if (poll(&request, 1, 10) <= 0) continue;
+
+            sockaddr_in source = {};
+            socklen_t len = sizeof(source);
+            ssize_t received = recvfrom(sock_, datagram.data(),
+                                        datagram.size(), 0,
+                                        (sockaddr*)&source, &len);
+            if (received < 0) continue;
+
+            bool from_left = source.sin_port == left_.sin_port;
+            if (++counts[from_left] % drop_every_ == 0) {
+                ++dropped_;
+                continue;
+            }
+
+            const sockaddr_in& target = from_left ? right_ : left_;
+            sendto(sock_, datagram.data(), (size_t)received, 0,
+                   (const sockaddr*)&target, sizeof(target));
+        }
+    }
+
+    sockaddr_in left_{};
+    sockaddr_in right_{};
+    size_t drop_every_ = 0;
+
+    sockaddr_in address_{};
+    int sock_ = -1;
+
+    std::atomic<bool> stop_ = false;
+    std::atomic<size_t> dropped_ = 0;
+    std::thread thread_{};
+};
+
+TEST(ReliableUdp, DeliversInOrderDespiteDrops) {
+    static const size_t COUNT = 300;
+
+    sockaddr_in sender_address = {};
+    sockaddr_in receiver_address = {};
+    int sender_sock = bind_loopback(&sender_address);
+    int receiver_sock = bind_loopback(&receiver_address);
+    ASSERT_GE(sender_sock, 0);
+    ASSERT_GE(receiver_sock, 0);
+
+    LossyRelay relay(sender_address, receiver_address, 5);
+
+    std::atomic<bool> sent_all = false;
+    std::vector<std::string> received{};
+
+    std::thread receiver_thread([&]() {
+        ReliableUdp channel{};
+        sockaddr_in peer = relay.address();
+
+        char buffer[2048] = {};
+        while (received.size() < COUNT) {
+            ssize_t len =
+                channel.recv(receiver_sock, &peer, buffer, sizeof(buffer));
+            if (len < 0) return;
+
+            received.emplace_back(buffer, (size_t)len);
+        }
+
+        // Retransmissions of acknowledgements lost on the way back.
+        while (!sent_all) {
+            if (!channel.poll(receiver_sock, &peer)) return;
+            std::this_thread::sleep_for(Milliseconds(1));
+        }
+    });
+
+    ReliableUdp channel{};
+    sockaddr_in peer = relay.address();
+
+    std::vector<std::string> messages{};
+    bool queued = true;
+    for (size_t id = 0; id < COUNT; ++id) {
+        messages.push_back(std::to_string(id) + " " + make_text(id % 1000));
+
+        queued = queued && channel.send(sender_sock, &peer,
+                                        messages.back().data(),
+                                        messages.back().size());
+    }
+
+    bool flushed = queued && channel.flush(sender_sock, &peer, 20000);
+
+    sent_all = true;
+    receiver_thread.join();
+
+    close(sender_sock);
+    close(receiver_sock);
+
+    EXPECT_TRUE(queued);
+    EXPECT_TRUE(flushed);
+    EXPECT_GT(relay.dropped(), 0u);
+    EXPECT_EQ(received, messages);
+}
@@ -0,0 +1,180 @@
+#include "lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+static const size_t HASH_BITS = 12;
+static const uint32_t NO_POSITION = UINT32_MAX;
+
+static const size_t NIBBLE_MAX = 15;
+static const uint8_t LENGTH_BYTE_MAX = 255;
+
+static size_t hash_sequence(const char* data) {
+    uint32_t word = 0;
+    memcpy(&word, data, sizeof(word));
+    return (word * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static std::string_view trim_dictionary(std::string_view dictionary) {
+    if (dictionary.size() <= LZ_MAX_DISTANCE) return dictionary;
+    return dictionary.substr(dictionary.size() - LZ_MAX_DISTANCE);
+}
+
+static void put_length(std::vector<char>& output, size_t extra) {
+    for (; extra >= LENGTH_BYTE_MAX; extra -= LENGTH_BYTE_MAX) {
+        output.push_back((char)LENGTH_BYTE_MAX);
+    }
+
+    output.push_back((char)extra);
+}
+
+static void put_sequence(std::vector<char>& output, const char* literals,
+                         size_t literal_count, size_t distance,
+                         size_t match_len) {
+    size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+
+    output.push_back((char)(std::min(literal_count, NIBBLE_MAX) << 4 |
+                            std::min(match_code, NIBBLE_MAX)));
+
+    if (literal_count >= NIBBLE_MAX) {
+        put_length(output, literal_count - NIBBLE_MAX);
+    }
+
+    output.insert(output.end(), literals, literals + literal_count);
+
+    if (match_len == 0) return;
+
+    output.push_back((char)(distance & 0xff));
+    output.push_back((char)(distance >> 8));
+
+    if (match_code >= NIBBLE_MAX) put_length(output, match_code - NIBBLE_MAX);
+}
+
+void lz_compress(std::string_view input, std::string_view dictionary,
+                 std::vector<char>& output) {
+    dictionary = trim_dictionary(dictionary);
+
+    // Dictionary and input form one window, so matches cross the border.
+    std::vector<char> window(dictionary.begin(), dictionary.end());
+    window.insert(window.end(), input.begin(), input.end());
+
+    const char* base = window.data();
+    size_t end = window.size();
+
+    std::vector<uint32_t> table(1 << HASH_BITS, NO_POSITION);
+
+    for (size_t pos = 0; pos + LZ_MIN_MATCH <= dictionary.size(); ++pos) {
+        table[hash_sequence(base + pos)] = (uint32_t)pos;
+    }
+
+    size_t anchor = dictionary.size();
+    size_t pos = dictionary.size();
+
+    while (pos + LZ_MIN_MATCH <= end) {
+        uint32_t& slot = table[hash_sequence(base + pos)];
+        size_t candidate = slot;
+        slot = (uint32_t)pos;
+
+        if (candidate == NO_POSITION || pos - candidate > LZ_MAX_DISTANCE ||
+            memcmp(base + candidate, base + pos, LZ_MIN_MATCH) != 0) {
+            ++pos;
+            continue;
+        }
+
+        size_t match_len = LZ_MIN_MATCH;
+        while (pos + match_len < end &&
+               base[candidate + match_len] == base[pos + match_len]) {
+            ++match_len;
+        }
+
+        put_sequence(output, base + anchor, pos - anchor, pos - candidate,
+                     match_len);
+
+        pos += match_len;
+        anchor = pos;
+    }
+
+    put_sequence(output, base + anchor, end - anchor, 0, 0);
+}
+
+static bool read_length(std::string_view input, size_t* cursor,
+                        size_t* length) {
+    uint8_t byte = LENGTH_BYTE_MAX;
+
+    while (byte == LENGTH_BYTE_MAX) {
+        if (*cursor >= input.size()) return false;
+
+        byte = (uint8_t)input[(*cursor)++];
+        *length += byte;
+    }
+
+    return true;
+}
+
+bool lz_decompress(std::string_view input, std::string_view dictionary,
+                   char* output, size_t raw_len) {
+    dictionary = trim_dictionary(dictionary);
+
+    size_t cursor = 0;
+    size_t out = 0;
+
+    while (cursor < input.size()) {
+        uint8_t token = (uint8_t)input[cursor++];
+
+        size_t literal_count = token >> 4;
+        if (literal_count == NIBBLE_MAX &&
+            !read_length(input, &cursor, &literal_count)) {
+            return false;
+        }
+
+        if (literal_count > input.size() - cursor ||
+            literal_count > raw_len - out) {
+            return false;
+        }
+
+        memcpy(output + out, input.data() + cursor, literal_count);
+        cursor += literal_count;
+        out += literal_count;
+
+        // The last sequence carries no match.
+        if (cursor == input.size()) break;
+
+        if (input.size() - cursor < 2) return false;
+
+        size_t distance = (size_t)(uint8_t)input[cursor] |
+                          (size_t)(uint8_t)input[cursor + 1] << 8;
+        cursor += 2;
+
+        size_t match_len = token & NIBBLE_MAX;
+        if (match_len == NIBBLE_MAX &&
+            !read_length(input, &cursor, &match_len)) {
+            return false;
+        }
+
+        match_len += LZ_MIN_MATCH;
+
+        if (distance == 0 || distance > out + dictionary.size() ||
+            match_len > raw_len - out) {
+            return false;
+        }
+
+        if (distance <= out && distance >= match_len) {
+            memcpy(output + out, output + out - distance, match_len);
+            out += match_len;
+            continue;
+        }
+
+        // Byte by byte, as the match overlaps its own output or starts in
+        // the dictionary.
+        for (size_t id = 0; id < match_len; ++id, ++out) {
+            output[out] =
+                distance > out
+                    ? dictionary[dictionary.size() - (distance - out)]
+                    : output[out - distance];
+        }
+    }
+
+    return out == raw_len;
+}
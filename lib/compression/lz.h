@@ -0,0 +1,55 @@
+/**
+ * @file lz.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Byte-oriented LZ77 block codec with preset dictionary support.
+ * @version 0.1
+ * @date 2024-11-23
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <string_view>
+#include <vector>
+
+/*
+ * Block layout follows LZ4: a sequence of
+ *   token (literal count << 4 | match length - LZ_MIN_MATCH),
+ *   extra literal count bytes, literals,
+ *   2-byte little-endian match distance, extra match length bytes,
+ * where a nibble of 15 is continued by bytes summed until one is below 255.
+ * The last sequence has literals only.
+ *
+ * Matches may reach back into the dictionary, which both sides have to
+ * share byte for byte.
+ */
+
+static const size_t LZ_MIN_MATCH = 4;         // bytes
+static const size_t LZ_MAX_DISTANCE = 65535;  // bytes
+
+/**
+ * @brief Compress the block
+ *
+ * @param input data to compress
+ * @param dictionary shared dictionary, may be empty
+ * @param output the compressed block is appended to it
+ */
+void lz_compress(std::string_view input, std::string_view dictionary,
+                 std::vector<char>& output);
+
+/**
+ * @brief Decompress the block
+ *
+ * @param input compressed block
+ * @param dictionary dictionary used for compression
+ * @param output destination buffer
+ * @param raw_len exact decompressed size
+ * @return false if the block is malformed or does not decode to exactly
+ * raw_len bytes
+ */
+bool lz_decompress(std::string_view input, std::string_view dictionary,
+                   char* output, size_t raw_len);
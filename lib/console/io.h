@@ -18,6 +18,25 @@
 template <class T>
 using Options = std::unordered_map<std::string, T>;
 
+template <class T>
+const T* match_command(const Options<T>& options, const std::string& input,
+                       const std::string& help) {
+    if (input == "help") {
+        std::cout << help << std::endl;
+        return nullptr;
+    }
+
+    auto found = options.find(input);
+    if (found == options.end()) {
+        std::cout
+            << "Invalid command, type \"help\" to see the list of options."
+            << std::endl;
+        return nullptr;
+    }
+
+    return &found->second;
+}
+
 template <class T>
 const T& receive_command(const Options<T>& options, const std::string& prefix,
                          const std::string& help) {
@@ -26,19 +45,7 @@ const T& receive_command(const Options<T>& options, const std::string& prefix,
         std::cout << prefix;
         std::cin >> input;
 
-        if (input == "help") {
-            std::cout << help << std::endl;
-            continue;
-        }
-
-        auto found = options.find(input);
-        if (found == options.end()) {
-            std::cout
-                << "Invalid command, type \"help\" to see the list of options."
-                << std::endl;
-            continue;
-        }
-
-        return found->second;
+        const T* command = match_command(options, input, help);
+        if (command) return *command;
     }
 }
@@ -0,0 +1,194 @@
+/**
+ * @file client_table.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Flat table of per-client state indexed by small integer ids.
+ * @version 0.1
+ * @date 2024-11-26
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <optional>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Fixed-capacity table of elements addressed by ids in [0, capacity)
+ *
+ * @note All slots are allocated up front and elements are constructed in
+ * place, so they never move and references stay valid until the element is
+ * erased. Iteration walks the slots in id order up to the highest occupied
+ * one. Vacant ids are kept on a stack, so finding one takes constant time.
+ *
+ * @tparam T element type, does not have to be movable
+ */
+template <class T>
+struct ClientTable {
+    explicit ClientTable(size_t capacity = 0)
+        : slots_(capacity), stacked_(capacity, true) {
+        // The lowest ids are handed out first.
+        for (size_t id = capacity; id > 0; --id) {
+            free_ids_.push_back((int)id - 1);
+        }
+    }
+
+    ClientTable(const ClientTable&) = delete;
+    ClientTable& operator=(const ClientTable&) = delete;
+
+    ClientTable(ClientTable&&) = default;
+    ClientTable& operator=(ClientTable&&) = default;
+
+    size_t capacity() const { return slots_.size(); }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    bool full() const { return size_ == slots_.size(); }
+
+    bool contains(int id) const {
+        return id >= 0 && (size_t)id < slots_.size() &&
+               slots_[(size_t)id].has_value();
+    }
+
+    T* find(int id) { return contains(id) ? &*slots_[(size_t)id] : nullptr; }
+
+    const T* find(int id) const {
+        return contains(id) ? &*slots_[(size_t)id] : nullptr;
+    }
+
+    T& operator[](int id) {
+        assert(contains(id));
+        return *slots_[(size_t)id];
+    }
+
+    const T& operator[](int id) const {
+        assert(contains(id));
+        return *slots_[(size_t)id];
+    }
+
+    /**
+     * @brief Construct the element with the id unless it already exists
+     *
+     * @param id element id
+     * @return the element (nullptr if the id is out of range) and whether it
+     * was constructed by this call
+     */
+    std::pair<T*, bool> try_emplace(int id) {
+        if (id < 0 || (size_t)id >= slots_.size()) return {nullptr, false};
+
+        std::optional<T>& slot = slots_[(size_t)id];
+        if (slot) return {&*slot, false};
+
+        slot.emplace();
+        ++size_;
+        end_ = std::max(end_, (size_t)id + 1);
+
+        return {&*slot, true};
+    }
+
+    /**
+     * @brief Find an id not taken by an element, the last one freed first
+     *
+     * @return the id, or -1 if the table is full
+     */
+    int vacant_id() {
+        // Ids taken through try_emplace() are left on the stack until here.
+        while (!free_ids_.empty() && slots_[(size_t)free_ids_.back()]) {
+            stacked_[(size_t)free_ids_.back()] = false;
+            free_ids_.pop_back();
+        }
+
+        return free_ids_.empty() ? -1 : free_ids_.back();
+    }
+
+    void erase(int id) {
+        if (!contains(id)) return;
+
+        slots_[(size_t)id].reset();
+        --size_;
+
+        release_id((size_t)id);
+
+        while (end_ > 0 && !slots_[end_ - 1]) --end_;
+    }
+
+    void clear() {
+        for (size_t id = 0; id < end_; ++id) {
+            if (!slots_[id]) continue;
+
+            slots_[id].reset();
+            release_id(id);
+        }
+
+        size_ = 0;
+        end_ = 0;
+    }
+
+    /**
+     * @brief Iterator over occupied slots
+     *
+     * @note Dereferences to an (id, element) pair. Erasing elements while
+     * iterating is allowed, the end is checked against the current highest
+     * occupied slot.
+     */
+    struct Sentinel {};
+
+    template <class Table, class Value>
+    struct BasicIterator {
+        std::pair<int, Value&> operator*() const {
+            return {(int)id, *table->slots_[id]};
+        }
+
+        BasicIterator& operator++() {
+            ++id;
+            skip_vacant();
+            return *this;
+        }
+
+        bool operator==(Sentinel) const { return id >= table->end_; }
+
+        void skip_vacant() {
+            while (id < table->end_ && !table->slots_[id]) ++id;
+        }
+
+        Table* table = nullptr;
+        size_t id = 0;
+    };
+
+    using Iterator = BasicIterator<ClientTable, T>;
+    using ConstIterator = BasicIterator<const ClientTable, const T>;
+
+    Iterator begin() { return make_iterator<Iterator>(this); }
+    ConstIterator begin() const { return make_iterator<ConstIterator>(this); }
+
+    Sentinel end() const { return {}; }
+
+   private:
+    void release_id(size_t id) {
+        if (stacked_[id]) return;
+
+        stacked_[id] = true;
+        free_ids_.push_back((int)id);
+    }
+
+    template <class It, class Table>
+    static It make_iterator(Table* table) {
+        It iter{.table = table, .id = 0};
+        iter.skip_vacant();
+        return iter;
+    }
+
+    std::vector<std::optional<T>> slots_{};
+
+    // Vacant ids, and ids taken since they were pushed.
+    std::vector<int> free_ids_{};
+    std::vector<bool> stacked_{};  // indexed by id, whether on free_ids_
+
+    size_t size_ = 0;
+    size_t end_ = 0;  // past the highest occupied slot
+};
@@ -0,0 +1,140 @@
+/**
+ * @file mpsc_queue.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Bounded lock-free multi-producer single-consumer queue.
+ * @version 0.1
+ * @date 2024-11-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+/**
+ * @brief Ring buffer any number of threads push to and one thread pops from
+ *
+ * @note Every cell carries a sequence number telling whose turn it is.
+ * Producers claim a cell by advancing the tail with a compare-and-swap and
+ * publish it by bumping its sequence, so a full queue makes push() fail
+ * instead of waiting. A cell claimed but not yet published hides the cells
+ * after it from pop() until the producer is done.
+ *
+ * @tparam T element type, default-constructible
+ * @tparam Capacity maximum element count (power of two)
+ */
+template <class T, size_t Capacity>
+struct MpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "Queue capacity must be a power of two");
+
+    MpscQueue() {
+        for (size_t index = 0; index < Capacity; ++index) {
+            cells_[index].sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    /**
+     * @brief Append the element (any thread)
+     *
+     * @param value element to append
+     * @return false if the queue is full
+     */
+    bool push(T value) {
+        return push_with([&value](T& slot) { slot = std::move(value); });
+    }
+
+    /**
+     * @brief Append an element built in place (any thread)
+     *
+     * @param fill functor called as fill(T&) on the claimed cell, which
+     * holds whatever the consumer left in it
+     * @return false if the queue is full
+     */
+    template <class Fill>
+    bool push_with(Fill&& fill) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+
+        while (true) {
+            cell = &cells_[tail & (Capacity - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+
+            intptr_t lag = (intptr_t)sequence - (intptr_t)tail;
+
+            // The cell still holds the element pushed a lap ago.
+            if (lag < 0) return false;
+
+            if (lag == 0 && tail_.compare_exchange_weak(
+                                tail, tail + 1, std::memory_order_relaxed)) {
+                break;
+            }
+
+            // Another producer took the cell.
+            if (lag > 0) tail = tail_.load(std::memory_order_relaxed);
+        }
+
+        fill(cell->value);
+        cell->sequence.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /**
+     * @brief Extract the oldest element (consumer thread only)
+     *
+     * @return the element, or nothing if the queue is empty
+     */
+    std::optional<T> pop() {
+        std::optional<T> value{};
+        pop_with([&value](T& slot) { value = std::exchange(slot, T{}); });
+
+        return value;
+    }
+
+    /**
+     * @brief Hand the oldest element to the functor without copying it out
+     * (consumer thread only)
+     *
+     * @param visit functor called as visit(T&), whatever it leaves in the
+     * cell is overwritten by a later push
+     * @return false if the queue is empty
+     */
+    template <class Visit>
+    bool pop_with(Visit&& visit) {
+        Cell& cell = cells_[head_ & (Capacity - 1)];
+
+        if (cell.sequence.load(std::memory_order_acquire) != head_ + 1) {
+            return false;
+        }
+
+        visit(cell.value);
+        cell.sequence.store(head_ + Capacity, std::memory_order_release);
+        ++head_;
+
+        return true;
+    }
+
+   private:
+    static const size_t CACHE_LINE = 64;  // bytes
+
+    struct Cell {
+        std::atomic<size_t> sequence = 0;
+        T value{};
+    };
+
+    alignas(CACHE_LINE) std::atomic<size_t> tail_ = 0;
+    alignas(CACHE_LINE) size_t head_ = 0;
+
+    alignas(CACHE_LINE) Cell cells_[Capacity] = {};
+};
@@ -0,0 +1,79 @@
+/**
+ * @file spsc_queue.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Bounded lock-free single-producer single-consumer queue.
+ * @version 0.1
+ * @date 2024-11-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <atomic>
+#include <optional>
+
+/**
+ * @brief Ring buffer with one pushing and one popping thread
+ *
+ * @tparam T element type
+ * @tparam Capacity maximum element count (power of two)
+ */
+template <class T, size_t Capacity>
+struct SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "Queue capacity must be a power of two");
+
+    /**
+     * @brief Append the element (producer thread only)
+     *
+     * @param value element to append
+     * @return false if the queue is full
+     */
+    bool push(const T& value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail - cached_head_ == Capacity) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail - cached_head_ == Capacity) return false;
+        }
+
+        buffer_[tail & (Capacity - 1)] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /**
+     * @brief Extract the oldest element (consumer thread only)
+     *
+     * @return the element, or nothing if the queue is empty
+     */
+    std::optional<T> pop() {
+        size_t head = head_.load(std::memory_order_relaxed);
+
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_) return {};
+        }
+
+        T value = buffer_[head & (Capacity - 1)];
+        head_.store(head + 1, std::memory_order_release);
+
+        return value;
+    }
+
+   private:
+    static const size_t CACHE_LINE = 64;  // bytes
+
+    alignas(CACHE_LINE) std::atomic<size_t> head_ = 0;
+    size_t cached_tail_ = 0;
+
+    alignas(CACHE_LINE) std::atomic<size_t> tail_ = 0;
+    size_t cached_head_ = 0;
+
+    alignas(CACHE_LINE) T buffer_[Capacity] = {};
+};
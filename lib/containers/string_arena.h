@@ -0,0 +1,140 @@
+/**
+ * @file string_arena.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Append-only list of strings stored back to back in one buffer.
+ * @version 0.1
+ * @date 2024-11-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string_view>
+#include <vector>
+
+#include "networking/serialization.h"
+
+/**
+ * @brief Monotonic string storage that is also its own wire encoding
+ *
+ * @note The buffer holds exactly what std::vector<std::string> encodes to in
+ * the later wire versions: a varint count, then every string as a varint
+ * length and the bytes. It is serialized with a single copy and decoded by
+ * the peer as a vector of strings. The first version's encoding, with fixed
+ * width lengths, is built when it is asked for. clear() keeps the memory, so
+ * the arena stops allocating once it has grown to the longest list it held.
+ */
+struct StringArena {
+    explicit StringArena(size_t reserved = 0) {
+        bytes_.reserve(MAX_VARINT_SIZE + reserved);
+        clear();
+    }
+
+    /**
+     * @brief Append a copy of the string
+     *
+     * @warning Invalidates views returned earlier.
+     *
+     * @param value string to append
+     * @return view of the stored copy
+     */
+    std::string_view append(std::string_view value) {
+        char length[MAX_VARINT_SIZE] = {};
+        size_t length_size = encode_varint(value.size(), length);
+        bytes_.insert(bytes_.end(), length, length + length_size);
+
+        size_t offset = bytes_.size() - count_size_;
+        bytes_.insert(bytes_.end(), value.begin(), value.end());
+
+        spans_.push_back({.offset = offset, .len = value.size()});
+        set_count(spans_.size());
+
+        return (*this)[spans_.size() - 1];
+    }
+
+    /**
+     * @brief Drop every string, keeping the memory
+     *
+     */
+    void clear() {
+        bytes_.clear();
+        spans_.clear();
+
+        bytes_.push_back(0);
+        count_size_ = 1;
+
+        fixed_.clear();
+        fixed_count_ = 0;
+    }
+
+    std::string_view operator[](size_t id) const {
+        assert(id < spans_.size());
+        return {bytes_.data() + count_size_ + spans_[id].offset,
+                spans_[id].len};
+    }
+
+    size_t size() const { return spans_.size(); }
+    bool empty() const { return spans_.empty(); }
+
+    std::string_view back() const { return (*this)[spans_.size() - 1]; }
+
+    /**
+     * @brief Encoding of the list as std::vector<std::string>
+     *
+     * @param version wire version of the receiving connection
+     */
+    std::string_view wire_encoded(WireVersion version) const {
+        if (version != WireVersion::V1) {
+            return {bytes_.data(), bytes_.size()};
+        }
+
+        if (fixed_.empty() || fixed_count_ != spans_.size()) {
+            fixed_.clear();
+
+            WireWriter writer(fixed_);
+            writer.put((uint32_t)spans_.size());
+            for (size_t id = 0; id < spans_.size(); ++id) {
+                writer.put((*this)[id]);
+            }
+
+            fixed_count_ = spans_.size();
+        }
+
+        return {fixed_.data(), fixed_.size()};
+    }
+
+   private:
+    struct Span {
+        size_t offset = 0;  // past the count
+        size_t len = 0;
+    };
+
+    // The count grows a byte now and then, the strings move along.
+    void set_count(size_t count) {
+        char encoded[MAX_VARINT_SIZE] = {};
+        size_t size = encode_varint(count, encoded);
+
+        if (size > count_size_) {
+            bytes_.insert(bytes_.begin(), size - count_size_, 0);
+            count_size_ = size;
+        }
+
+        memcpy(bytes_.data(), encoded, size);
+    }
+
+    std::vector<char> bytes_{};
+    size_t count_size_ = 0;  // bytes the varint count takes
+
+    std::vector<Span> spans_{};
+
+    // First wire version encoding, rebuilt once strings are added.
+    mutable std::vector<char> fixed_{};
+    mutable size_t fixed_count_ = 0;
+};
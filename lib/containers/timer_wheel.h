@@ -0,0 +1,385 @@
+/**
+ * @file timer_wheel.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Hierarchical timing wheel with constant-time arming and cancelling.
+ * @version 0.1
+ * @date 2024-11-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Set of timers carrying a value each, expiring with millisecond
+ * resolution
+ *
+ * @note Levels of 64 slots cover ever coarser time spans, a timer sits in
+ * the finest level whose span reaches its expiry and moves one level down
+ * whenever the wheel turns to its slot. Arming and cancelling only link or
+ * unlink a node, and finding the next slot to turn to scans one occupancy
+ * word per level, so the cost per timer does not grow with their number.
+ * Timers further out than the top level (about two years) wait in an
+ * overflow list checked once per top level turn.
+ *
+ * @tparam T value handed back on expiry, default-constructible
+ */
+template <class T>
+struct TimerWheel {
+    using Clock = std::chrono::steady_clock;
+    using TimerId = uint64_t;
+
+    static constexpr TimerId NO_TIMER = 0;
+
+    explicit TimerWheel(Clock::time_point origin = Clock::now())
+        : origin_(origin), nodes_(FIRST_TIMER) {
+        for (uint32_t head = 0; head < FIRST_TIMER; ++head) {
+            nodes_[head].prev = nodes_[head].next = head;
+        }
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    void reserve(size_t count) { nodes_.reserve(FIRST_TIMER + count); }
+
+    /**
+     * @brief Arm a timer
+     *
+     * @param at expiry time, timers already due expire on the next advance()
+     * @param value value to hand back on expiry
+     * @return timer id, never NO_TIMER
+     */
+    TimerId arm(Clock::time_point at, T value) {
+        uint32_t index = allocate();
+
+        Node& node = nodes_[index];
+        node.expires = to_tick(at, true);
+        node.value = std::move(value);
+
+        place(index);
+        ++size_;
+
+        return make_id(index);
+    }
+
+    /**
+     * @brief Disarm a timer
+     *
+     * @param timer timer id, expired and cancelled timers are ignored
+     * @return true if the timer was armed
+     */
+    bool cancel(TimerId timer) {
+        uint32_t index = find(timer);
+        if (index == NIL) return false;
+
+        unlink(index);
+        release(index);
+        --size_;
+
+        return true;
+    }
+
+    bool is_armed(TimerId timer) const { return find(timer) != NIL; }
+
+    /**
+     * @brief Time the wheel has to be advanced at next
+     *
+     * @note May come before the earliest expiry, when a coarse slot has to be
+     * spread over the finer levels first.
+     *
+     * @return time point, Clock::time_point::max() if nothing is armed
+     */
+    Clock::time_point next_expiry() const {
+        if (empty()) return Clock::time_point::max();
+
+        return origin_ + std::chrono::milliseconds(next_event_tick());
+    }
+
+    /**
+     * @brief Event loop wait until next_expiry()
+     *
+     * @param now current time
+     * @return timeout in milliseconds, -1 if nothing is armed
+     */
+    int timeout_ms(Clock::time_point now = Clock::now()) const {
+        if (empty()) return -1;
+
+        uint64_t tick = next_event_tick();
+        uint64_t current = to_tick(now);
+
+        if (tick <= current) return 0;
+
+        return (int)std::min<uint64_t>(tick - current, INT32_MAX);
+    }
+
+    /**
+     * @brief Expire every timer due by now
+     *
+     * @note The handler may arm and cancel timers, including the ones due in
+     * the same call.
+     *
+     * @param now current time
+     * @param on_expired functor called as on_expired(TimerId, T&)
+     * @return number of expired timers
+     */
+    template <class Handler>
+    size_t advance(Clock::time_point now, Handler&& on_expired) {
+        uint64_t target = to_tick(now);
+        size_t expired = 0;
+
+        while (!empty()) {
+            uint64_t tick = next_event_tick();
+            if (tick > target) break;
+
+            expired += turn_to(tick, on_expired);
+        }
+
+        now_ = std::max(now_, target);
+
+        return expired;
+    }
+
+   private:
+    static constexpr unsigned SLOT_BITS = 6;
+    static constexpr uint32_t SLOT_COUNT = 1u << SLOT_BITS;
+    static constexpr unsigned LEVEL_COUNT = 6;
+    static constexpr unsigned WHEEL_BITS = SLOT_BITS * LEVEL_COUNT;
+
+    // List heads come first in the node pool.
+    static constexpr uint32_t OVERFLOW_LIST = LEVEL_COUNT * SLOT_COUNT;
+    static constexpr uint32_t FIRING_LIST = OVERFLOW_LIST + 1;
+    static constexpr uint32_t FIRST_TIMER = FIRING_LIST + 1;
+
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct Node {
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+        uint32_t list = NIL;  // head of the list holding the node
+        uint32_t generation = 1;
+
+        uint64_t expires = 0;  // tick
+
+        T value{};
+    };
+
+    static uint64_t digit(uint64_t tick, unsigned level) {
+        return (tick >> (level * SLOT_BITS)) & (SLOT_COUNT - 1);
+    }
+
+    // Expiries round up, so that timers never fire early.
+    uint64_t to_tick(Clock::time_point at, bool round_up = false) const {
+        if (at <= origin_) return 0;
+
+        Clock::duration elapsed = at - origin_;
+        auto ticks = round_up
+                         ? std::chrono::ceil<std::chrono::milliseconds>(elapsed)
+                         : std::chrono::floor<std::chrono::milliseconds>(
+                               elapsed);
+
+        return (uint64_t)ticks.count();
+    }
+
+    TimerId make_id(uint32_t index) const {
+        return (TimerId)nodes_[index].generation << 32 | index;
+    }
+
+    uint32_t find(TimerId timer) const {
+        uint32_t index = (uint32_t)timer;
+        uint32_t generation = (uint32_t)(timer >> 32);
+
+        if (index < FIRST_TIMER || index >= nodes_.size()) return NIL;
+
+        const Node& node = nodes_[index];
+        if (node.generation != generation || node.list == NIL) return NIL;
+
+        return index;
+    }
+
+    uint32_t allocate() {
+        if (free_ == NIL) {
+            nodes_.emplace_back();
+            return (uint32_t)(nodes_.size() - 1);
+        }
+
+        uint32_t index = free_;
+        free_ = nodes_[index].next;
+
+        return index;
+    }
+
+    void release(uint32_t index) {
+        Node& node = nodes_[index];
+
+        node.value = T{};
+        node.list = NIL;
+
+        // Ids of the old timer must not match the next one.
+        if (++node.generation == 0) node.generation = 1;
+
+        node.next = free_;
+        free_ = index;
+    }
+
+    void link(uint32_t index, uint32_t head) {
+        Node& node = nodes_[index];
+
+        node.list = head;
+        node.prev = nodes_[head].prev;
+        node.next = head;
+
+        nodes_[node.prev].next = index;
+        nodes_[head].prev = index;
+
+        if (head < OVERFLOW_LIST) {
+            occupied_[head / SLOT_COUNT] |= 1ull << (head % SLOT_COUNT);
+        }
+    }
+
+    void unlink(uint32_t index) {
+        Node& node = nodes_[index];
+        uint32_t head = node.list;
+
+        nodes_[node.prev].next = node.next;
+        nodes_[node.next].prev = node.prev;
+        node.list = NIL;
+
+        if (head < OVERFLOW_LIST && nodes_[head].next == head) {
+            occupied_[head / SLOT_COUNT] &= ~(1ull << (head % SLOT_COUNT));
+        }
+    }
+
+    // Timers past due are placed at the current tick.
+    void place(uint32_t index) {
+        uint64_t key = std::max(nodes_[index].expires, now_);
+
+        uint64_t differ = key ^ now_;
+        unsigned level =
+            differ == 0 ? 0 : (63u - (unsigned)__builtin_clzll(differ)) /
+                                  SLOT_BITS;
+
+        if (level >= LEVEL_COUNT) {
+            link(index, OVERFLOW_LIST);
+            return;
+        }
+
+        link(index, level * SLOT_COUNT + (uint32_t)digit(key, level));
+    }
+
+    static bool is_turn_start(uint64_t tick, unsigned bits) {
+        return (tick & ((1ull << bits) - 1)) == 0;
+    }
+
+    // Tick of the nearest slot to turn to. Occupied slots are never behind
+    // the current digit of their level, so each level has one candidate.
+    uint64_t next_event_tick() const {
+        uint64_t nearest = UINT64_MAX;
+
+        for (unsigned level = 0; level < LEVEL_COUNT; ++level) {
+            uint64_t current = digit(now_, level);
+
+            // The current slot is still pending only if its turn has not
+            // started yet.
+            uint64_t from = current;
+            if (!is_turn_start(now_, level * SLOT_BITS)) ++from;
+            if (from >= SLOT_COUNT) continue;
+
+            uint64_t ahead = occupied_[level] & (~0ull << from);
+            if (ahead == 0) continue;
+
+            unsigned span_bits = (level + 1) * SLOT_BITS;
+            uint64_t base = now_ >> span_bits << span_bits;
+
+            nearest = std::min(nearest, base | (uint64_t)__builtin_ctzll(ahead)
+                                                   << (level * SLOT_BITS));
+        }
+
+        if (nodes_[OVERFLOW_LIST].next != OVERFLOW_LIST) {
+            uint64_t turn = is_turn_start(now_, WHEEL_BITS)
+                                ? now_
+                                : ((now_ >> WHEEL_BITS) + 1) << WHEEL_BITS;
+            nearest = std::min(nearest, turn);
+        }
+
+        return nearest;
+    }
+
+    // Timers still past the top level go back to the overflow list, so only
+    // the ones linked at the start are moved.
+    void cascade(uint32_t head) {
+        size_t count = 0;
+        for (uint32_t index = nodes_[head].next; index != head;
+             index = nodes_[index].next) {
+            ++count;
+        }
+
+        for (; count > 0; --count) {
+            uint32_t index = nodes_[head].next;
+
+            unlink(index);
+            place(index);
+        }
+    }
+
+    template <class Handler>
+    size_t turn_to(uint64_t tick, Handler& on_expired) {
+        now_ = tick;
+
+        // Coarse slots reaching the tick are spread over the finer levels.
+        if (is_turn_start(tick, WHEEL_BITS)) cascade(OVERFLOW_LIST);
+
+        for (unsigned level = LEVEL_COUNT - 1; level > 0; --level) {
+            if (!is_turn_start(tick, level * SLOT_BITS)) continue;
+
+            cascade(level * SLOT_COUNT + (uint32_t)digit(tick, level));
+        }
+
+        // Timers armed by the handlers go after this tick.
+        uint32_t slot = (uint32_t)digit(tick, 0);
+        while (nodes_[slot].next != slot) {
+            uint32_t index = nodes_[slot].next;
+
+            unlink(index);
+            link(index, FIRING_LIST);
+        }
+
+        now_ = tick + 1;
+
+        size_t expired = 0;
+        while (nodes_[FIRING_LIST].next != FIRING_LIST) {
+            uint32_t index = nodes_[FIRING_LIST].next;
+            TimerId timer = make_id(index);
+
+            unlink(index);
+
+            T value = std::move(nodes_[index].value);
+            release(index);
+            --size_;
+
+            on_expired(timer, value);
+            ++expired;
+        }
+
+        return expired;
+    }
+
+    Clock::time_point origin_{};
+    uint64_t now_ = 0;  // next tick to turn to
+
+    std::vector<Node> nodes_{};
+    uint32_t free_ = NIL;
+    size_t size_ = 0;
+
+    uint64_t occupied_[LEVEL_COUNT] = {};
+};
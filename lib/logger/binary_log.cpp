@@ -0,0 +1,455 @@
+#include "binary_log.h"
+
+#include <errno.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+static const char LOG_CUT_MARK[] = "...\n";
+
+/**
+ * @brief Call site read back from the log.
+ */
+struct DecodedSite {
+    std::string tag{};
+    std::string file{};
+    int line = 0;
+    std::string format{};
+};
+
+/**
+ * @brief Encoded argument read back from the log.
+ */
+struct DecodedArg {
+    LogArg kind = LogArg::SIGNED;
+    size_t size = 0;
+    uint64_t bits = 0;
+    std::string text{};
+};
+
+/**
+ * @brief Reader over the encoded arguments of one message.
+ */
+struct ArgReader {
+    ArgReader(const char* bytes, size_t length)
+        : bytes_(bytes), length_(length) {}
+
+    bool next(DecodedArg& arg) {
+        if (used_ + 1 > length_) return false;
+
+        arg.kind = (LogArg)bytes_[used_];
+        arg.size = 0;
+        arg.bits = 0;
+        arg.text.clear();
+
+        if (arg.kind == LogArg::CUT) return false;
+
+        if (arg.kind == LogArg::STRING || arg.kind == LogArg::CUT_STRING) {
+            uint16_t text_length = 0;
+            if (used_ + 1 + sizeof(text_length) > length_) return false;
+
+            memcpy(&text_length, bytes_ + used_ + 1, sizeof(text_length));
+            used_ += 1 + sizeof(text_length);
+
+            if (used_ + text_length > length_) return false;
+
+            arg.text.assign(bytes_ + used_, text_length);
+            used_ += text_length;
+
+            return true;
+        }
+
+        if (used_ + 2 + sizeof(arg.bits) > length_) return false;
+
+        arg.size = (unsigned char)bytes_[used_ + 1];
+        memcpy(&arg.bits, bytes_ + used_ + 2, sizeof(arg.bits));
+        used_ += 2 + sizeof(arg.bits);
+
+        return true;
+    }
+
+   private:
+    const char* bytes_ = NULL;
+    size_t length_ = 0;
+    size_t used_ = 0;
+};
+
+static long long arg_as_signed(const DecodedArg& arg) {
+    switch (arg.kind) {
+        case LogArg::DOUBLE: {
+            double value = 0;
+            memcpy(&value, &arg.bits, sizeof(value));
+            return (long long)value;
+        }
+        case LogArg::STRING:
+        case LogArg::CUT_STRING:
+            return 0;
+        case LogArg::SIGNED:
+        case LogArg::UNSIGNED:
+        case LogArg::POINTER:
+        case LogArg::CUT:
+        default:
+            return (long long)arg.bits;
+    }
+}
+
+static unsigned long long arg_as_unsigned(const DecodedArg& arg) {
+    unsigned long long value = (unsigned long long)arg_as_signed(arg);
+
+    // Negative values print as they would have in their own width.
+    if (arg.kind == LogArg::SIGNED && arg.size < sizeof(value)) {
+        value &= (1ull << (arg.size * 8)) - 1;
+    }
+
+    return value;
+}
+
+static double arg_as_double(const DecodedArg& arg) {
+    if (arg.kind != LogArg::DOUBLE) return (double)arg_as_signed(arg);
+
+    double value = 0;
+    memcpy(&value, &arg.bits, sizeof(value));
+
+    return value;
+}
+
+static bool is_string(const DecodedArg& arg) {
+    return arg.kind == LogArg::STRING || arg.kind == LogArg::CUT_STRING;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+/**
+ * @brief Print one conversion the way printf() would have.
+ *
+ * @param output text output
+ * @param spec conversion without length modifiers, the conversion last
+ * @param arg converted argument
+ */
+static void print_conversion(FILE* output, std::string& spec,
+                             const DecodedArg& arg) {
+    char conversion = spec.back();
+
+    switch (conversion) {
+        case 'd':
+        case 'i':
+            spec.insert(spec.size() - 1, "ll");
+            fprintf(output, spec.c_str(), arg_as_signed(arg));
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            spec.insert(spec.size() - 1, "ll");
+            fprintf(output, spec.c_str(), arg_as_unsigned(arg));
+            break;
+        case 'c':
+            fprintf(output, spec.c_str(), (int)arg_as_signed(arg));
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            fprintf(output, spec.c_str(), arg_as_double(arg));
+            break;
+        case 'p':
+            if (is_string(arg)) {
+                spec.back() = 's';
+                fprintf(output, spec.c_str(), "(?)");
+            } else {
+                fprintf(output, spec.c_str(), (void*)(uintptr_t)arg.bits);
+            }
+            break;
+        case 's':
+            if (is_string(arg)) {
+                fprintf(output, spec.c_str(), arg.text.c_str());
+            } else {
+                fprintf(output, spec.c_str(), "(?)");
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+#pragma GCC diagnostic pop
+
+/**
+ * @brief Print the message as printf() would have printed it at the call.
+ *
+ * @param output text output
+ * @param format format string of the call site
+ * @param args encoded arguments
+ * @param length length of the encoded arguments
+ */
+static void print_message(FILE* output, const std::string& format,
+                          const char* args, size_t length) {
+    ArgReader reader(args, length);
+    DecodedArg arg{};
+
+    const char* cursor = format.c_str();
+
+    while (*cursor) {
+        if (*cursor != '%') {
+            fputc(*cursor++, output);
+            continue;
+        }
+
+        if (cursor[1] == '%') {
+            fputc('%', output);
+            cursor += 2;
+            continue;
+        }
+
+        // Rebuilt with star widths filled in and length modifiers dropped.
+        std::string spec = "%";
+        ++cursor;
+
+        while (*cursor && strchr("-+ #0'", *cursor)) spec += *cursor++;
+
+        bool complete = true;
+        for (int part = 0; part < 2; ++part) {
+            if (part == 1) {
+                if (*cursor != '.') break;
+                spec += *cursor++;
+            }
+
+            if (*cursor == '*') {
+                if (!reader.next(arg)) complete = false;
+                spec += std::to_string(complete ? arg_as_signed(arg) : 0);
+                ++cursor;
+            }
+
+            while (*cursor >= '0' && *cursor <= '9') spec += *cursor++;
+        }
+
+        while (*cursor && strchr("hlLqjzt", *cursor)) ++cursor;
+
+        if (!*cursor) break;
+
+        char conversion = *cursor++;
+        spec += conversion;
+
+        if (!complete || !reader.next(arg)) {
+            fputs(LOG_CUT_MARK, output);
+            return;
+        }
+
+        if (conversion != 'n') print_conversion(output, spec, arg);
+
+        if (arg.kind == LogArg::CUT_STRING) {
+            fputs(LOG_CUT_MARK, output);
+            return;
+        }
+    }
+}
+
+uint64_t _log_pointer_arguments(const char* format) {
+    uint64_t pointers = 0;
+    unsigned index = 0;
+
+    while ((format = strchr(format, '%'))) {
+        ++format;
+
+        if (*format == '%') {
+            ++format;
+            continue;
+        }
+
+        for (; *format && strchr("-+ #0'123456789.*hlLqjzt", *format);
+             ++format) {
+            if (*format == '*') ++index;
+        }
+
+        if (!*format) break;
+
+        if (*format == 'p' && index < 64) pointers |= 1ull << index;
+
+        ++index;
+        ++format;
+    }
+
+    return pointers;
+}
+
+/**
+ * @brief Byte reader over the binary log file.
+ */
+struct EntryReader {
+    explicit EntryReader(FILE* input) : input_(input) {}
+
+    template <class T>
+    bool read(T& value) {
+        return fread(&value, sizeof(value), 1, input_) == 1;
+    }
+
+    bool read(std::string& text, size_t length) {
+        text.resize(length);
+        return length == 0 || fread(text.data(), length, 1, input_) == 1;
+    }
+
+   private:
+    FILE* input_ = NULL;
+};
+
+/**
+ * @brief State of the decoder between entries.
+ */
+struct DecoderState {
+    uint64_t ticks_per_second = 1;
+    uint64_t sync_ticks = 0;
+    int64_t sync_nanoseconds = 0;
+
+    std::vector<DecodedSite> sites{};
+
+    time_t stamp_time = -1;
+    char stamp[32] = {};
+    bool in_session = false;
+
+    const char* get_stamp(uint64_t ticks) {
+        double offset = ((double)ticks - (double)sync_ticks) /
+                        (double)ticks_per_second;
+        double seconds = (double)sync_nanoseconds / 1e9 + offset;
+
+        // Timestamps have a resolution of a second.
+        time_t time = (time_t)seconds;
+        if (time == stamp_time) return stamp;
+        stamp_time = time;
+
+        struct tm time_info = {};
+        localtime_r(&stamp_time, &time_info);
+        asctime_r(&time_info, stamp);
+        stamp[strlen(stamp) - 1] = '\0';
+
+        return stamp;
+    }
+};
+
+static bool decode_session(EntryReader& reader, DecoderState& state,
+                           FILE* output) {
+    char magic[sizeof(LOG_BINARY_MAGIC)] = {};
+    if (!reader.read(magic) || !reader.read(state.ticks_per_second)) {
+        return false;
+    }
+
+    if (memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) != 0) return false;
+    if (state.ticks_per_second == 0) return false;
+
+    state.sites.clear();
+
+    if (state.in_session) fprintf(output, "</pre>\n");
+    fprintf(output, "<pre>");
+    state.in_session = true;
+
+    return true;
+}
+
+static bool decode_site(EntryReader& reader, DecoderState& state) {
+    uint32_t id = 0;
+    DecodedSite site{};
+    uint16_t lengths[3] = {};
+
+    if (!reader.read(id) || !reader.read(site.line) || !reader.read(lengths)) {
+        return false;
+    }
+
+    if (!reader.read(site.tag, lengths[0]) ||
+        !reader.read(site.file, lengths[1]) ||
+        !reader.read(site.format, lengths[2])) {
+        return false;
+    }
+
+    if (id == 0) return false;
+    if (state.sites.size() < id) state.sites.resize(id);
+
+    state.sites[id - 1] = std::move(site);
+
+    return true;
+}
+
+static bool decode_message(EntryReader& reader, DecoderState& state,
+                           FILE* output) {
+    uint32_t id = 0;
+    uint64_t ticks = 0;
+    uint16_t length = 0;
+    std::string args{};
+
+    if (!reader.read(id) || !reader.read(ticks) || !reader.read(length) ||
+        !reader.read(args, length)) {
+        return false;
+    }
+
+    if (id == 0 || id > state.sites.size()) return false;
+
+    const DecodedSite& site = state.sites[id - 1];
+    const char* stamp = state.get_stamp(ticks);
+
+    fprintf(output, "%-20s [%s]:   ----- Called from %s:%d. -----\n", stamp,
+            site.tag.c_str(), site.file.c_str(), site.line);
+    fprintf(output, "%-20s [%s]:  ", stamp, site.tag.c_str());
+
+    print_message(output, site.format, args.data(), args.size());
+
+    return true;
+}
+
+size_t decode_binary_log(FILE* input, FILE* output, int* error_code) {
+    EntryReader reader(input);
+    DecoderState state{};
+
+    size_t decoded = 0;
+    bool intact = true;
+
+    uint8_t kind = 0;
+    while (intact && reader.read(kind)) {
+        // Everything but the session entry belongs to a session.
+        if (!state.in_session && (LogEntry)kind != LogEntry::SESSION) {
+            intact = false;
+            break;
+        }
+
+        switch ((LogEntry)kind) {
+            case LogEntry::SESSION:
+                intact = decode_session(reader, state, output);
+                break;
+            case LogEntry::SITE:
+                intact = decode_site(reader, state);
+                break;
+            case LogEntry::SYNC:
+                intact = reader.read(state.sync_ticks) &&
+                         reader.read(state.sync_nanoseconds);
+                break;
+            case LogEntry::MESSAGE:
+                intact = decode_message(reader, state, output);
+                if (intact) ++decoded;
+                break;
+            case LogEntry::DROPPED: {
+                uint64_t count = 0;
+                intact = reader.read(count);
+                if (!intact) break;
+
+                fprintf(output,
+                        "%-20s [logger]:  %llu messages were dropped, the "
+                        "queue was full.\n",
+                        state.get_stamp(state.sync_ticks),
+                        (unsigned long long)count);
+                break;
+            }
+            default:
+                intact = false;
+                break;
+        }
+    }
+
+    if (state.in_session) fprintf(output, "</pre>\n");
+
+    if (!intact && error_code) *error_code = EINVAL;
+
+    return decoded;
+}
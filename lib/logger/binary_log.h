@@ -0,0 +1,246 @@
+/**
+ * @file binary_log.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Binary log records with deferred formatting.
+ * @version 0.1
+ * @date 2024-11-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <type_traits>
+
+/**
+ * @brief Call site of log_printf(), one per macro expansion.
+ *
+ * @note Constant-initialized, the id is handed out on the first binary
+ * message from the site.
+ */
+struct LogSite {
+    const char* tag;
+    const char* file;
+    int line;
+    const char* format;
+
+    // Arguments printed with %p by position, filled in on registration.
+    uint64_t pointers = 0;
+
+    std::atomic<uint32_t> id = 0;  // 0 until registered
+};
+
+// Bytes of encoded arguments a message may carry, the rest is cut.
+static const size_t LOG_BINARY_ARGS_SIZE = 448;
+
+static const char LOG_BINARY_NAME[] = "log.bin";
+static const char LOG_BINARY_MAGIC[8] = {'K', 'L', 'O', 'G',
+                                         'B', 'I', 'N', '1'};
+
+/**
+ * @brief Entries of the binary log file, each led by its kind byte.
+ *
+ * @note SESSION: magic, u64 ticks per second. Starts a run of the program,
+ * forgets the sites of the previous one.
+ * SITE: u32 id, i32 line, u16 lengths of tag, file and format, the strings.
+ * SYNC: u64 ticks, i64 nanoseconds since the epoch at the same moment.
+ * MESSAGE: u32 site id, u64 ticks, u16 length, encoded arguments.
+ * DROPPED: u64 count of messages lost to a full queue.
+ *
+ * Numbers are in the byte order of the machine that wrote the log.
+ */
+enum class LogEntry : uint8_t {
+    SESSION = 1,
+    SITE,
+    SYNC,
+    MESSAGE,
+    DROPPED,
+};
+
+/**
+ * @brief Encoded argument kinds.
+ *
+ * @note Every argument but a string is the kind byte, its size in the call
+ * and 8 bytes of value. Strings are the kind byte, u16 length and the bytes.
+ * A string cut to fit is a CUT_STRING and ends the message, arguments that
+ * did not fit at all are replaced with a single CUT byte.
+ */
+enum class LogArg : uint8_t {
+    SIGNED = 1,
+    UNSIGNED,
+    DOUBLE,
+    POINTER,
+    STRING,
+    CUT_STRING,
+    CUT,
+};
+
+/**
+ * @brief Check if log_printf() should take the binary path.
+ *
+ * @note A true answer has to be followed by _log_binary_push(), turning the
+ * binary log off waits for it.
+ *
+ * @param importance message importance
+ * @return true if binary logging is on and the message passes the threshold
+ */
+bool _log_binary_accepts(const unsigned int importance);
+
+/**
+ * @brief Give the call site an id and note which of its arguments are
+ * printed with %p.
+ *
+ * @param site call site, may have been registered by another thread
+ * @return site id
+ */
+uint32_t _log_register_site(LogSite& site);
+
+/**
+ * @brief Find the arguments a format prints with %p.
+ *
+ * @param format format string for printf()
+ * @return bit mask of the argument positions, star widths included
+ */
+uint64_t _log_pointer_arguments(const char* format);
+
+/**
+ * @brief Queue a binary message for the background writer.
+ *
+ * @param site call site, registered if it has no id yet
+ * @param args encoded arguments
+ * @param length length of the encoded arguments
+ */
+void _log_binary_push(LogSite& site, const char* args, size_t length);
+
+inline bool _log_put_cut(char* buffer, size_t& used) {
+    buffer[used++] = (char)LogArg::CUT;
+    return false;
+}
+
+// Every argument leaves a byte for the cut mark after it.
+inline bool _log_put_arg(char* buffer, size_t& used, LogArg kind, size_t size,
+                         const void* value) {
+    if (used + 2 + sizeof(uint64_t) >= LOG_BINARY_ARGS_SIZE) {
+        return _log_put_cut(buffer, used);
+    }
+
+    buffer[used++] = (char)kind;
+    buffer[used++] = (char)size;
+    memcpy(buffer + used, value, sizeof(uint64_t));
+    used += sizeof(uint64_t);
+
+    return true;
+}
+
+inline bool _log_put_string(char* buffer, size_t& used, const char* string) {
+    if (used + 1 + sizeof(uint16_t) >= LOG_BINARY_ARGS_SIZE) {
+        return _log_put_cut(buffer, used);
+    }
+
+    if (!string) string = "(null)";
+
+    // Strings that do not fit are cut to the space left.
+    size_t space = LOG_BINARY_ARGS_SIZE - used - 1 - sizeof(uint16_t) - 1;
+    uint16_t length = (uint16_t)strnlen(string, space);
+    bool cut = string[length] != '\0';
+
+    buffer[used++] = (char)(cut ? LogArg::CUT_STRING : LogArg::STRING);
+    memcpy(buffer + used, &length, sizeof(length));
+    memcpy(buffer + used + sizeof(length), string, length);
+    used += sizeof(length) + length;
+
+    return !cut;
+}
+
+inline bool _log_is_pointer(const LogSite& site, unsigned index) {
+    return index < 64 && (site.pointers >> index & 1);
+}
+
+/**
+ * @brief Append the argument to the encoded ones.
+ *
+ * @param buffer encoded arguments, LOG_BINARY_ARGS_SIZE bytes
+ * @param used bytes already used
+ * @param value argument
+ * @param pointer whether the format prints the argument with %p
+ * @return false if the argument was cut and the message ends with it
+ */
+template <class T>
+bool _log_encode(char* buffer, size_t& used, T value, bool pointer) {
+    if constexpr (std::is_enum_v<T>) {
+        return _log_encode(buffer, used,
+                           static_cast<std::underlying_type_t<T>>(value),
+                           pointer);
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        int64_t wide = value;
+        return _log_put_arg(buffer, used, LogArg::SIGNED, sizeof(T), &wide);
+    } else if constexpr (std::is_integral_v<T>) {
+        uint64_t wide = value;
+        return _log_put_arg(buffer, used, LogArg::UNSIGNED, sizeof(T), &wide);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        double wide = value;
+        return _log_put_arg(buffer, used, LogArg::DOUBLE, sizeof(T), &wide);
+    } else if constexpr (std::is_pointer_v<T> ||
+                         std::is_null_pointer_v<T>) {
+        if constexpr (std::is_convertible_v<T, const char*>) {
+            if (!pointer) return _log_put_string(buffer, used, value);
+        }
+
+        uint64_t address = (uintptr_t)value;
+        return _log_put_arg(buffer, used, LogArg::POINTER, sizeof(T),
+                            &address);
+    } else {
+        static_assert(sizeof(T) == 0, "Type can not be logged");
+        return false;
+    }
+}
+
+/**
+ * @brief Copy the arguments of a log_printf() call to the log queue, leaving
+ * the formatting to the decoder.
+ *
+ * @param site call site holding the format string
+ * @param format format string, the same as the site's
+ * @param args arguments for printf()
+ */
+template <class... Args>
+void _log_binary(LogSite& site, const char* format, Args... args) {
+    if constexpr (sizeof...(Args) == 0) {
+        _log_binary_push(site, NULL, 0);
+        return;
+    }
+
+    // Char pointers are strings unless the format prints them with %p.
+    if (site.id.load(std::memory_order_acquire) == 0) {
+        _log_register_site(site);
+    }
+
+    char buffer[LOG_BINARY_ARGS_SIZE];
+    size_t used = 0;
+    unsigned index = 0;
+
+    (void)(_log_encode(buffer, used, args, _log_is_pointer(site, index++)) &&
+           ...);
+
+    _log_binary_push(site, buffer, used);
+}
+
+/**
+ * @brief Turn a binary log back into the text log.html holds.
+ *
+ * @param input binary log file
+ * @param output text output
+ * @param error_code (optional) variable to put EINVAL in if the log is
+ * damaged or cut short
+ * @return number of decoded messages
+ */
+size_t decode_binary_log(FILE* input, FILE* output, int* error_code = NULL);
+
+#endif
@@ -1,13 +1,80 @@
 #include "logger.h"
 
+#include <fcntl.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "containers/mpsc_queue.h"
 #include "debug.h"
 
 static FILE* logfile = NULL;
 static unsigned int log_threshold = 0;
 
+static const size_t LOG_RECORD_SIZE = 512;      // bytes
+static const size_t LOG_QUEUE_CAPACITY = 4096;  // records
+static const size_t LOG_BATCH_SIZE = 1 << 16;   // bytes
+static const int LOG_FLUSH_INTERVAL_MS = 10;
+static const int LOG_CALIBRATION_MS = 20;
+static const size_t LOG_SITE_STRING_LIMIT = 1024;  // bytes
+
+static const char LOG_CUT_MARK[] = "...\n";
+
+/**
+ * @brief Message waiting for the background writer, complete but for the
+ * timestamps.
+ *
+ * @note Binary messages carry a site id and hold encoded arguments instead of
+ * text.
+ */
+struct LogRecord {
+    time_t time = 0;
+    uint64_t ticks = 0;   // binary messages only
+    uint32_t site = 0;    // 0 for text messages
+    uint16_t split = 0;   // end of the call location line, 0 if there is none
+    uint16_t length = 0;  // bytes of text used
+    char text[LOG_RECORD_SIZE - sizeof(time_t) - sizeof(uint64_t) -
+              sizeof(uint32_t) - 2 * sizeof(uint16_t)] = {};
+};
+
+static_assert(LOG_BINARY_ARGS_SIZE <= sizeof(LogRecord::text),
+              "Encoded arguments must fit into a log record");
+
+using LogQueue = MpscQueue<LogRecord, LOG_QUEUE_CAPACITY>;
+
+static std::unique_ptr<LogQueue> log_queue{};
+static std::atomic<bool> log_async = false;
+
+static std::atomic<time_t> log_clock = 0;  // refreshed by the writer
+static std::atomic<size_t> log_dropped = 0;
+
+static std::atomic<bool> log_binary = false;
+
+// Callers between deciding to queue a message and queueing it.
+static std::atomic<size_t> log_producers = 0;
+static int log_binary_fd = -1;
+static bool log_binary_fresh = false;  // the session entry is yet to be written
+static uint64_t log_ticks_per_second = 0;
+
+// Registered call sites, site id - 1 is the index.
+static std::mutex log_sites_mutex{};
+static std::vector<const LogSite*> log_sites{};
+
+// Destroyed before the queue, stopping the writer first.
+static std::jthread log_writer{};
+
 /**
  * @brief Prints out log line prefix (time and tag).
  *
@@ -26,12 +93,49 @@ static void log_prefix(const char* tag = "status",
  */
 static FILE* log_file(const unsigned int importance = ABSOLUTE_IMPORTANCE);
 
+/**
+ * @brief Queues the message for the background writer.
+ *
+ * @param tag prefix tag
+ * @param file (optional) source file of the call
+ * @param line source line of the call
+ * @param format format string for printf()
+ * @param args arguments for printf()
+ */
+static void log_push(const char* tag, const char* file, int line,
+                     const char* format, va_list args)
+    __attribute__((format(printf, 4, 0)));
+
+/**
+ * @brief Writes out every queued message.
+ */
+static void log_drain();
+
+/**
+ * @brief Counts the caller as a producer if messages go to the queue.
+ *
+ * @param queued mode sending messages to the queue
+ * @return true if the caller has to queue the message and call log_leave()
+ */
+static bool log_enter(const std::atomic<bool>& queued);
+
+/**
+ * @brief Marks the message of log_enter() as queued.
+ */
+static void log_leave();
+
+/**
+ * @brief Writes out what is queued when the program exits.
+ */
+static void log_exit();
+
 static int log_init(const char* filename, const unsigned int threshold,
                     int* const error_code) {
     log_threshold = threshold;
 
     if ((logfile = fopen(filename, "a"))) {
         setvbuf(logfile, NULL, _IONBF, 0);
+        atexit(log_exit);
         fprintf(logfile, "<pre>");
         log_printf(ABSOLUTE_IMPORTANCE, "open", "Log file %s was opened.\n",
                    filename);
@@ -48,11 +152,13 @@ static int __log_init_caller = log_init("log.html", 0, NULL);
 static void log_prefix(const char* tag, const unsigned int importance) {
     if (!log_file()) return;
     time_t raw_time;
-    struct tm* time_info;
+    struct tm time_info = {};
+    char pc_timestamp[32] = {};
 
+    // Several threads may log at once.
     time(&raw_time);
-    time_info = localtime(&raw_time);
-    char* pc_timestamp = asctime(time_info);
+    localtime_r(&raw_time, &time_info);
+    asctime_r(&time_info, pc_timestamp);
     pc_timestamp[strlen(pc_timestamp) - 1] = '\0';
 
     fprintf(log_file(importance), "%-20s [%s]:  ", pc_timestamp, tag);
@@ -64,9 +170,36 @@ void _log_printf(const unsigned int importance, const char* tag,
     va_start(args, format);
 
     if (importance >= log_threshold && logfile) {
-        log_prefix(tag, importance);
-        vfprintf(log_file(importance), format, args);
-        fflush(log_file(importance));
+        if (log_enter(log_async)) {
+            log_push(tag, NULL, 0, format, args);
+            log_leave();
+        } else {
+            log_prefix(tag, importance);
+            vfprintf(log_file(importance), format, args);
+            fflush(log_file(importance));
+        }
+    }
+
+    va_end(args);
+}
+
+void _log_printf_from(const unsigned int importance, const char* tag,
+                      const char* file, int line, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    if (importance >= log_threshold && logfile) {
+        if (log_enter(log_async)) {
+            log_push(tag, file, line, format, args);
+            log_leave();
+        } else {
+            log_prefix(tag, importance);
+            fprintf(log_file(importance), " ----- Called from %s:%d. -----\n",
+                    file, line);
+            log_prefix(tag, importance);
+            vfprintf(log_file(importance), format, args);
+            fflush(log_file(importance));
+        }
     }
 
     va_end(args);
@@ -76,9 +209,433 @@ static FILE* log_file(const unsigned int importance) {
     return importance >= log_threshold ? logfile : NULL;
 }
 
+__attribute__((format(printf, 3, 0))) static size_t log_vappend(
+    LogRecord& record, size_t length, const char* format, va_list args) {
+    size_t space = sizeof(record.text) - length;
+
+    int written = vsnprintf(record.text + length, space, format, args);
+    if (written < 0) return length;
+    if ((size_t)written < space) return length + (size_t)written;
+
+    // Cut messages still end the line.
+    size_t end = sizeof(record.text) - 1;
+    memcpy(record.text + end - strlen(LOG_CUT_MARK), LOG_CUT_MARK,
+           strlen(LOG_CUT_MARK));
+
+    return end;
+}
+
+static size_t log_put(LogRecord& record, size_t length, const char* text) {
+    size_t len = strnlen(text, sizeof(record.text) - 1 - length);
+
+    memcpy(record.text + length, text, len);
+
+    return length + len;
+}
+
+static size_t log_put_number(LogRecord& record, size_t length, int value) {
+    char digits[16] = {};
+    size_t count = 0;
+
+    unsigned magnitude = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0) digits[count++] = '-';
+
+    while (count > 0 && length < sizeof(record.text) - 1) {
+        record.text[length++] = digits[--count];
+    }
+
+    return length;
+}
+
+static void log_push(const char* tag, const char* file, int line,
+                     const char* format, va_list args) {
+    bool queued = log_queue->push_with([&](LogRecord& record) {
+        record.time = log_clock.load(std::memory_order_relaxed);
+        record.site = 0;
+
+        // Fixed parts are copied, printf() is only paid for the message.
+        size_t length = 0;
+        if (file) {
+            length = log_put(record, length, "[");
+            length = log_put(record, length, tag);
+            length = log_put(record, length, "]:   ----- Called from ");
+            length = log_put(record, length, file);
+            length = log_put(record, length, ":");
+            length = log_put_number(record, length, line);
+            length = log_put(record, length, ". -----\n");
+        }
+
+        record.split = (uint16_t)length;
+
+        length = log_put(record, length, "[");
+        length = log_put(record, length, tag);
+        length = log_put(record, length, "]:  ");
+        length = log_vappend(record, length, format, args);
+
+        record.length = (uint16_t)length;
+    });
+
+    if (!queued) log_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+static uint64_t log_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+static uint64_t log_calibrate_ticks() {
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point start = Clock::now();
+    uint64_t start_ticks = log_ticks();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(LOG_CALIBRATION_MS));
+
+    uint64_t ticks = log_ticks() - start_ticks;
+    double seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    return (uint64_t)((double)ticks / seconds);
+}
+
+bool _log_binary_accepts(const unsigned int importance) {
+    return importance >= log_threshold && logfile && log_enter(log_binary);
+}
+
+uint32_t _log_register_site(LogSite& site) {
+    std::lock_guard<std::mutex> lock(log_sites_mutex);
+
+    // Another thread may have registered it first.
+    uint32_t id = site.id.load(std::memory_order_relaxed);
+    if (id != 0) return id;
+
+    log_sites.push_back(&site);
+    id = (uint32_t)log_sites.size();
+
+    site.pointers = _log_pointer_arguments(site.format);
+    site.id.store(id, std::memory_order_release);
+
+    return id;
+}
+
+void _log_binary_push(LogSite& site, const char* args, size_t length) {
+    uint32_t id = site.id.load(std::memory_order_acquire);
+    if (id == 0) id = _log_register_site(site);
+
+    uint64_t ticks = log_ticks();
+
+    bool queued = log_queue->push_with([&](LogRecord& record) {
+        record.ticks = ticks;
+        record.site = id;
+        record.split = 0;
+        record.length = (uint16_t)length;
+        if (length > 0) memcpy(record.text, args, length);
+    });
+
+    if (!queued) log_dropped.fetch_add(1, std::memory_order_relaxed);
+
+    log_leave();
+}
+
+static bool log_enter(const std::atomic<bool>& queued) {
+    // Pairs with set_async_logging(false) turning the mode off before it
+    // counts the producers.
+    log_producers.fetch_add(1);
+    if (queued.load()) return true;
+
+    log_leave();
+    return false;
+}
+
+static void log_leave() {
+    log_producers.fetch_sub(1, std::memory_order_release);
+}
+
+static void log_write(int fd, const char* bytes, size_t len) {
+    int saved_errno = errno;
+
+    while (len > 0) {
+        ssize_t written = write(fd, bytes, len);
+        if (written <= 0 && errno != EINTR) break;
+        if (written <= 0) continue;
+
+        bytes += written;
+        len -= (size_t)written;
+    }
+
+    errno = saved_errno;
+}
+
+/**
+ * @brief Binary log batch, written out as it fills up.
+ */
+struct LogBinaryBatch {
+    void reserve(size_t len) {
+        if (used + len <= LOG_BATCH_SIZE) return;
+
+        log_write(log_binary_fd, bytes, used);
+        used = 0;
+    }
+
+    void put(const void* data, size_t len) {
+        memcpy(bytes + used, data, len);
+        used += len;
+    }
+
+    void put_kind(LogEntry kind) { bytes[used++] = (char)kind; }
+
+    char bytes[LOG_BATCH_SIZE] = {};
+    size_t used = 0;
+};
+
+static void log_put_session(LogBinaryBatch& batch) {
+    batch.reserve(1 + sizeof(LOG_BINARY_MAGIC) + sizeof(uint64_t));
+
+    batch.put_kind(LogEntry::SESSION);
+    batch.put(LOG_BINARY_MAGIC, sizeof(LOG_BINARY_MAGIC));
+    batch.put(&log_ticks_per_second, sizeof(log_ticks_per_second));
+}
+
+static void log_put_sites(LogBinaryBatch& batch, uint32_t& written) {
+    std::lock_guard<std::mutex> lock(log_sites_mutex);
+
+    for (; written < log_sites.size(); ++written) {
+        const LogSite& site = *log_sites[written];
+
+        uint32_t id = written + 1;
+        const char* strings[] = {site.tag, site.file, site.format};
+        uint16_t lengths[3] = {};
+
+        size_t total = 0;
+        for (size_t index = 0; index < 3; ++index) {
+            lengths[index] =
+                (uint16_t)strnlen(strings[index], LOG_SITE_STRING_LIMIT);
+            total += lengths[index];
+        }
+
+        batch.reserve(1 + sizeof(id) + sizeof(site.line) + sizeof(lengths) +
+                      total);
+
+        batch.put_kind(LogEntry::SITE);
+        batch.put(&id, sizeof(id));
+        batch.put(&site.line, sizeof(site.line));
+        batch.put(lengths, sizeof(lengths));
+
+        for (size_t index = 0; index < 3; ++index) {
+            batch.put(strings[index], lengths[index]);
+        }
+    }
+}
+
+static void log_put_sync(LogBinaryBatch& batch) {
+    uint64_t ticks = log_ticks();
+    int64_t nanoseconds =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+
+    batch.reserve(1 + sizeof(ticks) + sizeof(nanoseconds));
+
+    batch.put_kind(LogEntry::SYNC);
+    batch.put(&ticks, sizeof(ticks));
+    batch.put(&nanoseconds, sizeof(nanoseconds));
+}
+
+static void log_drain() {
+    // Only one thread drains at a time: the writer, or the one stopping it.
+    static char batch[LOG_BATCH_SIZE] = {};
+    static time_t stamp_time = -1;
+    static char stamp[32] = {};
+
+    static LogBinaryBatch binary{};
+    static uint32_t sites_written = 0;
+
+    size_t used = 0;
+    bool synced = false;
+
+    auto start_binary = [&]() {
+        if (!log_binary_fresh) return;
+
+        log_put_session(binary);
+        sites_written = 0;
+
+        log_binary_fresh = false;
+    };
+
+    auto write_binary = [&](LogRecord& record) {
+        // Left over from a binary log closed since.
+        if (log_binary_fd < 0) return;
+
+        start_binary();
+
+        if (record.site > sites_written) log_put_sites(binary, sites_written);
+
+        // Decoders place ticks on the wall clock by the latest sync.
+        if (!synced) {
+            log_put_sync(binary);
+            synced = true;
+        }
+
+        binary.reserve(1 + sizeof(record.site) + sizeof(record.ticks) +
+                       sizeof(record.length) + record.length);
+
+        binary.put_kind(LogEntry::MESSAGE);
+        binary.put(&record.site, sizeof(record.site));
+        binary.put(&record.ticks, sizeof(record.ticks));
+        binary.put(&record.length, sizeof(record.length));
+        binary.put(record.text, record.length);
+    };
+
+    auto put_line = [&](const char* line, size_t len) {
+        used += (size_t)snprintf(batch + used, LOG_BATCH_SIZE - used,
+                                 "%-20s ", stamp);
+
+        memcpy(batch + used, line, len);
+        used += len;
+    };
+
+    auto write_record = [&](LogRecord& record) {
+        if (record.site != 0) {
+            write_binary(record);
+            return;
+        }
+
+        if (used + 2 * (sizeof(stamp) + LOG_RECORD_SIZE) > LOG_BATCH_SIZE) {
+            log_write(fileno(logfile), batch, used);
+            used = 0;
+        }
+
+        // Timestamps have a resolution of a second.
+        if (record.time != stamp_time) {
+            stamp_time = record.time;
+
+            struct tm time_info = {};
+            localtime_r(&stamp_time, &time_info);
+            asctime_r(&time_info, stamp);
+            stamp[strlen(stamp) - 1] = '\0';
+        }
+
+        if (record.split > 0) put_line(record.text, record.split);
+        put_line(record.text + record.split,
+                 (size_t)(record.length - record.split));
+    };
+
+    while (log_queue->pop_with(write_record)) {
+    }
+
+    size_t dropped = log_dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0 && log_binary_fd >= 0) {
+        start_binary();
+        if (!synced) log_put_sync(binary);
+
+        uint64_t count = dropped;
+        binary.reserve(1 + sizeof(count));
+
+        binary.put_kind(LogEntry::DROPPED);
+        binary.put(&count, sizeof(count));
+    } else if (dropped > 0) {
+        used += (size_t)snprintf(
+            batch + used, LOG_BATCH_SIZE - used,
+            "%-20s [logger]:  %zu messages were dropped, the queue was full.\n",
+            stamp, dropped);
+    }
+
+    log_write(fileno(logfile), batch, used);
+
+    if (log_binary_fd >= 0) {
+        log_write(log_binary_fd, binary.bytes, binary.used);
+        binary.used = 0;
+    }
+}
+
+static void log_run_writer(std::stop_token stop) {
+    while (!stop.stop_requested()) {
+        log_clock.store(time(NULL), std::memory_order_relaxed);
+
+        log_drain();
+
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+    }
+}
+
+void set_async_logging(bool enable) {
+    if (!logfile || enable == log_async.load()) return;
+
+    if (enable) {
+        if (!log_queue) log_queue = std::make_unique<LogQueue>();
+
+        log_clock.store(time(NULL), std::memory_order_relaxed);
+        log_writer = std::jthread(log_run_writer);
+
+        log_async.store(true, std::memory_order_release);
+        return;
+    }
+
+    log_binary.store(false);
+    log_async.store(false);
+
+    // Callers that saw the queue on are still pushing to it.
+    while (log_producers.load(std::memory_order_acquire) > 0) {
+        std::this_thread::yield();
+    }
+
+    log_writer.request_stop();
+    log_writer.join();
+
+    // Messages queued while the writer was stopping.
+    log_drain();
+
+    if (log_binary_fd >= 0) {
+        close(log_binary_fd);
+        log_binary_fd = -1;
+    }
+}
+
+static void log_exit() { set_async_logging(false); }
+
+void set_binary_logging(bool enable) {
+    if (!logfile || enable == log_binary.load()) return;
+
+    if (!enable) {
+        log_binary.store(false, std::memory_order_release);
+        return;
+    }
+
+    // The writer only picks up the file when it starts.
+    set_async_logging(false);
+
+    log_binary_fd =
+        open(LOG_BINARY_NAME, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_binary_fd < 0) {
+        log_printf(ERROR_REPORTS, "error", "Failed to open %s.\n",
+                   LOG_BINARY_NAME);
+        errno = 0;
+        return;
+    }
+
+    if (!log_ticks_per_second) log_ticks_per_second = log_calibrate_ticks();
+    log_binary_fresh = true;
+
+    set_async_logging(true);
+
+    log_binary.store(true, std::memory_order_release);
+}
+
 void log_close(int* error_code) {
     if (!log_file()) return;
     log_printf(ABSOLUTE_IMPORTANCE, "close", "Closing log file.\n\n");
+    set_async_logging(false);
     fprintf(log_file(ABSOLUTE_IMPORTANCE), "</pre>\n");
     if (!fclose(logfile) && error_code) *error_code = ENOENT;
 }
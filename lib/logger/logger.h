@@ -26,21 +26,32 @@ enum IMPORTANCES {
 
 #include <stdarg.h>
 
+#include "binary_log.h"
+
+#define _LOG_FORMAT(format, ...) format
+
 #ifndef NDEBUG
 
 #ifndef NLOG_PRINT_LINE
 /**
  * @brief Print message to logs followed by call information.
  *
+ * @note Messages go to the binary log unformatted while it is enabled.
+ *
  * @param importance message importance (more important = higher value)
  * @param tag prefix of the message
  * @param __VA_ARGS__ arguments as if they were in printf()
  */
-#define log_printf(importance, tag, ...)                                  \
-    do {                                                                  \
-        _log_printf(importance, tag, " ----- Called from %s:%d. -----\n", \
-                    __FILE__, __LINE__);                                  \
-        _log_printf(importance, tag, __VA_ARGS__);                        \
+#define log_printf(importance, tag, ...)                                   \
+    do {                                                                   \
+        static LogSite _log_site = {tag, __FILE__, __LINE__,               \
+                                    _LOG_FORMAT(__VA_ARGS__)};             \
+        if (_log_binary_accepts(importance)) {                             \
+            _log_binary(_log_site, __VA_ARGS__);                           \
+        } else {                                                           \
+            _log_printf_from(importance, tag, __FILE__, __LINE__,          \
+                             __VA_ARGS__);                                 \
+        }                                                                  \
     } while (0)
 #else
 /**
@@ -87,6 +98,46 @@ enum IMPORTANCES {
 void _log_printf(const unsigned int importance, const char* tag,
                  const char* format, ...) __attribute__((format(printf, 3, 4)));
 
+/**
+ * @brief Print line to logs with automatic prefix, preceded by the call
+ * location line.
+ *
+ * @param importance importance of the message
+ * @param tag message tag
+ * @param file source file of the call
+ * @param line source line of the call
+ * @param format format string for printf()
+ * @param ... arguments for printf()
+ */
+void _log_printf_from(const unsigned int importance, const char* tag,
+                      const char* file, int line, const char* format, ...)
+    __attribute__((format(printf, 5, 6)));
+
+/**
+ * @brief Move log writes to a background thread.
+ *
+ * @note Messages are formatted by the caller into a lock-free queue and
+ * written in batches every few milliseconds, stamped with a clock the writer
+ * refreshes. Messages that do not fit into a queue record are cut, and
+ * messages arriving while the queue is full are dropped and counted.
+ *
+ * @param enable true to start the writer, false to write out what is queued
+ * and go back to synchronous writes
+ */
+void set_async_logging(bool enable);
+
+/**
+ * @brief Write log_printf() messages to the binary log instead of log.html.
+ *
+ * @note Only the call site id, the raw arguments and a CPU tick count are
+ * queued, formatting is left to decode_binary_log(). Turns asynchronous
+ * logging on, and the binary log is closed when it is turned off. Messages
+ * without a call site keep going to log.html.
+ *
+ * @param enable true to start writing to log.bin, false to go back to text
+ */
+void set_binary_logging(bool enable);
+
 /**
  * @brief Close opened log file.
  *
@@ -13,15 +13,89 @@ ssize_t sys_send<NetworkProtocol::UDP>(int sock_fd, const void* buf, size_t len,
                   sizeof(address));
 }
 
+template <>
+ssize_t sys_sendv<NetworkProtocol::TCP>(int sock_fd, const iovec* parts,
+                                        size_t count, int flags, sockaddr_in) {
+    msghdr message{};
+    message.msg_iov = (iovec*)parts;
+    message.msg_iovlen = count;
+
+    return sendmsg(sock_fd, &message, flags);
+}
+
+template <>
+ssize_t sys_sendv<NetworkProtocol::UDP>(int sock_fd, const iovec* parts,
+                                        size_t count, int flags,
+                                        sockaddr_in address) {
+    msghdr message{};
+    message.msg_name = &address;
+    message.msg_namelen = sizeof(address);
+    message.msg_iov = (iovec*)parts;
+    message.msg_iovlen = count;
+
+    return sendmsg(sock_fd, &message, flags);
+}
+
 template <>
 ssize_t sys_recv<NetworkProtocol::TCP>(int sock_fd, void* buf, size_t len,
-                                       int flags, sockaddr_in) {
+                                       int flags, sockaddr_in*) {
     return recv(sock_fd, buf, len, flags);
 }
 
 template <>
 ssize_t sys_recv<NetworkProtocol::UDP>(int sock_fd, void* buf, size_t len,
-                                       int flags, sockaddr_in address) {
-    socklen_t addr_len = sizeof(address);
-    return recvfrom(sock_fd, buf, len, flags, (sockaddr*)&address, &addr_len);
-}
\ No newline at end of file
+                                       int flags, sockaddr_in* address) {
+    socklen_t addr_len = sizeof(*address);
+    return recvfrom(sock_fd, buf, len, flags, (sockaddr*)address, &addr_len);
+}
+
+int sys_sendmmsg(int sock_fd, mmsghdr* messages, size_t count, int flags) {
+    return sendmmsg(sock_fd, messages, (unsigned)count, flags);
+}
+
+ssize_t sys_send_segmented(int sock_fd, const void* buf, size_t len,
+                           size_t segment_size, sockaddr_in address) {
+    iovec part = {.iov_base = (void*)buf, .iov_len = len};
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+
+    msghdr message{};
+    message.msg_name = &address;
+    message.msg_namelen = sizeof(address);
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr* option = CMSG_FIRSTHDR(&message);
+    option->cmsg_level = SOL_UDP;
+    option->cmsg_type = UDP_SEGMENT;
+    option->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+    uint16_t size = (uint16_t)segment_size;
+    memcpy(CMSG_DATA(option), &size, sizeof(size));
+
+    return sendmsg(sock_fd, &message, 0);
+}
+
+int sys_recvmmsg(int sock_fd, mmsghdr* messages, size_t count, int flags) {
+    return recvmmsg(sock_fd, messages, (unsigned)count, flags, nullptr);
+}
+
+size_t sys_path_mtu(sockaddr_in address) {
+    // Only a connected socket reports the route MTU, a throwaway one is
+    // connected to the peer instead of the data socket.
+    int probe = socket(AF_INET, SOCK_DGRAM, 0);
+    if (probe < 0) return 0;
+
+    int mtu = 0;
+    socklen_t mtu_len = sizeof(mtu);
+
+    bool known =
+        connect(probe, (sockaddr*)&address, sizeof(address)) == 0 &&
+        getsockopt(probe, IPPROTO_IP, IP_MTU, &mtu, &mtu_len) == 0;
+
+    close(probe);
+
+    return known && mtu > 0 ? (size_t)mtu : 0;
+}
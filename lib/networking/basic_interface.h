@@ -14,13 +14,33 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <string_view>
+#include <vector>
 
+#include "coroutine.h"
+#include "payload.h"
 #include "protocols.h"
+#include "receive_buffer.h"
+#include "reliable_udp.h"
+#include "udp_demux.h"
+#include "serialization.h"
+#include "uring.h"
+#include "wire_format.h"
 
 template <NetworkProtocol Protocol>
 struct NetworkServer;
@@ -33,7 +53,11 @@ struct NetworkConnection {
     NetworkConnection() = default;
     virtual ~NetworkConnection() {
         assert(errno == 0);
-        if (close_on_destroy_) close(sock_);
+        flush_output();
+        if (reliable_) reliable_->flush(sock_, &conn_addr_, RELIABLE_LINGER_MS);
+        uring_.reset();
+        errno = 0;
+        if (close_on_destroy_ && sock_ > 0) close(sock_);
     }
 
     NetworkConnection(const NetworkConnection&) = delete;
@@ -44,12 +68,320 @@ struct NetworkConnection {
 
     bool is_dead() const { return dead_; }
 
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Bound the blocking receives and sends that follow by a deadline
+     *
+     * @note An operation still waiting for the socket once the deadline
+     * passes fails and marks the connection dead, since a message left
+     * half-transferred can not be picked up again.
+     *
+     * @param deadline time point, Clock::time_point::max() to lift the bound
+     */
+    void set_deadline(Clock::time_point deadline) { deadline_ = deadline; }
+
+    bool has_timed_out() const { return timed_out_; }
+
+    /**
+     * @brief Switch the message encoding
+     *
+     * @warning Both peers have to switch at the same message boundary, which
+     * is what the handshake is for.
+     *
+     * @param version wire version
+     */
+    void set_wire_version(WireVersion version) {
+        encoding_.version = version;
+    }
+    WireVersion wire_version() const { return encoding_.version; }
+
+    /**
+     * @brief Compress large strings and serialized values (wire version 2
+     * and newer)
+     *
+     * @note Compressed frames are only accepted while compression is on, and
+     * their decompressed body is bound by set_max_frame_size() as well. The
+     * peer has to use the same dictionary.
+     *
+     * @param threshold minimum body size worth compressing, 0 to disable
+     * @param dictionary shared LZ dictionary, has to outlive the connection
+     */
+    void set_compression(size_t threshold, std::string_view dictionary = {}) {
+        encoding_.compression_threshold = threshold;
+        encoding_.dictionary = dictionary;
+    }
+
+    const WireEncoding& encoding() const { return encoding_; }
+
+    /**
+     * @brief Bound the size of the frames the connection accepts
+     *
+     * @note A frame announcing a longer body marks the connection dead
+     * before any of the body is read.
+     *
+     * @param max_size maximum body size in bytes
+     */
+    void set_max_frame_size(size_t max_size) { max_frame_size_ = max_size; }
+
+    /**
+     * @brief Retransmit lost UDP datagrams and deliver them in order
+     *
+     * @note flush() waits until the peer acknowledges every datagram. The
+     * io_uring backend is bypassed while the mode is on. TCP connections
+     * ignore the setting.
+     *
+     * @warning Both peers have to switch at the same message boundary, which
+     * is what the handshake is for.
+     *
+     * @param enable whether to use reliable delivery
+     * @return true if the mode was switched
+     */
+    bool set_reliable(bool enable);
+    bool is_reliable() const { return reliable_ != nullptr; }
+
+    /**
+     * @brief Send the value
+     *
+     * @note Integers and strings have dedicated encodings, any other type
+     * supported by WireWriter is encoded into a single length-prefixed frame.
+     *
+     * @param content value to send
+     * @return true if the value was sent
+     */
     template <class T>
     bool send(const T& content);
 
     template <class T>
     std::optional<T> receive();
 
+    /**
+     * @brief Receive a string without copying it out of the input buffer
+     *
+     * @warning The view is invalidated by the next receive on the connection.
+     *
+     * @return view of the string body
+     */
+    std::optional<std::string_view> receive_view();
+
+    /**
+     * @brief Receive a string into the caller's memory
+     *
+     * @note Strings longer than the buffer are dropped, the connection stays
+     * usable.
+     *
+     * @param buffer destination buffer
+     * @param capacity buffer size
+     * @return string length
+     */
+    std::optional<size_t> receive_into(char* buffer, size_t capacity);
+
+    /**
+     * @brief Send several values with a single write
+     *
+     * @note TCP frames every value into one scatter-gather list, UDP sends
+     * them one by one.
+     *
+     * @param contents values to send, in order
+     * @return true if all values were sent
+     */
+    template <class... Ts>
+    bool send_all(const Ts&... contents);
+
+    /**
+     * @brief Receive the value without holding the thread while nothing has
+     * arrived
+     *
+     * @note The coroutine waits on the scheduler until the whole message has
+     * arrived, then receives it as receive<T>() does. Server-side UDP
+     * connections share their socket and are awaited through
+     * NetworkServer::async_receive_from() instead.
+     *
+     * @param scheduler scheduler the coroutine runs on
+     * @return the value, or nothing on failure
+     */
+    template <class T>
+    Task<std::optional<T>> async_receive(Scheduler& scheduler);
+
+    /**
+     * @brief Send the value once the socket can take it
+     *
+     * @param scheduler scheduler the coroutine runs on
+     * @param content value to send, has to outlive the task
+     * @return true if the value was sent
+     */
+    template <class T>
+    Task<bool> async_send(Scheduler& scheduler, const T& content);
+
+    /**
+     * @brief Coalesce outgoing TCP messages in a per-connection buffer
+     *
+     * @note Buffered data is written by flush(), by the next receive, or
+     * automatically once the buffer reaches the threshold. Nagle's algorithm
+     * is disabled while buffering is on. UDP connections ignore the setting.
+     *
+     * @param flush_threshold buffer size triggering an automatic flush, 0 to
+     * write every message right away
+     */
+    void set_output_buffering(size_t flush_threshold);
+
+    /**
+     * @brief Set how many datagrams a single syscall may move
+     *
+     * @note Chunk trains of long UDP messages are sent with sendmmsg() and
+     * received with recvmmsg() in batches of this size. Reliable mode and the
+     * io_uring backend still move datagrams one by one. TCP connections
+     * ignore the setting.
+     *
+     * @param send_batch datagrams per sendmmsg() call, 1 to use sendto()
+     * @param recv_batch datagrams per recvmmsg() call, 1 to use recvfrom()
+     */
+    void set_datagram_batching(size_t send_batch, size_t recv_batch) {
+        send_batch_ = std::max(send_batch, (size_t)1);
+        recv_batch_ = std::max(recv_batch, (size_t)1);
+    }
+
+    /**
+     * @brief Let the kernel split and coalesce UDP chunk trains (UDP_SEGMENT
+     * and UDP_GRO)
+     *
+     * @note Long strings and serialized values are handed to the kernel in
+     * buffers of up to GSO_MAX_SEGMENTS chunks, and chunks may be received
+     * coalesced. The connection falls back to chunking in user space if the
+     * kernel refuses a buffer. Reliable mode turns the offload off, TCP and
+     * io_uring connections ignore it. Server-side connections sharing one
+     * socket only choose how they send, the server configures receiving
+     * for all of them (see NetworkServer::set_client_segmentation_offload()).
+     *
+     * @param enable whether to use segmentation offload
+     * @return true if the kernel supports it
+     */
+    bool set_segmentation_offload(bool enable);
+
+    /**
+     * @brief Size UDP chunks to the path MTU instead of UDP_OPTIMAL_SIZE
+     * (wire version 2 and newer)
+     *
+     * @note Datagrams leave with the DF bit set, so once the path turns out
+     * to be narrower sends fail with EMSGSIZE and the connection shrinks its
+     * chunks to the MTU the kernel has learned. Frames state their chunk
+     * size, the peer sizes its receive slots to match. Reliable connections
+     * let the kernel fragment instead, TCP connections ignore the call.
+     * Server-side connections sharing one socket only size their chunks to
+     * their own path, the shared socket always lets the kernel fragment.
+     *
+     * @return chunk size in bytes
+     */
+    size_t discover_path_mtu();
+    size_t get_chunk_size() const {
+        return encoding_.version == WireVersion::V1 ? UDP_OPTIMAL_SIZE
+                                                    : chunk_size_;
+    }
+
+    /**
+     * @brief Send a pre-encoded message sequence
+     *
+     * @note UDP payloads with chunks wider than the path are cut down on the
+     * way, so they are best built for get_chunk_size().
+     *
+     * @param payload payload built by PayloadWriter for the same protocol
+     * and wire version
+     * @return true if the whole payload was sent
+     */
+    bool send_payload(const WirePayload& payload);
+
+    /**
+     * @brief Send a pre-encoded payload as far as the socket takes it right
+     * away
+     *
+     * @note The rest of a TCP payload stays in the output buffer, ahead of
+     * anything sent later, until try_flush() or the next send or flush
+     * writes it. UDP and io_uring connections send the payload whole, as
+     * send_payload() does.
+     *
+     * @param payload payload built by PayloadWriter for the same protocol
+     * and wire version
+     * @return true if nothing is left in the output buffer
+     */
+    bool try_send_payload(const WirePayload& payload);
+
+    /**
+     * @brief Write as much of the output buffer as the socket takes right
+     * away
+     *
+     * @return true if nothing is left in the output buffer
+     */
+    bool try_flush();
+
+    /**
+     * @brief Select the transport used for socket operations
+     *
+     * @note With NetworkBackend::IO_URING sends are only queued, they are
+     * submitted in one batch by flush() or by the next receive().
+     *
+     * @param backend transport backend
+     * @return true if the backend is available, false if the connection fell
+     * back to plain syscalls
+     */
+    bool set_backend(NetworkBackend backend);
+
+    /**
+     * @brief Put the socket in the non-blocking mode
+     *
+     * @note Receives and sends still wait until the whole message is
+     * through, only in poll() instead of the kernel. Connections on the
+     * io_uring backend keep their socket blocking.
+     *
+     * @return true if the socket was switched
+     */
+    bool set_nonblocking();
+
+    /**
+     * @brief Push every queued message to the socket
+     *
+     * @return true if all of them were sent successfully
+     */
+    bool flush();
+
+    /**
+     * @brief Check whether received bytes are waiting in the buffer
+     *
+     * @note The socket does not report such data as readable, event loops
+     * have to check it before waiting. The start of a message that
+     * poll_message() found incomplete does not count until more arrives.
+     *
+     * @return true if the next receive can start without a syscall
+     */
+    bool has_buffered_input() const {
+        return (input_.available() > 0 && !input_.is_seen()) ||
+               (reliable_ && reliable_->has_ready()) ||
+               (demux_ && demux_->has_pending(demux_slot_));
+    }
+
+    /**
+     * @brief Process what has already arrived without waiting and check
+     * whether a message can be received
+     *
+     * @note Unlike has_buffered_input(), datagrams a reliable connection
+     * consumes itself (acknowledgements, duplicates) do not count.
+     *
+     * @return true if there is data to receive
+     */
+    bool poll_input();
+
+    /**
+     * @brief Take in what has arrived without waiting and check whether a
+     * whole message can be received
+     *
+     * @note A message that only started arriving stays in the buffer until
+     * the rest comes in.
+     *
+     * @return true if receive<T>() can go without waiting, either because
+     * the message is whole or because the connection is dead
+     */
+    template <class T>
+    bool poll_message();
+
     friend struct NetworkServer<Protocol>;
     friend struct NetworkClient<Protocol>;
 
@@ -64,60 +396,1379 @@ struct NetworkConnection {
    private:
     bool dead_ = false;
 
+    Clock::time_point deadline_ = Clock::time_point::max();
+    bool timed_out_ = false;
+
+    std::unique_ptr<UringQueue> uring_{};
+    std::unique_ptr<ReliableUdp> reliable_{};
+
+    bool nonblocking_ = false;
+
+    // Set on server-side UDP connections sharing one socket.
+    UdpDemux* demux_ = nullptr;
+    int demux_slot_ = -1;
+
+    std::vector<char> output_{};
+    size_t flush_threshold_ = 0;
+
+    ReceiveBuffer input_{};
+    size_t max_frame_size_ = DEFAULT_MAX_FRAME_SIZE;
+
+    size_t send_batch_ = DEFAULT_DATAGRAM_BATCH;
+    size_t recv_batch_ = DEFAULT_DATAGRAM_BATCH;
+
+    std::vector<iovec> datagrams_{};
+    std::vector<mmsghdr> datagram_headers_{};
+
+    bool segmentation_offload_ = false;
+
+    size_t chunk_size_ = UDP_OPTIMAL_SIZE;
+    size_t peer_chunk_size_ = UDP_OPTIMAL_SIZE;
+
+    size_t path_chunk_size() const;
+    bool shrink_chunks();
+
     bool send_raw(const void* buffer, size_t len, int flags);
+    bool send_raw_vectored(const iovec* parts, size_t count, int flags);
     bool recv_raw(void* buffer, size_t len, int flags);
+    bool wait_socket(short events, bool drained = false);
+
+    // TCP takes everything the kernel has, UDP takes one whole datagram.
+    static constexpr size_t READ_SIZE =
+        Protocol == NetworkProtocol::TCP ? 4096 : 65536;  // bytes
+
+    bool fill_input(size_t len);
+    bool pull_input();
+    void take_pending_input();
+
+    template <class T>
+    std::optional<size_t> peek_message_length();
+
+    bool send_datagrams(const iovec* datagrams, size_t count,
+                        size_t* sent_count = nullptr);
+    bool send_batch(const iovec* datagrams, size_t count, size_t* sent);
+    void add_chunks(const char* body, size_t len, size_t chunk_size);
+    bool send_chunks(const char* header, size_t header_len, const char* body,
+                     size_t len);
+    bool send_segmented(const char* body, size_t len);
+    ssize_t receive_datagrams(size_t min_len);
+
+    template <class T>
+    bool send_integer(T value);
+
+    template <class T>
+    std::optional<T> receive_integer();
+
+    bool send_frame(WireTag tag, const char* body, size_t len);
+    std::optional<std::string_view> receive_frame(WireTag tag);
+
+    std::optional<uint64_t> receive_header(
+        WireTag tag, std::optional<uint64_t>* raw_length = nullptr,
+        std::optional<uint64_t>* chunk_size = nullptr);
+    std::optional<uint64_t> peek_varint(size_t* offset, bool wait = true);
+
+    WireEncoding encoding_{};
+
+    std::vector<char> encode_buffer_{};
+    std::vector<char> compress_buffer_{};
+    std::vector<char> decompress_buffer_{};
+
+    bool flush_output();
+    bool transmit(const iovec* parts, size_t count, int flags);
+    void transmit_reliable(const iovec* parts, size_t count);
+    void transmit_parts(const iovec* parts, size_t count, int flags);
 
     bool should_die();
 
     bool close_on_destroy_ = true;
 };
 
+#define DECLARE_BASIC_TYPE(PROTOCOL, TYPE)                                 \
+    template <>                                                            \
+    template <>                                                            \
+    bool NetworkConnection<PROTOCOL>::send<TYPE>(const TYPE& content);     \
+    template <>                                                            \
+    template <>                                                            \
+    std::optional<TYPE> NetworkConnection<PROTOCOL>::receive<TYPE>()
+
+#define DECLARE_BASIC_TYPES(PROTOCOL)                \
+    DECLARE_BASIC_TYPE(PROTOCOL, uint16_t);          \
+    DECLARE_BASIC_TYPE(PROTOCOL, uint32_t);          \
+    DECLARE_BASIC_TYPE(PROTOCOL, int16_t);           \
+    DECLARE_BASIC_TYPE(PROTOCOL, int32_t);           \
+    DECLARE_BASIC_TYPE(PROTOCOL, std::string)
+
+// Implemented in basic_types.cpp, have to be visible before any use.
+DECLARE_BASIC_TYPES(NetworkProtocol::TCP);
+DECLARE_BASIC_TYPES(NetworkProtocol::UDP);
+
+#undef DECLARE_BASIC_TYPES
+#undef DECLARE_BASIC_TYPE
+
 template <NetworkProtocol Protocol>
 ssize_t sys_send(int sock_fd, const void* buf, size_t len, int flags,
                  sockaddr_in address);
 
+template <NetworkProtocol Protocol>
+ssize_t sys_sendv(int sock_fd, const iovec* parts, size_t count, int flags,
+                  sockaddr_in address);
+
 template <NetworkProtocol Protocol>
 ssize_t sys_recv(int sock_fd, void* buf, size_t len, int flags,
-                 sockaddr_in address);
+                 sockaddr_in* address);
+
+int sys_sendmmsg(int sock_fd, mmsghdr* messages, size_t count, int flags);
+
+ssize_t sys_send_segmented(int sock_fd, const void* buf, size_t len,
+                           size_t segment_size, sockaddr_in address);
+
+int sys_recvmmsg(int sock_fd, mmsghdr* messages, size_t count, int flags);
+
+/**
+ * @brief Path MTU the kernel knows for the address
+ *
+ * @return MTU in bytes, 0 if unknown
+ */
+size_t sys_path_mtu(sockaddr_in address);
+
+template <NetworkProtocol Protocol>
+template <class T>
+inline bool NetworkConnection<Protocol>::send(const T& content) {
+    if (dead_) return false;
+
+    encode_buffer_.clear();
+    wire_encode(encoding_.version, encode_buffer_, content);
+
+    return send_frame(WIRE_TAG_FRAME, encode_buffer_.data(),
+                      encode_buffer_.size());
+}
+
+template <NetworkProtocol Protocol>
+template <class T>
+inline std::optional<T> NetworkConnection<Protocol>::receive() {
+    auto body = receive_frame(WIRE_TAG_FRAME);
+    if (!body) return {};
+
+    return wire_decode<T>(*body, encoding_.version);
+}
+
+template <NetworkProtocol Protocol>
+template <class... Ts>
+inline bool NetworkConnection<Protocol>::send_all(const Ts&... contents) {
+    // Compressed frames need their own buffers, no point gathering them.
+    if (Protocol != NetworkProtocol::TCP || encoding_.compression_threshold) {
+        return (send(contents) && ...);
+    }
+
+    GatherList<sizeof...(Ts)> parts(encoding_.version);
+    (parts.add(contents), ...);
+
+    return send_raw_vectored(parts.data(), parts.size(), 0);
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkConnection<Protocol>::
+    set_output_buffering(size_t flush_threshold) {
+    assert(errno == 0);
+
+    if (Protocol != NetworkProtocol::TCP) return;
+
+    flush_output();
+
+    flush_threshold_ = flush_threshold;
+    output_.reserve(flush_threshold);
+
+    int no_delay = flush_threshold > 0;
+    setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    errno = 0;
+}
+
+template <NetworkProtocol Protocol>
+inline std::optional<std::string_view> NetworkConnection<Protocol>::
+    receive_view() {
+    return receive_frame(WIRE_TAG_STRING);
+}
+
+template <NetworkProtocol Protocol>
+inline std::optional<size_t> NetworkConnection<Protocol>::
+    receive_into(char* buffer, size_t capacity) {
+    auto body = receive_view();
+    if (!body || body->size() > capacity) return {};
+
+    memcpy(buffer, body->data(), body->size());
+
+    return body->size();
+}
+
+// GCC flags the switch it generates over suspension points of coroutines.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+template <NetworkProtocol Protocol>
+template <class T>
+inline Task<std::optional<T>> NetworkConnection<Protocol>::
+    async_receive(Scheduler& scheduler) {
+    // The rest of a message that started arriving is waited for as well.
+    while (!poll_message<T>()) {
+        bool ready = co_await scheduler.readable(sock_);
+        if (!ready) co_return std::nullopt;
+    }
+
+    co_return receive<T>();
+}
+
+template <NetworkProtocol Protocol>
+template <class T>
+inline Task<bool> NetworkConnection<Protocol>::
+    async_send(Scheduler& scheduler, const T& content) {
+    bool ready = co_await scheduler.writable(sock_);
+    if (!ready) co_return false;
+
+    co_return send<T>(content);
+}
+
+#pragma GCC diagnostic pop
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::set_backend(NetworkBackend backend) {
+    assert(errno == 0);
+
+    if (!flush()) return false;
+
+    uring_.reset();
+
+    if (backend != NetworkBackend::IO_URING) return true;
+
+    // Receives from a shared socket go through the demultiplexer and would
+    // never submit the queued sends.
+    if (demux_) return false;
+
+    uring_ = std::make_unique<UringQueue>();
+
+    if (!uring_->is_valid()) {
+        uring_.reset();
+        return false;
+    }
+
+    uring_->attach(sock_);
+
+    return true;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::set_nonblocking() {
+    assert(errno == 0);
+
+    if (uring_) return false;
+
+    int flags = fcntl(sock_, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock_, F_SETFL, flags | O_NONBLOCK) < 0) {
+        errno = 0;
+        return false;
+    }
+
+    nonblocking_ = true;
+
+    return true;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::set_reliable(bool enable) {
+    assert(errno == 0);
+
+    if (Protocol != NetworkProtocol::UDP || !flush()) return false;
+
+    // Coalesced datagrams would merge sequence numbers.
+    if (enable) set_segmentation_offload(false);
+
+    if (enable && !reliable_) {
+        reliable_ = std::make_unique<ReliableUdp>();
+        if (demux_) reliable_->set_demux(demux_, demux_slot_);
+    }
+
+    if (!enable) reliable_.reset();
+
+    // Queued datagrams can not be re-chunked, the DF bit follows the mode.
+    if (chunk_size_ > UDP_OPTIMAL_SIZE) discover_path_mtu();
+
+    return true;
+}
 
 template <NetworkProtocol Protocol>
 inline bool NetworkConnection<Protocol>::
-    send_raw(const void* buffer, size_t len, int flags) {
+    set_segmentation_offload(bool enable) {
     assert(errno == 0);
 
-    if (dead_) return false;
+    segmentation_offload_ = false;
 
-    sys_send<Protocol>(sock_, buffer, len, flags, conn_addr_);
+    if (Protocol != NetworkProtocol::UDP || (enable && reliable_)) {
+        return false;
+    }
 
-    if (errno == 0) return true;
+    // The segment size goes with every message, the shared socket is left
+    // as the server set it.
+    if (demux_) {
+        segmentation_offload_ = enable;
+        return true;
+    }
 
-    if (should_die()) {
-        die();
+    // Segment size is given per message, the socket default stays off.
+    int no_segmentation = 0;
+    int coalesce = enable;
+
+    bool supported = setsockopt(sock_, SOL_UDP, UDP_SEGMENT, &no_segmentation,
+                                sizeof(no_segmentation)) == 0 &&
+                     setsockopt(sock_, SOL_UDP, UDP_GRO, &coalesce,
+                                sizeof(coalesce)) == 0;
+
+    errno = 0;
+
+    segmentation_offload_ = enable && supported;
+
+    return supported;
+}
+
+template <NetworkProtocol Protocol>
+inline size_t NetworkConnection<Protocol>::discover_path_mtu() {
+    assert(errno == 0);
+
+    if (Protocol != NetworkProtocol::UDP) return 0;
+
+    // The DF policy of a shared socket is the server's.
+    if (!demux_) {
+        int discovery = reliable_ ? IP_PMTUDISC_WANT : IP_PMTUDISC_DO;
+        setsockopt(sock_, IPPROTO_IP, IP_MTU_DISCOVER, &discovery,
+                   sizeof(discovery));
     }
 
     errno = 0;
 
+    chunk_size_ = path_chunk_size();
+
+    return get_chunk_size();
+}
+
+template <NetworkProtocol Protocol>
+inline size_t NetworkConnection<Protocol>::path_chunk_size() const {
+    size_t mtu = sys_path_mtu(conn_addr_);
+
+    errno = 0;
+
+    // Reliable mode prepends its own header to every chunk.
+    static const size_t OVERHEAD = UDP_HEADERS_SIZE + RELIABLE_DATA_HEADER_SIZE;
+
+    if (mtu < OVERHEAD + UDP_OPTIMAL_SIZE) return UDP_OPTIMAL_SIZE;
+
+    return std::min(mtu - UDP_HEADERS_SIZE, MAX_UDP_PAYLOAD) -
+           RELIABLE_DATA_HEADER_SIZE;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::shrink_chunks() {
+    size_t chunk_size = std::min(path_chunk_size(), chunk_size_);
+
+    // The kernel has not learned a narrower path yet, fall back to the size
+    // that fits any of them.
+    if (chunk_size == chunk_size_) chunk_size = UDP_OPTIMAL_SIZE;
+
+    if (chunk_size == chunk_size_) return false;
+
+    chunk_size_ = chunk_size;
+
+    return true;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::
+    send_payload(const WirePayload& payload) {
+    assert(errno == 0);
+
+    if (dead_ || !(payload.encoding == encoding_)) return false;
+
+    if (Protocol == NetworkProtocol::TCP) {
+        return send_raw(payload.bytes.data(), payload.bytes.size(), 0);
+    }
+
+    datagrams_.clear();
+
+    size_t frame_start = 0;
+    for (size_t frame_end : payload.frame_ends) {
+        datagrams_.push_back({
+            .iov_base = (void*)(payload.bytes.data() + frame_start),
+            .iov_len = frame_end - frame_start,
+        });
+
+        frame_start = frame_end;
+    }
+
+    // Once the path narrows, whatever is left is cut to the new chunk size,
+    // chunks smaller than announced are fine for the receiver.
+    size_t start = 0;
+    while (!dead_) {
+        size_t sent = 0;
+        if (send_datagrams(datagrams_.data() + start,
+                           datagrams_.size() - start, &sent)) {
+            return true;
+        }
+
+        start += sent;
+
+        std::vector<iovec> rest(datagrams_.begin() + (ssize_t)start,
+                                datagrams_.end());
+
+        datagrams_.clear();
+        start = 0;
+
+        for (const iovec& datagram : rest) {
+            add_chunks((const char*)datagram.iov_base, datagram.iov_len,
+                       get_chunk_size());
+        }
+    }
+
     return false;
 }
 
 template <NetworkProtocol Protocol>
 inline bool NetworkConnection<Protocol>::
-    recv_raw(void* buffer, size_t len, int flags) {
+    try_send_payload(const WirePayload& payload) {
     assert(errno == 0);
 
-    if (dead_) return false;
+    if (Protocol != NetworkProtocol::TCP || uring_) {
+        send_payload(payload);
+        return true;
+    }
 
-    sys_recv<Protocol>(sock_, buffer, len, flags, conn_addr_);
+    if (dead_ || !(payload.encoding == encoding_)) return true;
 
-    if (errno == 0) return true;
+    // Bytes buffered earlier go out first.
+    if (!output_.empty()) {
+        output_.insert(output_.end(), payload.bytes.begin(),
+                       payload.bytes.end());
+        return try_flush();
+    }
 
-    if (should_die()) {
-        dead_ = true;
+    ssize_t sent = sys_send<Protocol>(sock_, payload.bytes.data(),
+                                      payload.bytes.size(), MSG_DONTWAIT,
+                                      conn_addr_);
+
+    if (sent < 0 && should_die()) die();
+    errno = 0;
+
+    if (dead_) return true;
+
+    size_t written = sent > 0 ? (size_t)sent : 0;
+    output_.insert(output_.end(), payload.bytes.begin() + (ptrdiff_t)written,
+                   payload.bytes.end());
+
+    return output_.empty();
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::try_flush() {
+    assert(errno == 0);
+
+    if (dead_ || output_.empty()) return true;
+
+    if (uring_) {
+        flush();
+        return true;
     }
 
+    ssize_t sent = sys_send<Protocol>(sock_, output_.data(), output_.size(),
+                                      MSG_DONTWAIT, conn_addr_);
+
+    if (sent > 0) output_.erase(output_.begin(), output_.begin() + sent);
+
+    if (sent < 0 && should_die()) die();
     errno = 0;
 
-    return false;
+    return output_.empty() || dead_;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::poll_input() {
+    assert(errno == 0);
+
+    if (dead_) return false;
+
+    if ((input_.available() > 0 && !input_.is_seen()) || !reliable_) {
+        return has_buffered_input();
+    }
+
+    if (!reliable_->poll(sock_, &conn_addr_)) {
+        if (should_die()) die();
+        errno = 0;
+    }
+
+    return reliable_->has_ready();
+}
+
+template <NetworkProtocol Protocol>
+template <class T>
+inline bool NetworkConnection<Protocol>::poll_message() {
+    assert(errno == 0);
+
+    for (;;) {
+        if (dead_) return true;
+
+        auto length = peek_message_length<T>();
+        if (length && input_.available() >= *length) return true;
+
+        if (!pull_input()) break;
+    }
+
+    // Event loops wait for the rest instead of checking the start again.
+    input_.mark_seen();
+
+    return dead_;
+}
+
+template <NetworkProtocol Protocol>
+template <class T>
+inline std::optional<size_t> NetworkConnection<Protocol>::
+    peek_message_length() {
+    if (encoding_.version == WireVersion::V1) {
+        if constexpr (std::is_integral_v<T>) return sizeof(T);
+
+        uint32_t length = 0;
+        if (input_.available() < sizeof(length)) return {};
+
+        memcpy(&length, input_.data(), sizeof(length));
+        swap_wire_bytes<sizeof(length)>((char*)&length, 1);
+
+        // Frames over the limit are left to the receive, which drops them.
+        if (length > max_frame_size_) return sizeof(length);
+
+        return sizeof(length) + length;
+    }
+
+    if (input_.available() < 1) return {};
+
+    uint8_t found = (uint8_t)input_.data()[0];
+    uint8_t tag = found & (uint8_t)~(WIRE_TAG_COMPRESSED | WIRE_TAG_CHUNKED);
+
+    size_t offset = 1;
+
+    auto length = peek_varint(&offset, false);
+    if (!length) return {};
+
+    // Integers are the header alone, unknown tags are rejected by the
+    // receive.
+    if (tag != WIRE_TAG_STRING && tag != WIRE_TAG_FRAME) return offset;
+
+    if ((found & WIRE_TAG_COMPRESSED) && !peek_varint(&offset, false)) {
+        return {};
+    }
+
+    if ((found & WIRE_TAG_CHUNKED) && !peek_varint(&offset, false)) {
+        return {};
+    }
+
+    if (*length > max_frame_size_) return offset;
+
+    return offset + *length;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::pull_input() {
+    assert(errno == 0);
+
+    size_t writable = 0;
+    char* region = input_.prepare(READ_SIZE, &writable);
+
+    ssize_t received = -1;
+    if (reliable_) {
+        if (!reliable_->poll(sock_, &conn_addr_) && should_die()) die();
+        errno = 0;
+
+        if (!reliable_->has_ready()) return false;
+
+        received = reliable_->recv(sock_, &conn_addr_, region, writable);
+    } else if (demux_) {
+        if (!demux_->has_pending(demux_slot_)) demux_->pump();
+
+        received =
+            demux_->receive(demux_slot_, region, writable, MSG_DONTWAIT);
+    } else {
+        received = sys_recv<Protocol>(sock_, region, writable, MSG_DONTWAIT,
+                                      &conn_addr_);
+    }
+
+    if (received > 0) {
+        input_.commit((size_t)received);
+        return true;
+    }
+
+    // Orderly shutdown of a stream socket.
+    if (received == 0 && Protocol == NetworkProtocol::TCP) {
+        dead_ = true;
+        return false;
+    }
+
+    if (received < 0 && should_die()) dead_ = true;
+
+    errno = 0;
+
+    return received == 0;
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkConnection<Protocol>::take_pending_input() {
+    // Datagrams already taken off the socket, the socket itself is left.
+    while (((reliable_ && reliable_->has_ready()) ||
+            (demux_ && demux_->has_pending(demux_slot_))) &&
+           pull_input()) {
+    }
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::flush() {
+    assert(errno == 0);
+
+    if (dead_) return false;
+
+    if (!flush_output()) return false;
+
+    if (reliable_ && reliable_->flush(sock_, &conn_addr_, -1)) return true;
+
+    if (!reliable_ && (!uring_ || uring_->flush())) return true;
+
+    if (should_die()) die();
+
+    errno = 0;
+
+    return false;
+}
+
+template <NetworkProtocol Protocol>
+template <class T>
+inline bool NetworkConnection<Protocol>::send_integer(T value) {
+    char message[MAX_WIRE_HEADER_SIZE] = {};
+    size_t len = encode_wire_integer(encoding_.version, value, message);
+
+    return send_raw(message, len, 0);
+}
+
+template <NetworkProtocol Protocol>
+template <class T>
+inline std::optional<T> NetworkConnection<Protocol>::receive_integer() {
+    if (encoding_.version == WireVersion::V1) {
+        T value = 0;
+        if (!recv_raw(&value, sizeof(value), 0)) return {};
+
+        swap_wire_bytes<sizeof(T)>((char*)&value, 1);
+        return value;
+    }
+
+    constexpr bool is_signed = std::is_signed_v<T>;
+
+    auto encoded = receive_header(is_signed ? WIRE_TAG_SINT : WIRE_TAG_UINT);
+    if (!encoded) return {};
+
+    if constexpr (is_signed) {
+        int64_t value = zigzag_decode(*encoded);
+        if (value < std::numeric_limits<T>::min() ||
+            value > std::numeric_limits<T>::max()) {
+            die();
+            return {};
+        }
+
+        return (T)value;
+    } else {
+        if (*encoded > std::numeric_limits<T>::max()) {
+            die();
+            return {};
+        }
+
+        return (T)*encoded;
+    }
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::
+    send_frame(WireTag tag, const char* body, size_t len) {
+    if (dead_) return false;
+
+    std::string_view contents(body, len);
+
+    // Chunks other than the default size have to be announced.
+    size_t announced_chunk_size =
+        Protocol == NetworkProtocol::UDP && chunk_size_ > UDP_OPTIMAL_SIZE
+            ? chunk_size_
+            : 0;
+
+    char header[MAX_FRAME_HEADER_SIZE] = {};
+    size_t header_len = encode_frame(encoding_, tag, &contents,
+                                     compress_buffer_, header,
+                                     announced_chunk_size);
+
+    body = contents.data();
+    len = contents.size();
+
+    if (Protocol == NetworkProtocol::TCP) {
+        // Header and body leave in one segment.
+        iovec parts[] = {
+            {.iov_base = header, .iov_len = header_len},
+            {.iov_base = (void*)body, .iov_len = len},
+        };
+
+        return send_raw_vectored(parts, 2, 0);
+    }
+
+    bool offload = segmentation_offload_ && !reliable_ && !uring_ &&
+                   len > get_chunk_size();
+
+    // Header and chunks leave as one datagram train.
+    if (!send_chunks(header, header_len, body, offload ? 0 : len)) {
+        return false;
+    }
+
+    return !offload || send_segmented(body, len);
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::send_chunks(const char* header,
+                                                     size_t header_len,
+                                                     const char* body,
+                                                     size_t len) {
+    // Whatever is left of the train gets re-chunked if the path MTU shrinks
+    // on the way, chunks smaller than announced are fine for the receiver.
+    size_t start = 0;
+    while (!dead_) {
+        size_t chunk_size = get_chunk_size();
+
+        datagrams_.clear();
+        if (header_len > 0) {
+            datagrams_.push_back(
+                {.iov_base = (void*)header, .iov_len = header_len});
+        }
+
+        add_chunks(body + start, len - start, chunk_size);
+
+        size_t sent = 0;
+        bool status =
+            send_datagrams(datagrams_.data(), datagrams_.size(), &sent);
+
+        if (header_len > 0 && sent > 0) {
+            header_len = 0;
+            --sent;
+        }
+
+        start = std::min(start + sent * chunk_size, len);
+
+        if (status) return true;
+    }
+
+    return false;
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkConnection<Protocol>::
+    add_chunks(const char* body, size_t len, size_t chunk_size) {
+    for (size_t start = 0; start < len; start += chunk_size) {
+        size_t end = std::min(start + chunk_size, len);
+        datagrams_.push_back({
+            .iov_base = (void*)(body + start),
+            .iov_len = end - start,
+        });
+    }
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::
+    send_segmented(const char* body, size_t len) {
+    assert(errno == 0);
+
+    size_t start = 0;
+    while (start < len && !dead_) {
+        // The kernel splits each buffer into chunks, the whole buffer has
+        // to fit a single datagram.
+        size_t chunk_size = get_chunk_size();
+        size_t buffer_size =
+            chunk_size *
+            std::min(GSO_MAX_SEGMENTS, MAX_UDP_PAYLOAD / chunk_size);
+
+        size_t end = std::min(start + buffer_size, len);
+
+        if (sys_send_segmented(sock_, body + start, end - start, chunk_size,
+                               conn_addr_) >= 0) {
+            start = end;
+            continue;
+        }
+
+        // The chunks are over the path MTU, the buffer is retried.
+        if (errno == EMSGSIZE && shrink_chunks()) {
+            errno = 0;
+            continue;
+        }
+
+        // The route or the device can not segment, chunk the rest by hand.
+        if (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP ||
+            errno == ENOPROTOOPT) {
+            errno = 0;
+
+            set_segmentation_offload(false);
+
+            return send_chunks(nullptr, 0, body + start, len - start);
+        }
+
+        if (should_die()) die();
+
+        errno = 0;
+    }
+
+    return !dead_;
+}
+
+template <NetworkProtocol Protocol>
+inline std::optional<std::string_view> NetworkConnection<Protocol>::
+    receive_frame(WireTag tag) {
+    assert(errno == 0);
+
+    if (dead_) return {};
+
+    std::optional<uint64_t> length{};
+    std::optional<uint64_t> raw_length{};
+    std::optional<uint64_t> chunk_size{};
+    if (encoding_.version == WireVersion::V1) {
+        length = receive_integer<uint32_t>();
+    } else {
+        bool udp = Protocol == NetworkProtocol::UDP;
+        length = receive_header(tag, &raw_length, udp ? &chunk_size : nullptr);
+    }
+
+    if (!length) return {};
+
+    if (*length > UINT32_MAX || *length > max_frame_size_ ||
+        raw_length.value_or(0) > UINT32_MAX ||
+        raw_length.value_or(0) > max_frame_size_ ||
+        chunk_size.value_or(0) > MAX_UDP_PAYLOAD) {
+        die();
+        return {};
+    }
+
+    // A peer that was not granted compression has no business sending it.
+    if (raw_length && !encoding_.compression_threshold) {
+        die();
+        return {};
+    }
+
+    peer_chunk_size_ =
+        std::max(chunk_size.value_or(0), (uint64_t)UDP_OPTIMAL_SIZE);
+
+    // UDP chunks are retried one datagram at a time, as the sender does.
+    bool success = fill_input(*length);
+    while (!success && Protocol == NetworkProtocol::UDP && !dead_) {
+        success = fill_input(*length);
+    }
+
+    if (!success) return {};
+
+    std::string_view result(input_.data(), *length);
+    input_.consume(*length);
+
+    if (!raw_length) return result;
+
+    decompress_buffer_.resize(*raw_length);
+    if (!lz_decompress(result, encoding_.dictionary,
+                       decompress_buffer_.data(), *raw_length)) {
+        die();
+        return {};
+    }
+
+    return std::string_view(decompress_buffer_.data(), *raw_length);
+}
+
+template <NetworkProtocol Protocol>
+inline std::optional<uint64_t> NetworkConnection<Protocol>::receive_header(
+    WireTag tag, std::optional<uint64_t>* raw_length,
+    std::optional<uint64_t>* chunk_size) {
+    if (!fill_input(1)) return {};
+
+    uint8_t found = (uint8_t)input_.data()[0];
+    bool compressed = raw_length && (found & WIRE_TAG_COMPRESSED);
+    bool chunked = chunk_size && (found & WIRE_TAG_CHUNKED);
+
+    uint8_t expected = tag;
+    if (compressed) expected |= WIRE_TAG_COMPRESSED;
+    if (chunked) expected |= WIRE_TAG_CHUNKED;
+
+    // A mismatching tag means the peers are out of sync for good.
+    if (found != expected) {
+        die();
+        return {};
+    }
+
+    // Nothing is consumed until the whole header is in the buffer.
+    size_t offset = 1;
+
+    auto value = peek_varint(&offset);
+    if (!value) return {};
+
+    if (compressed) {
+        *raw_length = peek_varint(&offset);
+        if (!*raw_length) return {};
+    }
+
+    if (chunked) {
+        *chunk_size = peek_varint(&offset);
+        if (!*chunk_size) return {};
+    }
+
+    input_.consume(offset);
+
+    return value;
+}
+
+template <NetworkProtocol Protocol>
+inline std::optional<uint64_t> NetworkConnection<Protocol>::
+    peek_varint(size_t* offset, bool wait) {
+    uint64_t value = 0;
+
+    for (size_t byte_id = 0; byte_id < MAX_VARINT_SIZE; ++byte_id) {
+        size_t needed = *offset + byte_id + 1;
+        if (wait ? !fill_input(needed) : input_.available() < needed) {
+            return {};
+        }
+
+        uint8_t byte = (uint8_t)input_.data()[*offset + byte_id];
+        value |= (uint64_t)(byte & 0x7f) << (7 * byte_id);
+
+        if (!(byte & 0x80)) {
+            *offset += byte_id + 1;
+            return value;
+        }
+    }
+
+    die();
+    return {};
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::
+    send_raw(const void* buffer, size_t len, int flags) {
+    iovec part = {.iov_base = (void*)buffer, .iov_len = len};
+    return send_raw_vectored(&part, 1, flags);
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::
+    send_raw_vectored(const iovec* parts, size_t count, int flags) {
+    assert(errno == 0);
+
+    if (dead_) return false;
+
+    if (!flush_threshold_ || flags != 0) {
+        if (!flush_output()) return false;
+        return transmit(parts, count, flags);
+    }
+
+    size_t total = 0;
+    for (size_t part_id = 0; part_id < count; ++part_id) {
+        total += parts[part_id].iov_len;
+    }
+
+    if (output_.size() + total >= flush_threshold_ && !flush_output()) {
+        return false;
+    }
+
+    // Messages larger than the buffer itself skip the copy.
+    if (total >= flush_threshold_) return transmit(parts, count, flags);
+
+    for (size_t part_id = 0; part_id < count; ++part_id) {
+        const char* bytes = (const char*)parts[part_id].iov_base;
+        output_.insert(output_.end(), bytes, bytes + parts[part_id].iov_len);
+    }
+
+    return true;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::flush_output() {
+    if (output_.empty()) return true;
+
+    iovec part = {.iov_base = output_.data(), .iov_len = output_.size()};
+    bool status = transmit(&part, 1, 0);
+
+    output_.clear();
+
+    return status;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::
+    transmit(const iovec* parts, size_t count, int flags) {
+    assert(errno == 0);
+
+    if (dead_ || !wait_socket(POLLOUT)) return false;
+
+    if (reliable_) {
+        transmit_reliable(parts, count);
+    } else if (uring_) {
+        bool connected = Protocol == NetworkProtocol::TCP;
+        for (size_t part_id = 0; part_id < count && errno == 0; ++part_id) {
+            uring_->send(parts[part_id].iov_base, parts[part_id].iov_len,
+                         flags, connected ? nullptr : &conn_addr_);
+        }
+    } else {
+        transmit_parts(parts, count, flags);
+    }
+
+    if (errno == 0) return !dead_;
+
+    // A chunk over the path MTU, the sender re-chunks the rest of its train.
+    if (errno == EMSGSIZE && Protocol == NetworkProtocol::UDP &&
+        shrink_chunks()) {
+        errno = 0;
+        return false;
+    }
+
+    if (should_die()) {
+        die();
+    }
+
+    errno = 0;
+
+    return false;
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkConnection<Protocol>::
+    transmit_parts(const iovec* parts, size_t count, int flags) {
+    const iovec* left = parts;
+    size_t left_count = count;
+
+    // Copy of the parts still to send once a write was cut short.
+    std::vector<iovec> rest{};
+    size_t first = 0;
+    size_t offset = 0;
+
+    for (;;) {
+        ssize_t sent =
+            left_count == 1
+                ? sys_send<Protocol>(sock_, left[0].iov_base, left[0].iov_len,
+                                     flags, conn_addr_)
+                : sys_sendv<Protocol>(sock_, left, left_count, flags,
+                                      conn_addr_);
+
+        // Datagrams leave whole, blocking streams take the whole message.
+        if (Protocol == NetworkProtocol::UDP || !nonblocking_) return;
+
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return;
+
+            errno = 0;
+            if (!wait_socket(POLLOUT, true)) return;
+            continue;
+        }
+
+        offset += (size_t)sent;
+        while (first < count && offset >= parts[first].iov_len) {
+            offset -= parts[first].iov_len;
+            ++first;
+        }
+
+        if (first == count) return;
+
+        rest.assign(parts + first, parts + count);
+        rest[0].iov_base = (char*)rest[0].iov_base + offset;
+        rest[0].iov_len -= offset;
+
+        left = rest.data();
+        left_count = rest.size();
+    }
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkConnection<Protocol>::
+    transmit_reliable(const iovec* parts, size_t count) {
+    if (count == 1) {
+        reliable_->send(sock_, &conn_addr_, parts[0].iov_base,
+                        parts[0].iov_len);
+        return;
+    }
+
+    // Every transmission is one datagram, so the parts get joined.
+    std::vector<char> datagram{};
+    for (size_t part_id = 0; part_id < count; ++part_id) {
+        const char* bytes = (const char*)parts[part_id].iov_base;
+        datagram.insert(datagram.end(), bytes, bytes + parts[part_id].iov_len);
+    }
+
+    reliable_->send(sock_, &conn_addr_, datagram.data(), datagram.size());
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::
+    recv_raw(void* buffer, size_t len, int flags) {
+    assert(errno == 0);
+
+    if (dead_) return false;
+
+    if (!fill_input(len)) return false;
+
+    memcpy(buffer, input_.data(), len);
+    if (!(flags & MSG_PEEK)) input_.consume(len);
+
+    return true;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::fill_input(size_t len) {
+    assert(errno == 0);
+
+    if (input_.available() >= len) return true;
+
+    if (!flush_output()) return false;
+
+    while (input_.available() < len) {
+        size_t writable = 0;
+        char* region =
+            input_.prepare(std::max(len - input_.available(), READ_SIZE),
+                           &writable);
+
+        if (!wait_socket(POLLIN)) return false;
+
+        ssize_t received = 0;
+        if (reliable_) {
+            received = reliable_->recv(sock_, &conn_addr_, region, writable);
+        } else if (demux_) {
+            received = demux_->receive(demux_slot_, region, writable, 0);
+        } else if (Protocol == NetworkProtocol::UDP && !uring_ &&
+                   recv_batch_ > 1) {
+            received = receive_datagrams(len - input_.available());
+        } else if (uring_) {
+            bool connected = Protocol == NetworkProtocol::TCP;
+            received = uring_->recv(region, writable, 0,
+                                    connected ? nullptr : &conn_addr_);
+        } else {
+            received =
+                sys_recv<Protocol>(sock_, region, writable, 0, &conn_addr_);
+        }
+
+        if (received > 0) {
+            input_.commit((size_t)received);
+            continue;
+        }
+
+        // Orderly shutdown of a stream socket.
+        if (received == 0 && Protocol == NetworkProtocol::TCP) {
+            dead_ = true;
+            return false;
+        }
+
+        if (received == 0) continue;
+
+        // Non-blocking sockets wait here for what a blocking one would.
+        if (nonblocking_ && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            errno = 0;
+            if (!wait_socket(POLLIN, true)) return false;
+            continue;
+        }
+
+        if (should_die()) {
+            dead_ = true;
+        }
+
+        errno = 0;
+
+        return false;
+    }
+
+    return true;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::
+    wait_socket(short events, bool drained) {
+    // Blocking sockets wait in the call itself unless there is a deadline.
+    if (deadline_ == Clock::time_point::max() && !drained) return true;
+
+    // Data a reliable connection has already reordered is not in the socket.
+    if (events == POLLIN && reliable_ && reliable_->has_ready()) return true;
+
+    for (;;) {
+        int left_ms = -1;
+        if (deadline_ != Clock::time_point::max()) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline_ - Clock::now());
+            left_ms = (int)std::clamp<int64_t>(left.count(), 0, INT32_MAX);
+        }
+
+        bool ready = false;
+        if (events == POLLIN && demux_) {
+            ready = demux_->wait(demux_slot_, left_ms);
+        } else {
+            pollfd request = {.fd = sock_, .events = events, .revents = 0};
+            int status = poll(&request, 1, left_ms);
+
+            if (status < 0 && errno == EINTR) {
+                errno = 0;
+                continue;
+            }
+
+            // Socket errors are reported by the operation itself.
+            ready = status != 0;
+        }
+
+        errno = 0;
+
+        if (!ready) {
+            timed_out_ = true;
+            dead_ = true;
+        }
+
+        return ready;
+    }
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::
+    send_datagrams(const iovec* datagrams, size_t count, size_t* sent_count) {
+    assert(errno == 0);
+
+    size_t chunk_size = chunk_size_;
+
+    // A gap would corrupt the message, so datagrams wait for room in the
+    // socket buffer and any other failure ends the connection.
+    size_t sent = 0;
+    while (sent < count && !dead_) {
+        // Chunks over the new path MTU go back to the caller.
+        if (sent_count && chunk_size_ < chunk_size) break;
+
+        // Both queue the datagram themselves, transmit() has already shrunk
+        // the chunks or killed the connection if that failed.
+        if (reliable_ || uring_) {
+            size_t previous_size = chunk_size_;
+
+            if (send_raw(datagrams[sent].iov_base, datagrams[sent].iov_len,
+                         0)) {
+                ++sent;
+            } else if (!dead_ && chunk_size_ == previous_size) {
+                die();
+            }
+
+            continue;
+        }
+
+        if (send_batch_ <= 1) {
+            ssize_t status =
+                sys_send<Protocol>(sock_, datagrams[sent].iov_base,
+                                   datagrams[sent].iov_len, 0, conn_addr_);
+
+            if (status >= 0) {
+                ++sent;
+                continue;
+            }
+        } else if (send_batch(datagrams + sent, count - sent, &sent)) {
+            continue;
+        }
+
+        if (errno == EMSGSIZE && shrink_chunks()) {
+            errno = 0;
+            continue;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            errno = 0;
+            wait_socket(POLLOUT, true);
+            continue;
+        }
+
+        die();
+        errno = 0;
+    }
+
+    if (sent_count) *sent_count = sent;
+
+    return sent == count && !dead_;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkConnection<Protocol>::
+    send_batch(const iovec* datagrams, size_t count, size_t* sent) {
+    size_t batch = std::min(count, send_batch_);
+
+    datagram_headers_.resize(batch);
+    for (size_t message_id = 0; message_id < batch; ++message_id) {
+        msghdr& message = datagram_headers_[message_id].msg_hdr;
+        message = {};
+        message.msg_name = &conn_addr_;
+        message.msg_namelen = sizeof(conn_addr_);
+        message.msg_iov = (iovec*)&datagrams[message_id];
+        message.msg_iovlen = 1;
+    }
+
+    int status = sys_sendmmsg(sock_, datagram_headers_.data(), batch, 0);
+    if (status <= 0) return false;
+
+    *sent += (size_t)status;
+
+    return true;
+}
+
+template <NetworkProtocol Protocol>
+inline ssize_t NetworkConnection<Protocol>::receive_datagrams(size_t min_len) {
+    // The first slot fits any datagram, later ones fit a chunk of the size
+    // the frame header announced, which is all a train is made of, or a
+    // coalesced run of chunks.
+    static const size_t FIRST_SLOT_SIZE = 65536;  // bytes
+
+    size_t slot_size =
+        segmentation_offload_ ? FIRST_SLOT_SIZE : peer_chunk_size_;
+
+    size_t batch = std::clamp((min_len + slot_size - 1) / slot_size,
+                              (size_t)1, recv_batch_);
+
+    size_t writable = 0;
+    char* region =
+        input_.prepare(FIRST_SLOT_SIZE + (batch - 1) * slot_size, &writable);
+
+    datagrams_.resize(batch);
+    datagram_headers_.resize(batch);
+
+    for (size_t message_id = 0; message_id < batch; ++message_id) {
+        size_t offset = message_id == 0
+                            ? 0
+                            : FIRST_SLOT_SIZE + (message_id - 1) * slot_size;
+
+        datagrams_[message_id] = {
+            .iov_base = region + offset,
+            .iov_len = message_id == 0 ? FIRST_SLOT_SIZE : slot_size,
+        };
+
+        msghdr& message = datagram_headers_[message_id].msg_hdr;
+        message = {};
+        message.msg_name = &conn_addr_;
+        message.msg_namelen = sizeof(conn_addr_);
+        message.msg_iov = &datagrams_[message_id];
+        message.msg_iovlen = 1;
+    }
+
+    int status = sys_recvmmsg(sock_, datagram_headers_.data(), batch,
+                              MSG_WAITFORONE);
+    if (status <= 0) return status;
+
+    // Datagrams are packed together, the input is a byte stream.
+    size_t total = 0;
+    for (size_t message_id = 0; message_id < (size_t)status; ++message_id) {
+        const mmsghdr& header = datagram_headers_[message_id];
+
+        // Only part of an oversized datagram is in its slot. The frame
+        // would be completed with the next one's bytes, so the stream is
+        // lost.
+        if (header.msg_hdr.msg_flags & MSG_TRUNC) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+
+        memmove(region + total, datagrams_[message_id].iov_base,
+                header.msg_len);
+        total += header.msg_len;
+    }
+
+    return (ssize_t)total;
 }
 
 template <NetworkProtocol Protocol>
@@ -12,211 +12,1802 @@
 #pragma once
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
 #include <functional>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <thread>
+#include <vector>
 
 #include "basic_interface.h"
+#include "containers/client_table.h"
+#include "containers/mpsc_queue.h"
+#include "containers/spsc_queue.h"
+#include "containers/timer_wheel.h"
+#include "coroutine.h"
+#include "logger/logger.h"
+#include "reactor.h"
 
 struct NetworkClientInfo {
     int socket = 0;
     sockaddr_in address{};
+    std::chrono::steady_clock::time_point accepted_at{};
 };
 
+static const size_t MAX_PENDING_CLIENTS = 1024;
+
+static const size_t DEFAULT_CLIENT_LIMIT = 1024;
+
+// Payloads other threads may have posted to clients and the polling thread
+// has not picked up yet.
+static const size_t MAX_POSTED_PAYLOADS = 4096;
+
+// Receive buffer requested for the socket all UDP clients share, the kernel
+// caps it at net.core.rmem_max.
+static const int SHARED_SOCKET_BUFFER_SIZE = 8 << 20;  // bytes
+
+template <NetworkProtocol Protocol>
+struct NetworkServer : public NetworkConnection<Protocol> {
+    /**
+     * @brief Bind the server socket
+     *
+     * @param port port to listen on
+     * @param reuse_port allow several servers to bind the same port
+     * (SO_REUSEPORT), incoming connections get spread between them
+     */
+    explicit NetworkServer(in_port_t port, bool reuse_port = false);
+    ~NetworkServer();
+
+    NetworkServer(const NetworkServer&) = delete;
+    NetworkServer& operator=(const NetworkServer&) = delete;
+
+    /**
+     * @brief Start accepting clients on a background thread
+     *
+     * @note Accepted clients are handed to the calling thread through a
+     * lock-free queue and get registered by check_new_connections(). Not
+     * needed in the event loop mode, where poll_events() accepts clients.
+     */
+    void start_accepting();
+
+    /**
+     * @brief Register clients accepted by the background thread
+     *
+     * @param timeout_ms time to wait for a new client if none are pending,
+     * -1 to wait indefinitely
+     * @param external_fd (optional) descriptor that ends the wait once it is
+     * readable
+     * @return true if external_fd is readable
+     */
+    bool check_new_connections(int timeout_ms = 0, int external_fd = -1);
+
+    void stop_accepting();
+
+    using ClientId = int;
+
+    /**
+     * @brief Switch the server to the readiness-driven mode
+     *
+     * @note Listening socket and client sockets get watched by an epoll
+     * reactor, new clients are accepted and socket events are dispatched to
+     * the on_client_* hooks from inside poll_events().
+     *
+     * @return true if the event loop is ready to be polled
+     */
+    bool enable_event_loop();
+
+    /**
+     * @brief Wait for socket events and dispatch them
+     *
+     * @note Clients with input already buffered are reported without
+     * waiting, as long as something arrived or was received since they were
+     * last reported.
+     *
+     * @param timeout_ms maximum time to wait, -1 to wait indefinitely
+     * @return number of events dispatched
+     */
+    int poll_events(int timeout_ms);
+
+    /**
+     * @brief Request (or stop requesting) writability events for the client
+     *
+     * @param client client id
+     * @param enable true to receive on_client_writable() calls
+     */
+    void watch_writable(ClientId client, bool enable);
+
+    /**
+     * @brief Watch a non-client file descriptor (stdin, eventfd, timerfd...)
+     *
+     * @param fd file descriptor to watch for readability
+     * @return true if the descriptor was registered
+     */
+    bool watch_external(int fd);
+
+    bool is_event_driven() const { return reactor_ != nullptr; }
+
+    /**
+     * @brief Let coroutines running on the scheduler await clients
+     *
+     * @note Switches the server to the event loop mode and makes the
+     * scheduler poll it. From then on client readiness wakes the coroutine
+     * awaiting the client instead of calling on_client_readable(), readiness
+     * nobody awaits stays pending until somebody does.
+     *
+     * @param scheduler scheduler, has to outlive the server
+     * @return true if the scheduler is attached
+     */
+    bool set_scheduler(Scheduler& scheduler);
+
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Awaitable suspending the coroutine until the client can be read
+     * from (or written to)
+     *
+     * @note co_await evaluates to false if the client is gone or the
+     * deadline passes first. Without a scheduler it is always ready and the
+     * operation that follows blocks. Only one coroutine may await each
+     * direction of a client at a time.
+     */
+    struct ClientEvent {
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> handle);
+
+        bool await_resume() const {
+            return !timed_out && server->clients_.contains(client);
+        }
+
+        NetworkServer* server = nullptr;
+        ClientId client = -1;
+        bool writable = false;
+        Clock::time_point deadline = Clock::time_point::max();
+
+        std::coroutine_handle<> handle{};
+        uint64_t timer = 0;
+        bool timed_out = false;
+    };
+
+    ClientEvent readable(ClientId client,
+                         Clock::time_point deadline = Clock::time_point::max()) {
+        return {.server = this,
+                .client = client,
+                .writable = false,
+                .deadline = deadline};
+    }
+
+    ClientEvent writable(ClientId client,
+                         Clock::time_point deadline = Clock::time_point::max()) {
+        return {.server = this,
+                .client = client,
+                .writable = true,
+                .deadline = deadline};
+    }
+
+    /**
+     * @brief Bound the client's blocking operations by a deadline
+     *
+     * @note See NetworkConnection::set_deadline().
+     *
+     * @param client client id
+     * @param deadline time point, Clock::time_point::max() to lift the bound
+     */
+    void set_deadline(ClientId client, Clock::time_point deadline) {
+        NetworkConnection<Protocol>* client_conn = clients_.find(client);
+        if (client_conn) client_conn->set_deadline(deadline);
+    }
+
+    /**
+     * @brief Expire clients the event loop gets no input from for too long
+     *
+     * @note Expired clients are passed to on_client_idle().
+     *
+     * @param timeout time of silence allowed, zero to never expire clients
+     */
+    void set_idle_timeout(std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Hand a client accepted elsewhere over to this server
+     *
+     * @note Thread-safe. The client is registered (and on_client_connect() is
+     * called) from the thread running poll_events().
+     *
+     * @param client accepted client
+     */
+    void post_client(const NetworkClientInfo& client);
+
+    /**
+     * @brief Interrupt poll_events() from another thread
+     *
+     */
+    void wake();
+
+    enum class PostStatus {
+        QUEUED,
+        OVER_BUDGET,  // the client's backlog is over its budget
+        REJECTED,     // no send budget, unknown client or the queue is full
+    };
+
+    /**
+     * @brief Let other threads send through post_to(), within a budget
+     *
+     * @note Has to be called before anything is posted, and after
+     * set_client_limit(). A client whose backlog goes over high_water is
+     * refused until it drains to low_water, on_client_over_budget() and
+     * on_client_within_budget() mark both transitions.
+     *
+     * @param high_water backlog refusing further payloads, bytes
+     * @param low_water backlog accepting them again, bytes
+     */
+    void set_send_budget(size_t high_water, size_t low_water);
+
+    /**
+     * @brief Queue a payload for the client
+     *
+     * @note Thread-safe and never blocks. The payload is sent from the
+     * thread running poll_events(), to TCP clients once their socket can
+     * take it. Payloads of another encoding than the client's are dropped,
+     * as in broadcast(), and so are payloads still queued when the client
+     * leaves, even if a new client gets its id.
+     *
+     * @param client client id
+     * @param payload shared payload (see PayloadWriter)
+     * @return whether the payload was queued
+     */
+    PostStatus post_to(ClientId client, SharedPayload payload);
+
+    /**
+     * @brief Send what other threads posted
+     *
+     * @note Called from poll_events(), servers without an event loop have to
+     * call it themselves.
+     */
+    void drain_outboxes();
+
+    /**
+     * @brief Bytes posted to the client and not sent yet (any thread)
+     *
+     * @param client client id
+     * @return byte count
+     */
+    size_t get_backlog(ClientId client) const {
+        if (!outboxes_ || client < 0 || (size_t)client >= outbox_count_) {
+            return 0;
+        }
+
+        return outboxes_[(size_t)client].queued_bytes.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Install a functor that may take freshly accepted clients away
+     *
+     * @param redirect functor returning true if it took ownership of the client
+     */
+    void set_accept_redirect(
+        std::function<bool(const NetworkClientInfo&)> redirect) {
+        accept_redirect_ = std::move(redirect);
+    }
+
+    /**
+     * @brief Install a functor called whenever a client leaves the server
+     *
+     * @param notice functor called with the id of the dropped client, or -1
+     * for a client turned away at the client limit
+     */
+    void set_leave_notice(std::function<void(ClientId)> notice) {
+        leave_notice_ = std::move(notice);
+    }
+
+    size_t client_count() const { return clients_.size(); }
+
+    // Sends and receives belong to the polling thread, other threads send
+    // through post_to().
+    template <class T>
+    bool send_to(ClientId client, const T& content) {
+        assert(errno == 0);
+
+        NetworkConnection<Protocol>* client_conn = clients_.find(client);
+        if (!client_conn) return {};
+
+        if (client_conn->is_dead()) {
+            drop_client(client);
+            return {};
+        }
+
+        return client_conn->template send<T>(content);
+    }
+
+    template <class... Ts>
+    bool send_all_to(ClientId client, const Ts&... contents) {
+        assert(errno == 0);
+
+        NetworkConnection<Protocol>* client_conn = clients_.find(client);
+        if (!client_conn) return {};
+
+        if (client_conn->is_dead()) {
+            drop_client(client);
+            return {};
+        }
+
+        return client_conn->send_all(contents...);
+    }
+
+    // See the note above NetworkConnection::async_receive().
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+    /**
+     * @brief Wait for the client's message without holding the thread
+     *
+     * @note The coroutine is resumed once the whole message has arrived.
+     *
+     * @param client client id
+     * @param deadline time to give up waiting at
+     * @return the value, or nothing if the client is gone or silent past the
+     * deadline
+     */
+    template <class T>
+    Task<std::optional<T>> async_receive_from(
+        ClientId client,
+        Clock::time_point deadline = Clock::time_point::max()) {
+        // The rest of a message that started arriving is waited for as well.
+        while (!poll_message_from<T>(client)) {
+            bool ready = co_await readable(client, deadline);
+            if (!ready) co_return std::nullopt;
+        }
+
+        co_return receive_from<T>(client);
+    }
+
+    /**
+     * @brief Send the values once the client's socket can take them
+     *
+     * @warning The values are not copied, they have to outlive the task.
+     *
+     * @param client client id
+     * @return true if the values were sent
+     */
+    template <class... Ts>
+    Task<bool> async_send_all_to(ClientId client, const Ts&... contents) {
+        bool ready = co_await writable(client);
+        if (!ready) co_return false;
+
+        co_return send_all_to(client, contents...);
+    }
+
+    /**
+     * @brief Send the value once the client's socket can take it
+     *
+     * @warning The value is not copied, it has to outlive the task.
+     *
+     * @param client client id
+     * @param content value to send
+     * @param deadline time to give up waiting at
+     * @return true if the value was sent
+     */
+    template <class T>
+    Task<bool> async_send_to(
+        ClientId client, const T& content,
+        Clock::time_point deadline = Clock::time_point::max()) {
+        bool ready = co_await writable(client, deadline);
+        if (!ready) co_return false;
+
+        co_return send_all_to(client, content);
+    }
+
+#pragma GCC diagnostic pop
+
+    template <class T>
+    std::optional<T> receive_from(ClientId client) {
+        assert(errno == 0);
+
+        NetworkConnection<Protocol>* client_conn = clients_.find(client);
+        if (!client_conn) return {};
+
+        if (client_conn->is_dead()) {
+            drop_client(client);
+            return {};
+        }
+
+        std::optional<T> result = client_conn->template receive<T>();
+        note_input(client);
+
+        return result;
+    }
+
+    /**
+     * @brief Take in what the client sent without waiting and check whether
+     * a whole message can be received
+     *
+     * @param client client id
+     * @return true if receive_from<T>() can go without waiting
+     */
+    template <class T>
+    bool poll_message_from(ClientId client) {
+        assert(errno == 0);
+
+        NetworkConnection<Protocol>* client_conn = clients_.find(client);
+        if (!client_conn) return true;
+
+        bool whole = client_conn->template poll_message<T>();
+        note_input(client);
+
+        return whole;
+    }
+
+    /**
+     * @brief Receive a string from the client without copying it
+     *
+     * @warning The view is invalidated by the next receive from the client.
+     *
+     * @param client client id
+     * @return view of the string body
+     */
+    std::optional<std::string_view> receive_view_from(ClientId client) {
+        assert(errno == 0);
+
+        NetworkConnection<Protocol>* client_conn = clients_.find(client);
+        if (!client_conn) return {};
+
+        if (client_conn->is_dead()) {
+            drop_client(client);
+            return {};
+        }
+
+        std::optional<std::string_view> result = client_conn->receive_view();
+        note_input(client);
+
+        return result;
+    }
+
+    using ClientFilter = std::function<bool(ClientId)>;
+
+    /**
+     * @brief Send the same pre-encoded payload to many clients
+     *
+     * @note Clients using another encoding than the payload are skipped.
+     *
+     * @param payload shared payload (see PayloadWriter)
+     * @param filter (optional) predicate selecting recipients
+     * @return number of clients the payload was sent to
+     */
+    size_t broadcast(const SharedPayload& payload,
+                     const ClientFilter& filter = {});
+
+    /**
+     * @brief Encode the value once and send it to many clients
+     *
+     * @param content value to send
+     * @param filter (optional) predicate selecting recipients
+     * @return number of clients the value was sent to
+     */
+    template <class T>
+    size_t broadcast(const T& content, const ClientFilter& filter = {}) {
+        return broadcast_encoded(filter, content);
+    }
+
+    /**
+     * @brief Encode several values into one payload and send it to every
+     * client
+     *
+     * @param contents values to send, in order
+     * @return number of clients the values were sent to
+     */
+    template <class... Ts>
+    size_t broadcast_many(const Ts&... contents) {
+        return broadcast_encoded({}, contents...);
+    }
+
+    /**
+     * @brief Encode the value once and send it to the listed clients
+     *
+     * @note Unlike broadcast(), only the listed clients are visited.
+     *
+     * @param recipients client ids, unknown ones are skipped
+     * @param content value to send
+     * @return number of clients the value was sent to
+     */
+    template <class T>
+    size_t multicast(const std::vector<ClientId>& recipients,
+                     const T& content);
+
+    /**
+     * @brief Switch the client to another wire version (see
+     * NetworkConnection::set_wire_version())
+     *
+     * @param client client id
+     * @param version wire version
+     */
+    void set_wire_version(ClientId client, WireVersion version) {
+        if (auto* client_conn = clients_.find(client)) {
+            client_conn->set_wire_version(version);
+        }
+    }
+
+    /**
+     * @brief Wire version the client uses
+     *
+     * @param client client id
+     * @return wire version, WireVersion::V1 for unknown clients
+     */
+    WireVersion get_wire_version(ClientId client) const {
+        const auto* client_conn = clients_.find(client);
+
+        return client_conn ? client_conn->wire_version() : WireVersion::V1;
+    }
+
+    /**
+     * @brief Enable compression for the client (see
+     * NetworkConnection::set_compression())
+     *
+     * @param client client id
+     * @param threshold minimum body size worth compressing, 0 to disable
+     * @param dictionary shared LZ dictionary
+     */
+    void set_compression(ClientId client, size_t threshold,
+                         std::string_view dictionary = {}) {
+        if (auto* client_conn = clients_.find(client)) {
+            client_conn->set_compression(threshold, dictionary);
+        }
+    }
+
+    /**
+     * @brief Switch reliable delivery for the client (see
+     * NetworkConnection::set_reliable())
+     *
+     * @param client client id
+     * @param enable whether to use reliable delivery
+     * @return true if the mode was switched
+     */
+    bool set_reliable(ClientId client, bool enable) {
+        auto* client_conn = clients_.find(client);
+
+        return client_conn && client_conn->set_reliable(enable);
+    }
+
+    /**
+     * @brief Size UDP chunks for the client to the path MTU (see
+     * NetworkConnection::discover_path_mtu())
+     *
+     * @param client client id
+     * @return chunk size in bytes, 0 for unknown clients
+     */
+    size_t discover_path_mtu(ClientId client) {
+        auto* client_conn = clients_.find(client);
+
+        return client_conn ? client_conn->discover_path_mtu() : 0;
+    }
+
+    bool flush_to(ClientId client) {
+        assert(errno == 0);
+
+        auto* client_conn = clients_.find(client);
+
+        return client_conn && client_conn->flush();
+    }
+
+    /**
+     * @brief Limit the number of clients served at once
+     *
+     * @note Client state is preallocated for the whole limit, so it can only
+     * be changed while no clients are connected. Clients past the limit are
+     * turned away.
+     *
+     * @param limit maximum client count
+     * @return true if the limit was changed
+     */
+    bool set_client_limit(size_t limit) {
+        if (!clients_.empty()) return false;
+
+        clients_ = ClientTable<NetworkConnection<Protocol>>(limit);
+
+        return true;
+    }
+
+    size_t get_client_limit() const { return clients_.capacity(); }
+
+    /**
+     * @brief Select the transport backend for accepted clients
+     *
+     * @param backend transport backend
+     */
+    void set_client_backend(NetworkBackend backend) {
+        client_backend_ = backend;
+    }
+
+    /**
+     * @brief Enable output coalescing for accepted clients
+     *
+     * @param flush_threshold see NetworkConnection::set_output_buffering()
+     */
+    void set_client_buffering(size_t flush_threshold) {
+        client_flush_threshold_ = flush_threshold;
+    }
+
+    /**
+     * @brief Bound the size of the frames accepted clients may send
+     *
+     * @param max_size see NetworkConnection::set_max_frame_size()
+     */
+    void set_client_max_frame_size(size_t max_size) {
+        client_max_frame_size_ = max_size;
+    }
+
+    /**
+     * @brief Set datagram batching for accepted clients
+     *
+     * @param send_batch see NetworkConnection::set_datagram_batching()
+     * @param recv_batch see NetworkConnection::set_datagram_batching()
+     */
+    void set_client_datagram_batching(size_t send_batch, size_t recv_batch) {
+        client_send_batch_ = send_batch;
+        client_recv_batch_ = recv_batch;
+    }
+
+    /**
+     * @brief Enable segmentation offload for accepted clients
+     *
+     * @note UDP clients share the socket, so coalescing is switched for all
+     * of them at once.
+     *
+     * @param enable see NetworkConnection::set_segmentation_offload()
+     */
+    void set_client_segmentation_offload(bool enable) {
+        client_segmentation_offload_ = enable;
+        client_communicator_.set_segmentation_offload(enable);
+    }
+
+    bool is_alive(ClientId client) const {
+        assert(errno == 0);
+
+        const auto* client_conn = clients_.find(client);
+
+        return client_conn && !client_conn->is_dead();
+    }
+
+    void remove_dead() {
+        assert(errno == 0);
+
+        for (auto [client, client_conn] : clients_) {
+            if (client_conn.is_dead()) drop_client(client);
+        }
+
+        assert(errno == 0);
+    }
+
+   protected:
+    virtual void on_client_connect(ClientId client) {}
+    virtual void on_client_disconnect(ClientId client) {}
+
+    /**
+     * @brief Called from poll_events() when client data can be read
+     *
+     * @warning Epoll is level-triggered, so the data has to be consumed, or the
+     * hook will be called again on the next poll.
+     */
+    virtual void on_client_readable(ClientId client) {}
+    virtual void on_client_writable(ClientId client) {}
+    virtual void on_client_hangup(ClientId client) { drop_client(client); }
+
+    virtual void on_client_idle(ClientId client) {
+        log_printf(STATUS_REPORTS, "status",
+                   "Client %d has been silent for too long.\n", client);
+        drop_client(client);
+    }
+
+    virtual void on_client_over_budget(ClientId client) {
+        log_printf(STATUS_REPORTS, "status",
+                   "Client %d is not keeping up with its messages.\n",
+                   client);
+    }
+
+    virtual void on_client_within_budget(ClientId client) {}
+
+    virtual void on_external_event(int fd, uint32_t events) {}
+
+    void drop_client(ClientId client);
+
+   private:
+    NetworkClientInfo accept_client();
+    ClientId assign_client_id(const NetworkClientInfo& client);
+    void setup_client(NetworkConnection<Protocol>& connection,
+                      ClientId client);
+
+    template <class... Ts>
+    size_t broadcast_encoded(const ClientFilter& filter,
+                             const Ts&... contents);
+
+    template <class... Ts>
+    static bool send_encoded(NetworkConnection<Protocol>& client_conn,
+                             std::vector<SharedPayload>& payloads,
+                             const Ts&... contents);
+
+    void register_client(const NetworkClientInfo& client);
+
+    ClientId find_client_by_socket(int fd) const {
+        if (fd < 0 || (size_t)fd >= client_ids_.size()) return -1;
+
+        return client_ids_[(size_t)fd];
+    }
+
+    void accept_pending();
+    void note_input(ClientId client);
+    void dispatch_event(int fd, uint32_t events);
+    bool notify_readable(ClientId client);
+    bool notify_writable(ClientId client);
+    bool wake_waiter(std::vector<ClientEvent*>& waiters, ClientId client);
+    void rearm_client(ClientId client);
+
+    void touch_client(ClientId client);
+    size_t expire_timers();
+    void dispatch_datagrams();
+    void drain_inbox();
+
+    bool send_backlog(ClientId client);
+    void settle_backlog(ClientId client, size_t sent_bytes);
+    void discard_backlog(ClientId client);
+
+    // Client ids index the table, TCP clients are found by their socket
+    // through client_ids_.
+    ClientTable<NetworkConnection<Protocol>> clients_{DEFAULT_CLIENT_LIMIT};
+    std::vector<ClientId> client_ids_{};
+
+    std::unique_ptr<Reactor> reactor_{};
+
+    // Clients whose input was taken from the socket but not all consumed,
+    // epoll does not report it again. Listed by note_input(), walked by
+    // poll_events().
+    std::vector<ClientId> buffered_{};
+    std::vector<ClientId> buffered_walk_{};
+    std::vector<bool> buffered_listed_{};  // indexed by client id
+
+    // Coroutines awaiting clients, indexed by client id. TCP client sockets
+    // are only watched while somebody awaits them.
+    Scheduler* scheduler_ = nullptr;
+    int scheduler_fd_ = -1;
+    std::vector<ClientEvent*> read_waiters_{};
+    std::vector<ClientEvent*> write_waiters_{};
+
+    enum class ClientTimerKind {
+        IDLE,
+        READ_DEADLINE,
+        WRITE_DEADLINE,
+    };
+
+    struct ClientTimer {
+        ClientId client = -1;
+        ClientTimerKind kind = ClientTimerKind::IDLE;
+    };
+
+    // Expired from poll_events(), which waits no longer than the nearest.
+    TimerWheel<ClientTimer> timers_{};
+
+    std::chrono::milliseconds idle_timeout_{};
+    std::vector<uint64_t> idle_timers_{};  // indexed by client id
+
+    NetworkBackend client_backend_ = NetworkBackend::SYSCALL;
+    size_t client_flush_threshold_ = 0;
+    size_t client_max_frame_size_ = DEFAULT_MAX_FRAME_SIZE;
+    size_t client_send_batch_ = DEFAULT_DATAGRAM_BATCH;
+    size_t client_recv_batch_ = DEFAULT_DATAGRAM_BATCH;
+    bool client_segmentation_offload_ = false;
+
+    std::function<bool(const NetworkClientInfo&)> accept_redirect_{};
+    std::function<void(ClientId)> leave_notice_{};
+
+    std::mutex inbox_mutex_{};
+    std::vector<NetworkClientInfo> inbox_{};
+    int inbox_event_ = -1;
+
+    // Budget of a client, shared with the posting threads.
+    struct Outbox {
+        std::atomic<size_t> queued_bytes = 0;
+        std::atomic<bool> over_budget = false;
+
+        // Moves on whenever the client leaves, the id may be reused.
+        std::atomic<uint32_t> generation = 0;
+    };
+
+    // Posted payloads picked up by the polling thread, in order.
+    struct Backlog {
+        std::vector<SharedPayload> payloads{};
+        size_t sent = 0;
+
+        bool listed = false;    // in backlogged_
+        bool watching = false;  // for the socket to become writable
+        bool reported = false;  // to on_client_over_budget()
+    };
+
+    // Payload-less posts tell the polling thread a client went over budget.
+    struct PostedPayload {
+        ClientId client = -1;
+        uint32_t generation = 0;
+        SharedPayload payload{};
+    };
+
+    using PostQueue = MpscQueue<PostedPayload, MAX_POSTED_PAYLOADS>;
+
+    std::unique_ptr<PostQueue> posted_{};
+    std::unique_ptr<Outbox[]> outboxes_{};
+    size_t outbox_count_ = 0;
+    size_t send_high_water_ = 0;
+    size_t send_low_water_ = 0;
+
+    std::vector<Backlog> backlogs_{};  // indexed by client id
+    std::vector<ClientId> backlogged_{};
+
+    using AcceptQueue = SpscQueue<NetworkClientInfo, MAX_PENDING_CLIENTS>;
+
+    std::jthread conn_listener_{};
+    std::unique_ptr<AcceptQueue> accept_queue_{};
+    int accept_event_ = -1;
+    int accept_stop_ = -1;
+
+    // UDP clients share this socket, their datagrams are told apart by the
+    // demultiplexer and their ids are its slots.
+    NetworkConnection<Protocol> client_communicator_{};
+    std::unique_ptr<UdpDemux> client_demux_{};
+    std::vector<int> ready_slots_{};
+};
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::start_accepting() {
+    assert(errno == 0);
+
+    if (reactor_ || conn_listener_.joinable()) return;
+
+    accept_queue_ = std::make_unique<AcceptQueue>();
+    accept_event_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    accept_stop_ = eventfd(0, EFD_CLOEXEC);
+
+    auto listen_for_conns = [this](std::stop_token stop) {
+        assert(errno == 0);
+
+        pollfd watched[] = {
+            {.fd = this->sock_, .events = POLLIN, .revents = 0},
+            {.fd = accept_stop_, .events = POLLIN, .revents = 0},
+        };
+
+        while (!stop.stop_requested()) {
+            if (poll(watched, 2, -1) < 0) {
+                errno = 0;
+                continue;
+            }
+
+            if (watched[1].revents) break;
+            if (!(watched[0].revents & POLLIN)) continue;
+
+            NetworkClientInfo client = accept_client();
+
+            if (client.socket < 0) {
+                errno = 0;
+                continue;
+            }
+
+            client.accepted_at = std::chrono::steady_clock::now();
+
+            while (!accept_queue_->push(client)) {
+                if (stop.stop_requested()) return;
+                std::this_thread::yield();
+            }
+
+            uint64_t increment = 1;
+            write(accept_event_, &increment, sizeof(increment));
+
+            errno = 0;
+        }
+    };
+
+    conn_listener_ = std::jthread(listen_for_conns);
+
+    assert(errno == 0);
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkServer<Protocol>::
+    check_new_connections(int timeout_ms, int external_fd) {
+    assert(errno == 0);
+
+    if (!accept_queue_) return false;
+
+    pollfd watched[] = {
+        {.fd = accept_event_, .events = POLLIN, .revents = 0},
+        {.fd = external_fd, .events = POLLIN, .revents = 0},
+    };
+
+    if (timeout_ms != 0 || external_fd >= 0) {
+        poll(watched, external_fd >= 0 ? 2 : 1, timeout_ms);
+    }
+
+    uint64_t counter = 0;
+    read(accept_event_, &counter, sizeof(counter));
+
+    errno = 0;
+
+    while (std::optional<NetworkClientInfo> client = accept_queue_->pop()) {
+        register_client(*client);
+    }
+
+    assert(errno == 0);
+
+    return watched[1].revents != 0;
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::
+    register_client(const NetworkClientInfo& client) {
+    assert(errno == 0);
+
+    if (client.socket < 0) return;
+
+    ClientId client_id = assign_client_id(client);
+
+    auto [client_entry, inserted] = clients_.try_emplace(client_id);
+
+    if (!client_entry) {
+        log_printf(STATUS_REPORTS, "status",
+                   "Client limit of %zu reached, a client was turned away.\n",
+                   clients_.capacity());
+
+        if (Protocol == NetworkProtocol::TCP) close(client.socket);
+        if (client_demux_ && client_id >= 0) client_demux_->detach(client_id);
+
+        if (leave_notice_) leave_notice_(-1);
+
+        return;
+    }
+
+    NetworkConnection<Protocol>& client_conn = *client_entry;
+    client_conn.sock_ = client.socket;
+    client_conn.conn_addr_ = client.address;
+
+    setup_client(client_conn, client_id);
+
+    if (inserted) {
+        client_conn.set_backend(client_backend_);
+        if (Protocol == NetworkProtocol::TCP) client_conn.set_nonblocking();
+        client_conn.set_output_buffering(client_flush_threshold_);
+        client_conn.set_max_frame_size(client_max_frame_size_);
+        client_conn.set_datagram_batching(client_send_batch_,
+                                          client_recv_batch_);
+
+        if (client_segmentation_offload_) {
+            client_conn.set_segmentation_offload(true);
+        }
+    }
+
+    if (inserted) touch_client(client_id);
+
+    if (reactor_ && inserted && Protocol == NetworkProtocol::TCP) {
+        // Clients of a scheduler are watched once they are awaited.
+        reactor_->watch(client.socket,
+                        scheduler_ ? 0 : (uint32_t)REACTOR_READABLE);
+    }
+
+    if (client.accepted_at != std::chrono::steady_clock::time_point{}) {
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - client.accepted_at);
+
+        log_printf(STATUS_REPORTS, "status",
+                   "Client %d registered %lld us after being accepted.\n",
+                   client_id, (long long)latency.count());
+    }
+
+    on_client_connect(client_id);
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::drop_client(ClientId client) {
+    assert(errno == 0);
+
+    NetworkConnection<Protocol>* client_conn = clients_.find(client);
+    if (!client_conn) return;
+
+    if (Protocol == NetworkProtocol::TCP) {
+        if (reactor_) reactor_->forget(client_conn->sock_);
+        client_ids_[(size_t)client_conn->sock_] = -1;
+    }
+
+    clients_.erase(client);
+    if (client_demux_) client_demux_->detach(client);
+
+    // Awaiting coroutines find the client gone.
+    wake_waiter(read_waiters_, client);
+    wake_waiter(write_waiters_, client);
+
+    if ((size_t)client < idle_timers_.size()) {
+        timers_.cancel(std::exchange(idle_timers_[(size_t)client], 0));
+    }
+
+    discard_backlog(client);
+
+    if (leave_notice_) leave_notice_(client);
+
+    on_client_disconnect(client);
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkServer<Protocol>::enable_event_loop() {
+    assert(errno == 0);
+
+    if (reactor_) return true;
+
+    reactor_ = std::make_unique<Reactor>();
+
+    if (!reactor_->is_valid() ||
+        !reactor_->watch(this->sock_, REACTOR_READABLE)) {
+        reactor_.reset();
+        return false;
+    }
+
+    fcntl(this->sock_, F_SETFL,
+          fcntl(this->sock_, F_GETFL, 0) | O_NONBLOCK);
+
+    inbox_event_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    reactor_->watch(inbox_event_, REACTOR_READABLE);
+
+    if (Protocol == NetworkProtocol::UDP) {
+        reactor_->watch(client_communicator_.sock_, REACTOR_READABLE);
+    } else {
+        for (auto [client, client_conn] : clients_) {
+            reactor_->watch(client_conn.sock_, REACTOR_READABLE);
+        }
+    }
+
+    assert(errno == 0);
+
+    return true;
+}
+
+template <NetworkProtocol Protocol>
+inline int NetworkServer<Protocol>::poll_events(int timeout_ms) {
+    assert(errno == 0);
+
+    if (!reactor_) return 0;
+
+    // Datagrams routed while another client was reading are out of the
+    // socket already.
+    if (client_demux_) {
+        client_demux_->take_ready(ready_slots_);
+        for (ClientId client : ready_slots_) note_input(client);
+    }
+
+    // Bytes already pulled into receive buffers never wake epoll up again.
+    buffered_walk_.swap(buffered_);
+    buffered_.clear();
+
+    int dispatched = 0;
+    for (ClientId client : buffered_walk_) {
+        buffered_listed_[(size_t)client] = false;
+
+        NetworkConnection<Protocol>* client_conn = clients_.find(client);
+        if (!client_conn || !client_conn->poll_input()) continue;
+
+        // A hook leaving the input as it is, say the start of a frame, is
+        // not called for it again until more arrives.
+        client_conn->take_pending_input();
+        client_conn->input_.mark_seen();
+
+        if (notify_readable(client)) ++dispatched;
+
+        note_input(client);
+    }
+
+    // The wait ends in time for the nearest client timer.
+    int timers_ms = timers_.timeout_ms();
+    if (timers_ms >= 0 && (timeout_ms < 0 || timers_ms < timeout_ms)) {
+        timeout_ms = timers_ms;
+    }
+
+    if (dispatched > 0) timeout_ms = 0;
+
+    dispatched += reactor_->poll(timeout_ms, [this](int fd, uint32_t events) {
+        dispatch_event(fd, events);
+    });
+
+    return dispatched + (int)expire_timers();
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::note_input(ClientId client) {
+    NetworkConnection<Protocol>* client_conn = clients_.find(client);
+    if (!client_conn || !client_conn->has_buffered_input()) return;
+
+    if (buffered_listed_.size() <= (size_t)client) {
+        buffered_listed_.resize((size_t)client + 1);
+    }
+
+    if (buffered_listed_[(size_t)client]) return;
+
+    buffered_listed_[(size_t)client] = true;
+    buffered_.push_back(client);
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::
+    dispatch_event(int fd, uint32_t events) {
+    assert(errno == 0);
+
+    if (fd == this->sock_) {
+        if (events & REACTOR_READABLE) accept_pending();
+        return;
+    }
+
+    if (fd == inbox_event_) {
+        drain_inbox();
+        return;
+    }
+
+    if (scheduler_ && fd == scheduler_fd_) {
+        scheduler_->poll_descriptors(0);
+        return;
+    }
+
+    // UDP client ids are not descriptors, all of their traffic arrives at
+    // the shared socket.
+    if (Protocol == NetworkProtocol::UDP) {
+        if (fd == client_communicator_.sock_) {
+            dispatch_datagrams();
+        } else {
+            on_external_event(fd, events);
+        }
+
+        return;
+    }
+
+    ClientId client = find_client_by_socket(fd);
+
+    if (client < 0) {
+        on_external_event(fd, events);
+        return;
+    }
+
+    if (events & REACTOR_HANGUP) {
+        on_client_hangup(client);
+        return;
+    }
+
+    if (events & REACTOR_READABLE) {
+        notify_readable(client);
+        note_input(client);
+    }
+
+    if (!clients_.contains(client)) return;
+
+    if (clients_[client].is_dead()) {
+        on_client_hangup(client);
+        return;
+    }
+
+    if (events & REACTOR_WRITABLE) notify_writable(client);
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::dispatch_datagrams() {
+    assert(errno == 0);
+
+    client_demux_->pump();
+    client_demux_->take_ready(ready_slots_);
+
+    for (ClientId client : ready_slots_) {
+        NetworkConnection<Protocol>* client_conn = clients_.find(client);
+        if (!client_conn || !client_conn->poll_input()) continue;
+
+        notify_readable(client);
+        note_input(client);
+
+        // The hook may have dropped the client.
+        client_conn = clients_.find(client);
+        if (client_conn && client_conn->is_dead()) on_client_hangup(client);
+    }
+}
+
 template <NetworkProtocol Protocol>
-struct NetworkServer : public NetworkConnection<Protocol> {
-    NetworkServer(in_port_t port);
-    ~NetworkServer();
+inline size_t NetworkServer<Protocol>::broadcast(const SharedPayload& payload,
+                                                 const ClientFilter& filter) {
+    assert(errno == 0);
 
-    void start_accepting(in_port_t local_port);
-    void check_new_connections();
-    void stop_accepting();
+    size_t recipients = 0;
 
-    using ClientId = int;
+    for (auto [client, client_conn] : clients_) {
+        if (filter && !filter(client)) continue;
 
-    template <class T>
-    bool send_to(ClientId client, const T& content) {
-        assert(errno == 0);
+        if (client_conn.send_payload(*payload)) ++recipients;
+    }
+
+    return recipients;
+}
 
-        if (!clients_.contains(client)) return {};
+template <NetworkProtocol Protocol>
+template <class... Ts>
+inline size_t NetworkServer<Protocol>::
+    broadcast_encoded(const ClientFilter& filter, const Ts&... contents) {
+    assert(errno == 0);
 
-        NetworkConnection<Protocol>& client_conn = clients_[client];
+    std::vector<SharedPayload> payloads{};
 
-        if (client_conn.is_dead()) {
-            clients_.erase(client);
-            on_client_disconnect(client);
-            return {};
-        }
+    size_t recipients = 0;
 
-        return client_conn.template send<T>(content);
+    for (auto [client, client_conn] : clients_) {
+        if (filter && !filter(client)) continue;
+
+        if (send_encoded(client_conn, payloads, contents...)) ++recipients;
     }
 
-    template <class T>
-    std::optional<T> receive_from(ClientId client) {
-        assert(errno == 0);
+    return recipients;
+}
 
-        if (!clients_.contains(client)) return {};
+template <NetworkProtocol Protocol>
+template <class T>
+inline size_t NetworkServer<Protocol>::
+    multicast(const std::vector<ClientId>& recipients, const T& content) {
+    assert(errno == 0);
 
-        NetworkConnection<Protocol>& client_conn = clients_[client];
+    std::vector<SharedPayload> payloads{};
 
-        if (client_conn.is_dead()) {
-            clients_.erase(client);
-            on_client_disconnect(client);
-            return {};
-        }
+    size_t sent = 0;
+
+    for (ClientId client : recipients) {
+        NetworkConnection<Protocol>* client_conn = clients_.find(client);
+        if (!client_conn) continue;
 
-        return client_conn.template receive<T>();
+        if (send_encoded(*client_conn, payloads, content)) ++sent;
     }
 
-    bool is_alive(ClientId client) const {
-        assert(errno == 0);
+    return sent;
+}
 
-        return clients_.contains(client) && !clients_[client].is_dead();
+template <NetworkProtocol Protocol>
+template <class... Ts>
+inline bool NetworkServer<Protocol>::
+    send_encoded(NetworkConnection<Protocol>& client_conn,
+                 std::vector<SharedPayload>& payloads, const Ts&... contents) {
+    // Every encoding and UDP chunk size present gets its own payload,
+    // encoded once.
+    size_t chunk_size = Protocol == NetworkProtocol::UDP
+                            ? client_conn.get_chunk_size()
+                            : UDP_OPTIMAL_SIZE;
+
+    auto payload = std::find_if(
+        payloads.begin(), payloads.end(), [&](const SharedPayload& known) {
+            return known->encoding == client_conn.encoding() &&
+                   known->chunk_size == chunk_size;
+        });
+
+    if (payload == payloads.end()) {
+        PayloadWriter<Protocol> writer(client_conn.encoding(), chunk_size);
+        (writer.put(contents), ...);
+
+        payloads.push_back(writer.finish());
+        payload = payloads.end() - 1;
     }
 
-    void remove_dead() {
-        assert(errno == 0);
+    return client_conn.send_payload(**payload);
+}
 
-        for (auto& [client, client_conn] : clients_) {
-            if (!client_conn.is_dead()) continue;
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::post_client(
+    const NetworkClientInfo& client) {
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        inbox_.push_back(client);
+    }
 
-            clients_.erase(client);
-            on_client_disconnect(client);
-        }
+    wake();
+}
 
-        assert(errno == 0);
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::wake() {
+    if (inbox_event_ < 0) return;
+
+    int saved_errno = errno;
+
+    uint64_t increment = 1;
+    write(inbox_event_, &increment, sizeof(increment));
+
+    errno = saved_errno;
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::drain_inbox() {
+    assert(errno == 0);
+
+    uint64_t counter = 0;
+    read(inbox_event_, &counter, sizeof(counter));
+    errno = 0;
+
+    std::vector<NetworkClientInfo> arrived{};
+
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        arrived.swap(inbox_);
     }
 
-   protected:
-    virtual void on_client_connect(ClientId client) {}
-    virtual void on_client_disconnect(ClientId client) {}
+    for (const NetworkClientInfo& client : arrived) register_client(client);
 
-   private:
-    NetworkClientInfo accept_client();
-    void setup_client(NetworkConnection<Protocol>& connection);
+    drain_outboxes();
+}
 
-    std::map<ClientId, NetworkConnection<Protocol>> clients_{};
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::set_send_budget(size_t high_water,
+                                                     size_t low_water) {
+    assert(low_water <= high_water);
 
-    std::jthread conn_listener_{};
-    int local_sock_ = 0;
+    send_high_water_ = high_water;
+    send_low_water_ = low_water;
 
-    NetworkConnection<Protocol> client_communicator_{};
+    if (outboxes_) return;
 
-    int local_server_ = 0;
-};
+    outbox_count_ = clients_.capacity();
+    outboxes_ = std::make_unique<Outbox[]>(outbox_count_);
+    backlogs_.resize(outbox_count_);
+    posted_ = std::make_unique<PostQueue>();
+}
+
+template <NetworkProtocol Protocol>
+inline typename NetworkServer<Protocol>::PostStatus NetworkServer<Protocol>::
+    post_to(ClientId client, SharedPayload payload) {
+    if (!outboxes_ || !payload || client < 0 ||
+        (size_t)client >= outbox_count_) {
+        return PostStatus::REJECTED;
+    }
+
+    Outbox& outbox = outboxes_[(size_t)client];
+    if (outbox.over_budget.load(std::memory_order_acquire)) {
+        return PostStatus::OVER_BUDGET;
+    }
+
+    uint32_t generation = outbox.generation.load(std::memory_order_acquire);
+
+    size_t size = payload->bytes.size();
+    size_t queued =
+        outbox.queued_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+
+    if (queued > send_high_water_) {
+        outbox.queued_bytes.fetch_sub(size, std::memory_order_relaxed);
+
+        // Only the thread flipping the flag tells the polling thread, which
+        // is the one to clear it.
+        bool expected = false;
+        if (outbox.over_budget.compare_exchange_strong(expected, true)) {
+            if (posted_->push({.client = client, .generation = generation})) {
+                wake();
+            } else {
+                outbox.over_budget.store(false, std::memory_order_release);
+            }
+        }
+
+        return PostStatus::OVER_BUDGET;
+    }
+
+    if (!posted_->push({.client = client,
+                        .generation = generation,
+                        .payload = std::move(payload)})) {
+        outbox.queued_bytes.fetch_sub(size, std::memory_order_relaxed);
+        return PostStatus::REJECTED;
+    }
+
+    wake();
+
+    return PostStatus::QUEUED;
+}
 
 template <NetworkProtocol Protocol>
-inline void NetworkServer<Protocol>::start_accepting(in_port_t local_port) {
+inline void NetworkServer<Protocol>::drain_outboxes() {
     assert(errno == 0);
 
-    local_server_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (!posted_) return;
 
-    auto listen_for_conns = [=, this]() {
-        assert(errno == 0);
+    while (std::optional<PostedPayload> posted = posted_->pop()) {
+        ClientId client = posted->client;
+        Backlog& backlog = backlogs_[(size_t)client];
 
-        sockaddr_in addr{};
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(local_port);
-        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        // Posts to a client that left never reach the next one with its id.
+        bool current =
+            clients_.contains(client) &&
+            posted->generation == outboxes_[(size_t)client].generation.load(
+                                      std::memory_order_relaxed);
 
-        bind(local_server_, (sockaddr*)&addr, sizeof(addr));
+        if (!posted->payload) {
+            if (!current) {
+                outboxes_[(size_t)client].over_budget.store(false);
+                continue;
+            }
 
-        assert(errno == 0);
+            backlog.reported = true;
+            on_client_over_budget(client);
 
-        listen(local_server_, 1);
+            // The backlog may have drained before the flag was raised.
+            settle_backlog(client, 0);
+            continue;
+        }
 
-        assert(errno == 0);
+        if (!current) {
+            outboxes_[(size_t)client].queued_bytes.fetch_sub(
+                posted->payload->bytes.size(), std::memory_order_relaxed);
+            continue;
+        }
 
-        int loopback = accept(local_server_, nullptr, nullptr);
+        backlog.payloads.push_back(std::move(posted->payload));
 
-        assert(errno == 0);
+        if (!backlog.listed) {
+            backlog.listed = true;
+            backlogged_.push_back(client);
+        }
+    }
 
-        for (;;) {
-            NetworkClientInfo client = accept_client();
+    // Clients waiting for their socket are sent to from notify_writable().
+    size_t kept = 0;
+    for (size_t index = 0; index < backlogged_.size(); ++index) {
+        ClientId client = backlogged_[index];
+        Backlog& backlog = backlogs_[(size_t)client];
+
+        if (backlog.watching || !send_backlog(client)) {
+            backlogged_[kept++] = client;
+        } else {
+            backlog.listed = false;
+        }
+    }
+
+    backlogged_.resize(kept);
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkServer<Protocol>::send_backlog(ClientId client) {
+    Backlog& backlog = backlogs_[(size_t)client];
+
+    NetworkConnection<Protocol>* client_conn = clients_.find(client);
+    if (!client_conn) {
+        discard_backlog(client);
+        return true;
+    }
 
-            send(loopback, &client, sizeof(client), 0);
+    size_t sent_bytes = 0;
 
-            if (errno != 0) break;
+    // A slow reader keeps its backlog instead of blocking the thread, the
+    // part of a payload its socket did not take waits in the connection.
+    bool drained = client_conn->try_flush();
+
+    while (drained && backlog.sent < backlog.payloads.size()) {
+        SharedPayload payload = std::move(backlog.payloads[backlog.sent++]);
+
+        drained = client_conn->try_send_payload(*payload);
+        sent_bytes += payload->bytes.size();
+    }
+
+    if (Protocol == NetworkProtocol::UDP) flush_to(client);
+
+    if (backlog.sent == backlog.payloads.size()) {
+        backlog.payloads.clear();
+        backlog.sent = 0;
+    }
+
+    bool emptied = drained && backlog.payloads.empty();
+
+    // TCP backlogs resume once the socket becomes writable.
+    if (backlog.watching == emptied) {
+        backlog.watching = !emptied;
+
+        if (scheduler_) {
+            rearm_client(client);
+        } else {
+            watch_writable(client, !emptied);
         }
-    };
+    }
 
-    conn_listener_ = std::jthread(listen_for_conns);
+    settle_backlog(client, sent_bytes);
 
-    local_sock_ = socket(AF_INET, SOCK_STREAM, 0);
+    return emptied;
+}
 
-    assert(errno == 0);
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::settle_backlog(ClientId client,
+                                                    size_t sent_bytes) {
+    Outbox& outbox = outboxes_[(size_t)client];
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(local_port);
-    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    size_t queued = outbox.queued_bytes.fetch_sub(sent_bytes,
+                                                  std::memory_order_relaxed) -
+                    sent_bytes;
 
-    sleep(1);
+    Backlog& backlog = backlogs_[(size_t)client];
+    if (!backlog.reported || queued > send_low_water_) return;
 
-    assert(errno == 0);
+    backlog.reported = false;
+    outbox.over_budget.store(false, std::memory_order_release);
+
+    on_client_within_budget(client);
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::discard_backlog(ClientId client) {
+    if (!outboxes_ || (size_t)client >= outbox_count_) return;
+
+    Backlog& backlog = backlogs_[(size_t)client];
+
+    size_t bytes = 0;
+    for (size_t index = backlog.sent; index < backlog.payloads.size();
+         ++index) {
+        bytes += backlog.payloads[index]->bytes.size();
+    }
 
-    connect(local_sock_, (sockaddr*)&addr, sizeof(addr));
+    backlog.payloads.clear();
+    backlog.sent = 0;
+    backlog.watching = false;
+    backlog.reported = false;
 
-    fcntl(local_sock_, F_SETFL, fcntl(local_sock_, F_GETFL, 0) | O_NONBLOCK);
+    outboxes_[(size_t)client].queued_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    outboxes_[(size_t)client].over_budget.store(false, std::memory_order_release);
+    outboxes_[(size_t)client].generation.fetch_add(1, std::memory_order_release);
+}
 
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::watch_writable(ClientId client,
+                                                    bool enable) {
     assert(errno == 0);
 
-    errno = 0;
+    NetworkConnection<Protocol>* client_conn = clients_.find(client);
+    if (!reactor_ || !client_conn) return;
+
+    // The shared UDP socket is watched for all clients at once.
+    if (Protocol == NetworkProtocol::UDP) return;
+
+    reactor_->modify(client_conn->sock_,
+                     enable ? REACTOR_READABLE | REACTOR_WRITABLE
+                            : REACTOR_READABLE);
 }
 
 template <NetworkProtocol Protocol>
-inline void NetworkServer<Protocol>::check_new_connections() {
+inline bool NetworkServer<Protocol>::set_scheduler(Scheduler& scheduler) {
     assert(errno == 0);
 
-    while (true) {
-        assert(errno == 0);
+    if (!enable_event_loop()) return false;
+
+    int scheduler_fd = scheduler.get_reactor_fd();
+    if (scheduler_fd < 0 || !reactor_->watch(scheduler_fd, REACTOR_READABLE)) {
+        return false;
+    }
 
-        NetworkClientInfo client{};
-        recv(local_sock_, &client, sizeof(client), 0);
+    scheduler_ = &scheduler;
+    scheduler_fd_ = scheduler_fd;
 
-        if (errno != 0) {
-            errno = 0;
-            break;
+    scheduler.set_poller([this](int timeout_ms) { poll_events(timeout_ms); });
+
+    // Client sockets are armed again by the coroutines awaiting them.
+    if (Protocol == NetworkProtocol::TCP) {
+        for (auto [client, client_conn] : clients_) rearm_client(client);
+    }
+
+    return true;
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkServer<Protocol>::ClientEvent::await_ready() {
+    NetworkConnection<Protocol>* client_conn = server->clients_.find(client);
+    if (!client_conn || !server->scheduler_) return true;
+
+    if (writable) {
+        // Datagrams go out through the shared socket without waiting.
+        if (Protocol == NetworkProtocol::UDP) return true;
+
+        pollfd descriptor = {.fd = client_conn->sock_, .events = POLLOUT};
+        return poll(&descriptor, 1, 0) > 0;
+    }
+
+    return client_conn->has_buffered_input() && client_conn->poll_input();
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::ClientEvent::
+    await_suspend(std::coroutine_handle<> awaiting) {
+    std::vector<ClientEvent*>& waiters =
+        writable ? server->write_waiters_ : server->read_waiters_;
+
+    if (waiters.size() <= (size_t)client) waiters.resize((size_t)client + 1);
+
+    assert(!waiters[(size_t)client] && "Client is already awaited");
+    waiters[(size_t)client] = this;
+
+    handle = awaiting;
+
+    if (deadline != Clock::time_point::max()) {
+        timer = server->timers_.arm(
+            deadline, {.client = client,
+                       .kind = writable ? ClientTimerKind::WRITE_DEADLINE
+                                        : ClientTimerKind::READ_DEADLINE});
+    }
+
+    server->rearm_client(client);
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkServer<Protocol>::notify_readable(ClientId client) {
+    touch_client(client);
+
+    if (!scheduler_) {
+        on_client_readable(client);
+        return true;
+    }
+
+    return wake_waiter(read_waiters_, client);
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkServer<Protocol>::notify_writable(ClientId client) {
+    if ((size_t)client < backlogs_.size() &&
+        backlogs_[(size_t)client].watching) {
+        send_backlog(client);
+    }
+
+    if (!clients_.contains(client)) return true;
+
+    if (!scheduler_) {
+        on_client_writable(client);
+        return true;
+    }
+
+    return wake_waiter(write_waiters_, client);
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkServer<Protocol>::
+    wake_waiter(std::vector<ClientEvent*>& waiters, ClientId client) {
+    if ((size_t)client >= waiters.size() || !waiters[(size_t)client]) {
+        return false;
+    }
+
+    ClientEvent* event = std::exchange(waiters[(size_t)client], nullptr);
+    timers_.cancel(event->timer);
+
+    scheduler_->post(event->handle);
+    rearm_client(client);
+
+    return true;
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::
+    set_idle_timeout(std::chrono::milliseconds timeout) {
+    idle_timeout_ = timeout;
+
+    for (auto [client, client_conn] : clients_) touch_client(client);
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::touch_client(ClientId client) {
+    if (idle_timers_.size() <= (size_t)client) {
+        idle_timers_.resize((size_t)client + 1);
+    }
+
+    uint64_t& timer = idle_timers_[(size_t)client];
+    timers_.cancel(std::exchange(timer, 0));
+
+    if (idle_timeout_.count() <= 0) return;
+
+    timer = timers_.arm(Clock::now() + idle_timeout_,
+                        {.client = client, .kind = ClientTimerKind::IDLE});
+}
+
+template <NetworkProtocol Protocol>
+inline size_t NetworkServer<Protocol>::expire_timers() {
+    if (timers_.empty()) return 0;
+
+    return timers_.advance(Clock::now(), [this](uint64_t,
+                                                ClientTimer& timer) {
+        ClientId client = timer.client;
+
+        if (timer.kind == ClientTimerKind::IDLE) {
+            idle_timers_[(size_t)client] = 0;
+            if (clients_.contains(client)) on_client_idle(client);
+            return;
         }
 
-        int client_id = client.socket;
+        std::vector<ClientEvent*>& waiters =
+            timer.kind == ClientTimerKind::WRITE_DEADLINE ? write_waiters_
+                                                          : read_waiters_;
+
+        ClientEvent* event = std::exchange(waiters[(size_t)client], nullptr);
+        if (!event) return;
+
+        event->timed_out = true;
+
+        scheduler_->post(event->handle);
+        rearm_client(client);
+    });
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::rearm_client(ClientId client) {
+    // The shared UDP socket stays watched for all clients at once.
+    if (Protocol == NetworkProtocol::UDP || !reactor_) return;
+
+    NetworkConnection<Protocol>* client_conn = clients_.find(client);
+    if (!client_conn) return;
 
-        clients_[client_id] = NetworkConnection<Protocol>();
-        NetworkConnection<Protocol>& client_conn = clients_[client_id];
-        client_conn.sock_ = client.socket;
-        client_conn.conn_addr_ = client.address;
+    auto awaited = [client](const std::vector<ClientEvent*>& waiters) {
+        return (size_t)client < waiters.size() && waiters[(size_t)client];
+    };
 
-        setup_client(client_conn);
+    uint32_t events = 0;
+    if (awaited(read_waiters_)) events |= REACTOR_READABLE;
+    if (awaited(write_waiters_)) events |= REACTOR_WRITABLE;
 
-        on_client_connect(client.socket);
+    if ((size_t)client < backlogs_.size() &&
+        backlogs_[(size_t)client].watching) {
+        events |= REACTOR_WRITABLE;
     }
 
+    reactor_->modify(client_conn->sock_, events);
+}
+
+template <NetworkProtocol Protocol>
+inline bool NetworkServer<Protocol>::watch_external(int fd) {
     assert(errno == 0);
+
+    if (!reactor_) return false;
+
+    return reactor_->watch(fd, REACTOR_READABLE);
 }
 
 template <NetworkProtocol Protocol>
 inline void NetworkServer<Protocol>::stop_accepting() {
     assert(errno == 0);
 
-    close(local_sock_);
-    local_sock_ = 0;
+    if (!conn_listener_.joinable()) return;
+
+    conn_listener_.request_stop();
+
+    uint64_t increment = 1;
+    write(accept_stop_, &increment, sizeof(increment));
+
+    conn_listener_.join();
+
+    // Clients accepted after the last check are turned away.
+    while (std::optional<NetworkClientInfo> client = accept_queue_->pop()) {
+        if (Protocol == NetworkProtocol::TCP) close(client->socket);
+    }
+
+    close(accept_event_);
+    accept_event_ = -1;
+
+    close(accept_stop_);
+    accept_stop_ = -1;
+
+    accept_queue_.reset();
+
+    assert(errno == 0);
+}
+
+static inline void set_reuse_options(int sock, bool reuse_port) {
+    int enable = 1;
 
-    close(local_server_);
-    local_server_ = 0;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    if (reuse_port) {
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+    }
 
     assert(errno == 0);
 }
 
 template <>
-inline NetworkServer<NetworkProtocol::TCP>::NetworkServer(in_port_t port) {
+inline NetworkServer<NetworkProtocol::TCP>::NetworkServer(in_port_t port,
+                                                         bool reuse_port) {
     assert(errno == 0);
 
     sock_ = socket(AF_INET, SOCK_STREAM, 0);
 
     assert(errno == 0);
 
+    set_reuse_options(sock_, reuse_port);
+
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
@@ -230,11 +1821,14 @@ inline NetworkServer<NetworkProtocol::TCP>::NetworkServer(in_port_t port) {
 }
 
 template <>
-inline NetworkServer<NetworkProtocol::UDP>::NetworkServer(in_port_t port) {
+inline NetworkServer<NetworkProtocol::UDP>::NetworkServer(in_port_t port,
+                                                         bool reuse_port) {
     assert(errno == 0);
 
     sock_ = socket(AF_INET, SOCK_DGRAM, 0);
 
+    set_reuse_options(sock_, reuse_port);
+
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
@@ -253,18 +1847,49 @@ inline NetworkServer<NetworkProtocol::UDP>::NetworkServer(in_port_t port) {
     bind(client_communicator_.sock_, (sockaddr*)&client_comm,
          sizeof(client_comm));
 
+    // The port is handed to every client in the handshake.
+    socklen_t comm_len = sizeof(client_comm);
+    getsockname(client_communicator_.sock_, (sockaddr*)&client_comm,
+                &comm_len);
+
+    int buffer_size = SHARED_SOCKET_BUFFER_SIZE;
+    setsockopt(client_communicator_.sock_, SOL_SOCKET, SO_RCVBUF, &buffer_size,
+               sizeof(buffer_size));
+
+    // Reliable clients can not re-chunk what they queued, so datagrams over
+    // the path MTU are fragmented for every client of the shared socket.
+    int discovery = IP_PMTUDISC_WANT;
+    setsockopt(client_communicator_.sock_, IPPROTO_IP, IP_MTU_DISCOVER,
+               &discovery, sizeof(discovery));
+
+    client_demux_ = std::make_unique<UdpDemux>(client_communicator_.sock_);
+
+    // Handshake datagrams carry their sender, so they are read one by one.
+    set_datagram_batching(1, 1);
+
     assert(errno == 0);
 }
 
 template <>
-NetworkServer<NetworkProtocol::UDP>::~NetworkServer() {
+inline NetworkServer<NetworkProtocol::UDP>::~NetworkServer() {
     assert(errno == 0);
+    stop_accepting();
+
+    // Clients linger on the shared socket while their last datagrams get
+    // acknowledged, so it is closed after them.
+    clients_.clear();
+    client_communicator_.set_close_on_destroy(false);
     close(client_communicator_.sock_);
+
+    if (inbox_event_ >= 0) close(inbox_event_);
     assert(errno == 0);
 }
 
 template <>
-NetworkServer<NetworkProtocol::TCP>::~NetworkServer() {
+inline NetworkServer<NetworkProtocol::TCP>::~NetworkServer() {
+    assert(errno == 0);
+    stop_accepting();
+    if (inbox_event_ >= 0) close(inbox_event_);
     assert(errno == 0);
 }
 
@@ -278,14 +1903,63 @@ inline NetworkClientInfo NetworkServer<NetworkProtocol::TCP>::accept_client() {
 }
 
 template <>
-void NetworkServer<NetworkProtocol::TCP>::
-    setup_client(NetworkConnection<NetworkProtocol::TCP>& connection) {}
+inline NetworkServer<NetworkProtocol::TCP>::ClientId
+NetworkServer<NetworkProtocol::TCP>::
+    assign_client_id(const NetworkClientInfo& client) {
+    ClientId client_id = clients_.vacant_id();
+    if (client_id < 0) return -1;
+
+    if (client_ids_.size() <= (size_t)client.socket) {
+        client_ids_.resize((size_t)client.socket + 1, -1);
+    }
+
+    client_ids_[(size_t)client.socket] = client_id;
+
+    return client_id;
+}
+
+template <>
+inline NetworkServer<NetworkProtocol::UDP>::ClientId
+NetworkServer<NetworkProtocol::UDP>::
+    assign_client_id(const NetworkClientInfo& client) {
+    int known = client_demux_->find(client.address);
+    if (known >= 0) return known;
+
+    // Demultiplexer slots are reused, so they stay below the client limit.
+    if (clients_.full()) return -1;
+
+    return client_demux_->attach(client.address);
+}
+
+template <>
+inline void NetworkServer<NetworkProtocol::TCP>::setup_client(
+    NetworkConnection<NetworkProtocol::TCP>& connection, ClientId client) {}
 
 template <>
-void NetworkServer<NetworkProtocol::UDP>::
-    setup_client(NetworkConnection<NetworkProtocol::UDP>& connection) {
+inline void NetworkServer<NetworkProtocol::UDP>::setup_client(
+    NetworkConnection<NetworkProtocol::UDP>& connection, ClientId client) {
     assert(errno == 0);
+
     connection.set_close_on_destroy(false);
+
+    // Clients accepted by another shard come with that shard's socket.
+    connection.sock_ = client_communicator_.sock_;
+    connection.demux_ = client_demux_.get();
+    connection.demux_slot_ = client;
+
+    // The handshake is answered only now, so datagrams the client sends to
+    // the shared socket always find their slot. The listener may be reading
+    // on another thread, the reply bypasses its buffers.
+    char reply[MAX_WIRE_HEADER_SIZE] = {};
+    size_t reply_len =
+        encode_wire_integer(WireVersion::V1,
+                            ntohs(client_communicator_.conn_addr_.sin_port),
+                            reply);
+
+    sys_send<NetworkProtocol::UDP>(sock_, reply, reply_len, 0,
+                                   connection.conn_addr_);
+
+    errno = 0;
 }
 
 template <>
@@ -294,16 +1968,32 @@ inline NetworkClientInfo NetworkServer<NetworkProtocol::UDP>::accept_client() {
 
     NetworkClientInfo client{};
 
-    receive<uint16_t>();
+    auto hello = receive<uint16_t>();
 
-    client.socket = client_communicator_.sock_;
+    client.socket = hello ? client_communicator_.sock_ : -1;
     client.address = conn_addr_;
 
-    send<uint16_t>(client_communicator_.conn_addr_.sin_port);
-
     conn_addr_ = (sockaddr_in){};
 
+    return client;
+}
+
+template <NetworkProtocol Protocol>
+inline void NetworkServer<Protocol>::accept_pending() {
     assert(errno == 0);
 
-    return client;
+    for (;;) {
+        NetworkClientInfo client = accept_client();
+
+        if (client.socket < 0) {
+            errno = 0;
+            break;
+        }
+
+        if (accept_redirect_ && accept_redirect_(client)) continue;
+
+        register_client(client);
+    }
+
+    assert(errno == 0);
 }
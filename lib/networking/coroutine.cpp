@@ -0,0 +1,94 @@
+#include "coroutine.h"
+
+Scheduler::~Scheduler() {
+    for (void* frame : tasks_) {
+        std::coroutine_handle<>::from_address(frame).destroy();
+    }
+}
+
+void Scheduler::spawn(Task<void> task) {
+    Task<void>::Handle handle = task.release();
+    if (!handle) return;
+
+    handle.promise().owner = this;
+    tasks_.insert(handle.address());
+
+    post(handle);
+}
+
+bool Scheduler::FdAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    watched = scheduler->watch(fd, events, handle);
+
+    // Resume right away if there is nothing to wait for.
+    return watched;
+}
+
+void Scheduler::run() {
+    while (!tasks_.empty()) {
+        run_ready();
+
+        if (tasks_.empty()) break;
+
+        int timeout_ms = ready_.empty() ? -1 : 0;
+
+        if (poller_) {
+            poller_(timeout_ms);
+        } else if (reactor_) {
+            poll_descriptors(timeout_ms);
+        } else if (ready_.empty()) {
+            // Nothing can wake the remaining tasks up.
+            break;
+        }
+    }
+}
+
+size_t Scheduler::run_ready() {
+    // Coroutines posted while these run wait for the next round, so a
+    // coroutine yielding in a loop can not starve the event loop.
+    size_t count = ready_.size();
+
+    for (size_t resumed = 0; resumed < count; ++resumed) {
+        std::coroutine_handle<> handle = ready_.front();
+        ready_.pop_front();
+
+        handle.resume();
+    }
+
+    return count;
+}
+
+int Scheduler::poll_descriptors(int timeout_ms) {
+    if (!reactor_) return 0;
+
+    return reactor_->poll(timeout_ms, [this](int fd, uint32_t) {
+        if ((size_t)fd >= fd_waiters_.size() || !fd_waiters_[(size_t)fd]) {
+            return;
+        }
+
+        reactor_->forget(fd);
+
+        post(fd_waiters_[(size_t)fd]);
+        fd_waiters_[(size_t)fd] = {};
+    });
+}
+
+int Scheduler::get_reactor_fd() {
+    if (!reactor_) reactor_ = std::make_unique<Reactor>();
+
+    return reactor_->is_valid() ? reactor_->get_fd() : -1;
+}
+
+bool Scheduler::watch(int fd, uint32_t events,
+                      std::coroutine_handle<> handle) {
+    if (fd < 0 || get_reactor_fd() < 0) return false;
+
+    if (fd_waiters_.size() <= (size_t)fd) fd_waiters_.resize((size_t)fd + 1);
+
+    assert(!fd_waiters_[(size_t)fd] && "Descriptor is already awaited");
+
+    if (!reactor_->watch(fd, events)) return false;
+
+    fd_waiters_[(size_t)fd] = handle;
+
+    return true;
+}
@@ -0,0 +1,286 @@
+/**
+ * @file coroutine.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Coroutine tasks and a single-threaded scheduler resuming them on
+ * readiness events.
+ * @version 0.1
+ * @date 2024-11-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "reactor.h"
+
+struct Scheduler;
+
+/**
+ * @brief Lazily started coroutine producing a value
+ *
+ * @note The body starts running when the task is awaited, or when it is
+ * handed to Scheduler::spawn(). The awaiting coroutine is resumed right
+ * after the body finishes.
+ *
+ * @warning Reference parameters are not copied into the coroutine frame,
+ * they have to outlive the task. Awaiting the task in the same expression
+ * that creates it is enough.
+ *
+ * @warning GCC 12 miscompiles co_await in the condition of an if statement,
+ * store the result in a variable and test that instead.
+ *
+ * @tparam T result type
+ */
+template <class T = void>
+struct [[nodiscard]] Task {
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct PromiseBase {
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(Handle handle) noexcept;
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        // Network code reports failures through errno, not exceptions.
+        void unhandled_exception() { std::terminate(); }
+
+        std::coroutine_handle<> continuation{};
+        Scheduler* owner = nullptr;  // set for detached tasks
+    };
+
+    struct ValuePromise : PromiseBase {
+        void return_value(T value) { result.emplace(std::move(value)); }
+
+        std::optional<T> result{};
+    };
+
+    struct VoidPromise : PromiseBase {
+        void return_void() {}
+    };
+
+    struct promise_type
+        : std::conditional_t<std::is_void_v<T>, VoidPromise, ValuePromise> {
+        Task get_return_object() { return Task(Handle::from_promise(*this)); }
+    };
+
+    Task() = default;
+    explicit Task(Handle handle) : handle_(handle) {}
+
+    ~Task() {
+        if (handle_) handle_.destroy();
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, {});
+        }
+
+        return *this;
+    }
+
+    bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<> awaiting) noexcept {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+
+    T await_resume() {
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*handle_.promise().result);
+        }
+    }
+
+    /**
+     * @brief Give up ownership of the coroutine frame
+     *
+     * @return coroutine handle
+     */
+    Handle release() { return std::exchange(handle_, {}); }
+
+   private:
+    Handle handle_{};
+};
+
+/**
+ * @brief Single-threaded scheduler of coroutine tasks
+ *
+ * @note Spawned tasks run until they wait on something. Waiting tasks are
+ * resumed from run() once a descriptor they wait for becomes ready, or once
+ * someone posts them, in the order they became ready. Descriptors are
+ * watched by the scheduler's own epoll reactor unless a poller is installed,
+ * which is then responsible for polling the reactor descriptor as well (see
+ * NetworkServer::set_scheduler()).
+ */
+struct Scheduler {
+    using Poller = std::function<void(int timeout_ms)>;
+
+    Scheduler() = default;
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    ~Scheduler();
+
+    /**
+     * @brief Start a detached task, its frame is freed once it finishes
+     *
+     * @param task task to run
+     */
+    void spawn(Task<void> task);
+
+    /**
+     * @brief Queue a suspended coroutine to be resumed by run()
+     *
+     * @param handle coroutine handle
+     */
+    void post(std::coroutine_handle<> handle) { ready_.push_back(handle); }
+
+    /**
+     * @brief Awaitable suspending the coroutine until the descriptor is ready
+     *
+     * @note co_await evaluates to false if the descriptor can not be
+     * watched. Hangups and errors count as readiness. Only one coroutine may
+     * wait for a descriptor at a time.
+     */
+    struct FdAwaiter {
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        bool await_resume() const noexcept { return watched; }
+
+        Scheduler* scheduler = nullptr;
+        int fd = -1;
+        uint32_t events = 0;
+        bool watched = false;
+    };
+
+    FdAwaiter readable(int fd) {
+        return {.scheduler = this, .fd = fd, .events = REACTOR_READABLE};
+    }
+
+    FdAwaiter writable(int fd) {
+        return {.scheduler = this, .fd = fd, .events = REACTOR_WRITABLE};
+    }
+
+    /**
+     * @brief Awaitable letting the other ready coroutines run first
+     *
+     */
+    struct YieldAwaiter {
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            scheduler->post(handle);
+        }
+
+        void await_resume() const noexcept {}
+
+        Scheduler* scheduler = nullptr;
+    };
+
+    YieldAwaiter yield() { return {.scheduler = this}; }
+
+    /**
+     * @brief Replace epoll waits with the functor, for schedulers driven by
+     * another event loop
+     *
+     * @param poller functor waiting up to timeout_ms for events and posting
+     * the coroutines they wake up
+     */
+    void set_poller(Poller poller) { poller_ = std::move(poller); }
+
+    /**
+     * @brief Resume ready coroutines and wait for events until every spawned
+     * task has finished
+     *
+     */
+    void run();
+
+    /**
+     * @brief Resume the coroutines that are ready now
+     *
+     * @return number of resumed coroutines
+     */
+    size_t run_ready();
+
+    /**
+     * @brief Wait for watched descriptors and post their coroutines
+     *
+     * @param timeout_ms maximum time to wait, -1 to wait indefinitely
+     * @return number of events
+     */
+    int poll_descriptors(int timeout_ms);
+
+    /**
+     * @brief Descriptor of the reactor watching the awaited descriptors,
+     * readable whenever poll_descriptors() has something to dispatch
+     *
+     * @return epoll descriptor, -1 if it can not be created
+     */
+    int get_reactor_fd();
+
+    size_t get_task_count() const { return tasks_.size(); }
+
+    void on_task_finished(std::coroutine_handle<> handle) {
+        tasks_.erase(handle.address());
+    }
+
+   private:
+    bool watch(int fd, uint32_t events, std::coroutine_handle<> handle);
+
+    std::deque<std::coroutine_handle<>> ready_{};
+
+    // Frames of spawned tasks, destroyed with the scheduler if unfinished.
+    std::unordered_set<void*> tasks_{};
+
+    std::unique_ptr<Reactor> reactor_{};
+    std::vector<std::coroutine_handle<>> fd_waiters_{};  // indexed by fd
+
+    Poller poller_{};
+};
+
+template <class T>
+inline std::coroutine_handle<> Task<T>::PromiseBase::FinalAwaiter::
+    await_suspend(Handle handle) noexcept {
+    PromiseBase& promise = handle.promise();
+
+    if (promise.continuation) return promise.continuation;
+
+    if (promise.owner) {
+        promise.owner->on_task_finished(handle);
+        handle.destroy();
+    }
+
+    return std::noop_coroutine();
+}
@@ -0,0 +1,249 @@
+/**
+ * @file payload.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Pre-encoded messages that can be sent to many connections.
+ * @version 0.1
+ * @date 2024-11-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "protocols.h"
+#include "serialization.h"
+#include "wire_format.h"
+
+static const size_t UDP_OPTIMAL_SIZE = 534;  // bytes
+
+// Largest payload of an IPv4 UDP datagram.
+static const size_t MAX_UDP_PAYLOAD = 65507;  // bytes
+
+// IPv4 and UDP headers preceding the payload of every datagram.
+static const size_t UDP_HEADERS_SIZE = 28;  // bytes
+
+// Chunks per segmentation offload buffer, within the kernel limit.
+static const size_t GSO_MAX_SEGMENTS = 64;
+
+/**
+ * @brief Encoded message sequence
+ *
+ * @note Frame boundaries mark datagrams for UDP, TCP sends the bytes as one
+ * stream.
+ */
+struct WirePayload {
+    std::vector<char> bytes{};
+    std::vector<size_t> frame_ends{};
+    WireEncoding encoding{};
+
+    // Size of the UDP chunks carrying the bodies.
+    size_t chunk_size = UDP_OPTIMAL_SIZE;
+};
+
+using SharedPayload = std::shared_ptr<const WirePayload>;
+
+/**
+ * @brief Encoder producing exactly what NetworkConnection::send<T>() would
+ * put on the wire
+ *
+ * @note UDP bodies are cut into chunks of the given size, the frame headers
+ * state it when it is not UDP_OPTIMAL_SIZE. Payloads with the default size
+ * fit any path, larger ones should only go to connections whose
+ * get_chunk_size() matches.
+ *
+ * @tparam Protocol target protocol
+ */
+template <NetworkProtocol Protocol>
+struct PayloadWriter {
+    explicit PayloadWriter(const WireEncoding& encoding = {},
+                           size_t chunk_size = UDP_OPTIMAL_SIZE) {
+        payload_.encoding = encoding;
+        payload_.chunk_size = chunk_size;
+    }
+
+    PayloadWriter& put(uint16_t value) { return put_integer(value); }
+    PayloadWriter& put(uint32_t value) { return put_integer(value); }
+    PayloadWriter& put(int16_t value) { return put_integer(value); }
+    PayloadWriter& put(int32_t value) { return put_integer(value); }
+
+    PayloadWriter& put(const std::string& value) {
+        return put_frame(WIRE_TAG_STRING, value.data(), value.size());
+    }
+
+    /**
+     * @brief Encode any other serializable value as one frame, the way
+     * NetworkConnection::send<T>() does
+     *
+     * @param value value to encode
+     */
+    template <class T>
+    PayloadWriter& put(const T& value) {
+        std::vector<char> body{};
+        wire_encode(payload_.encoding.version, body, value);
+
+        return put_frame(WIRE_TAG_FRAME, body.data(), body.size());
+    }
+
+    /**
+     * @brief Seal the payload so it can be shared between connections
+     *
+     * @return shared payload
+     */
+    SharedPayload finish() {
+        return std::make_shared<const WirePayload>(std::move(payload_));
+    }
+
+   private:
+    template <class T>
+    PayloadWriter& put_integer(T value) {
+        char message[MAX_WIRE_HEADER_SIZE] = {};
+        size_t len =
+            encode_wire_integer(payload_.encoding.version, value, message);
+
+        return append(message, len).end_frame();
+    }
+
+    PayloadWriter& put_frame(WireTag tag, const char* body, size_t len);
+
+    PayloadWriter& append(const void* data, size_t len) {
+        const char* bytes = (const char*)data;
+        payload_.bytes.insert(payload_.bytes.end(), bytes, bytes + len);
+        return *this;
+    }
+
+    PayloadWriter& end_frame() {
+        payload_.frame_ends.push_back(payload_.bytes.size());
+        return *this;
+    }
+
+    WirePayload payload_{};
+    std::vector<char> compressed_{};
+};
+
+template <>
+inline PayloadWriter<NetworkProtocol::TCP>&
+PayloadWriter<NetworkProtocol::TCP>::put_frame(WireTag tag, const char* body,
+                                               size_t len) {
+    std::string_view contents(body, len);
+
+    char header[MAX_FRAME_HEADER_SIZE] = {};
+    append(header, encode_frame(payload_.encoding, tag, &contents,
+                                compressed_, header));
+
+    return append(contents.data(), contents.size()).end_frame();
+}
+
+template <>
+inline PayloadWriter<NetworkProtocol::UDP>&
+PayloadWriter<NetworkProtocol::UDP>::put_frame(WireTag tag, const char* body,
+                                               size_t len) {
+    std::string_view contents(body, len);
+
+    size_t chunk_size = payload_.chunk_size;
+
+    // Chunks other than the default size have to be announced.
+    char header[MAX_FRAME_HEADER_SIZE] = {};
+    append(header, encode_frame(payload_.encoding, tag, &contents,
+                                compressed_, header,
+                                chunk_size > UDP_OPTIMAL_SIZE ? chunk_size
+                                                              : 0))
+        .end_frame();
+
+    for (size_t start = 0; start < contents.size(); start += chunk_size) {
+        size_t end = std::min(start + chunk_size, contents.size());
+        append(contents.data() + start, end - start).end_frame();
+    }
+
+    return *this;
+}
+
+/**
+ * @brief Encode values into a shareable payload
+ *
+ * @tparam Protocol target protocol
+ * @param encoding encoding used by the recipients
+ * @param contents values to encode
+ * @return shared payload
+ */
+template <NetworkProtocol Protocol, class... Ts>
+SharedPayload make_payload(const WireEncoding& encoding,
+                           const Ts&... contents) {
+    PayloadWriter<Protocol> writer(encoding);
+    (writer.put(contents), ...);
+    return writer.finish();
+}
+
+/**
+ * @brief Scatter-gather list framing several values for a single TCP write
+ *
+ * @note Integer headers are stored inside the list, string bodies are
+ * referenced in place and have to outlive it.
+ *
+ * @tparam ValueCount maximum number of values
+ */
+template <size_t ValueCount>
+struct GatherList {
+    explicit GatherList(WireVersion version = WireVersion::V1)
+        : version_(version) {}
+
+    void add(uint16_t value) { add_integer(value); }
+    void add(uint32_t value) { add_integer(value); }
+    void add(int16_t value) { add_integer(value); }
+    void add(int32_t value) { add_integer(value); }
+
+    void add(const std::string& value) {
+        char* header = headers_ + headers_used_;
+        add_header(header, encode_frame_header(version_, WIRE_TAG_STRING,
+                                               value.size(), header));
+
+        if (value.empty()) return;
+
+        parts_[count_++] = {.iov_base = (void*)value.data(),
+                            .iov_len = value.size()};
+    }
+
+    const iovec* data() const { return parts_; }
+    size_t size() const { return count_; }
+
+   private:
+    template <class T>
+    void add_integer(T value) {
+        char* header = headers_ + headers_used_;
+        add_header(header, encode_wire_integer(version_, value, header));
+    }
+
+    void add_header(char* header, size_t len) {
+        headers_used_ += len;
+
+        // Consecutive headers are merged into one vector entry.
+        if (count_ > 0) {
+            iovec& last = parts_[count_ - 1];
+            if ((char*)last.iov_base + last.iov_len == header) {
+                last.iov_len += len;
+                return;
+            }
+        }
+
+        parts_[count_++] = {.iov_base = header, .iov_len = len};
+    }
+
+    WireVersion version_ = WireVersion::V1;
+
+    char headers_[ValueCount * MAX_WIRE_HEADER_SIZE] = {};
+    size_t headers_used_ = 0;
+
+    iovec parts_[ValueCount * 2] = {};
+    size_t count_ = 0;
+};
@@ -1,7 +1,7 @@
 /**
  * @file protocols.h
  * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
- * @brief Network protocol enum.
+ * @brief Network protocol, transport backend and wire version enums.
  * @version 0.1
  * @date 2024-11-02
  *
@@ -11,4 +11,23 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 enum class NetworkProtocol { TCP, UDP };
+
+enum class NetworkBackend { SYSCALL, IO_URING };
+
+/**
+ * @brief Message encoding version
+ *
+ * @note V1 uses fixed-width big-endian integers and 4-byte lengths, V2 adds
+ * a type tag and encodes integers and lengths as LEB128 varints.
+ * Connections start at V1 and switch after the handshake.
+ */
+enum class WireVersion : uint8_t { V1 = 1, V2 = 2 };
+
+static const WireVersion LATEST_WIRE_VERSION = WireVersion::V2;
+
+// Datagrams moved by one sendmmsg()/recvmmsg() call unless configured.
+static const size_t DEFAULT_DATAGRAM_BATCH = 32;
@@ -0,0 +1,49 @@
+#include "reactor.h"
+
+#include <unistd.h>
+
+static uint32_t to_epoll_mask(uint32_t events) {
+    return (events & (REACTOR_READABLE | REACTOR_WRITABLE)) | EPOLLRDHUP;
+}
+
+Reactor::Reactor() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+    if (epoll_fd_ < 0) errno = 0;
+}
+
+Reactor::~Reactor() {
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+bool Reactor::watch(int fd, uint32_t events) {
+    assert(errno == 0);
+
+    epoll_event event{};
+    event.events = to_epoll_mask(events);
+    event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == 0) return true;
+
+    errno = 0;
+    return false;
+}
+
+bool Reactor::modify(int fd, uint32_t events) {
+    assert(errno == 0);
+
+    epoll_event event{};
+    event.events = to_epoll_mask(events);
+    event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) == 0) return true;
+
+    errno = 0;
+    return false;
+}
+
+void Reactor::forget(int fd) {
+    assert(errno == 0);
+
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+
+    errno = 0;
+}
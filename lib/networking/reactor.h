@@ -0,0 +1,104 @@
+/**
+ * @file reactor.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Readiness-based event demultiplexer (epoll wrapper).
+ * @version 0.1
+ * @date 2024-11-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/**
+ * @brief Readiness flags reported by the reactor
+ *
+ */
+enum ReactorEvent : uint32_t {
+    REACTOR_READABLE = EPOLLIN,
+    REACTOR_WRITABLE = EPOLLOUT,
+    REACTOR_HANGUP = EPOLLHUP | EPOLLRDHUP | EPOLLERR,
+};
+
+struct Reactor {
+    Reactor();
+    ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    /**
+     * @brief Start watching the file descriptor
+     *
+     * @param fd file descriptor
+     * @param events combination of REACTOR_READABLE and REACTOR_WRITABLE
+     * @return true if the descriptor was registered
+     */
+    bool watch(int fd, uint32_t events);
+
+    /**
+     * @brief Change the set of events the descriptor is watched for
+     *
+     * @param fd file descriptor
+     * @param events combination of REACTOR_READABLE and REACTOR_WRITABLE
+     * @return true if the descriptor was updated
+     */
+    bool modify(int fd, uint32_t events);
+
+    /**
+     * @brief Stop watching the file descriptor
+     *
+     * @param fd file descriptor
+     */
+    void forget(int fd);
+
+    /**
+     * @brief Wait for events and dispatch them to the callback
+     *
+     * @param timeout_ms maximum time to wait, -1 to wait indefinitely
+     * @param callback functor called as callback(fd, events)
+     * @return number of dispatched events
+     */
+    template <class Callback>
+    int poll(int timeout_ms, Callback&& callback);
+
+    bool is_valid() const { return epoll_fd_ >= 0; }
+
+    /**
+     * @brief Epoll descriptor, readable while events are pending, so the
+     * reactor can be nested in another one
+     *
+     */
+    int get_fd() const { return epoll_fd_; }
+
+   private:
+    static const int MAX_EVENTS_PER_POLL = 64;
+
+    int epoll_fd_ = -1;
+};
+
+template <class Callback>
+inline int Reactor::poll(int timeout_ms, Callback&& callback) {
+    assert(errno == 0);
+
+    epoll_event events[MAX_EVENTS_PER_POLL] = {};
+
+    int count = epoll_wait(epoll_fd_, events, MAX_EVENTS_PER_POLL, timeout_ms);
+
+    if (count < 0) {
+        errno = 0;
+        return 0;
+    }
+
+    for (int event_id = 0; event_id < count; ++event_id) {
+        callback(events[event_id].data.fd, events[event_id].events);
+    }
+
+    return count;
+}
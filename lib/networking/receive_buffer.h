@@ -0,0 +1,87 @@
+/**
+ * @file receive_buffer.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Per-connection buffer for incoming bytes.
+ * @version 0.1
+ * @date 2024-11-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#include <vector>
+
+/**
+ * @brief Contiguous window of received but not yet parsed bytes
+ *
+ * @note Consumed bytes are reclaimed lazily: the window is moved back to the
+ * start of the storage only when the tail runs out of space.
+ */
+struct ReceiveBuffer {
+    size_t available() const { return end_ - begin_; }
+
+    const char* data() const { return storage_.data() + begin_; }
+
+    /**
+     * @brief Drop bytes from the front of the window
+     *
+     * @param len number of bytes to drop
+     */
+    void consume(size_t len) {
+        begin_ += len;
+        if (begin_ == end_) begin_ = end_ = 0;
+
+        seen_ = false;
+    }
+
+    /**
+     * @brief Get writable space after the window
+     *
+     * @param min_len minimum number of bytes the caller needs to write
+     * @param writable output for the actual size of the region
+     * @return start of the writable region
+     */
+    char* prepare(size_t min_len, size_t* writable) {
+        if (storage_.size() - end_ < min_len && begin_ > 0) {
+            memmove(storage_.data(), storage_.data() + begin_, available());
+            end_ -= begin_;
+            begin_ = 0;
+        }
+
+        if (storage_.size() - end_ < min_len) storage_.resize(end_ + min_len);
+
+        *writable = storage_.size() - end_;
+        return storage_.data() + end_;
+    }
+
+    /**
+     * @brief Append bytes written into the prepared region to the window
+     *
+     * @param len number of bytes written
+     */
+    void commit(size_t len) {
+        end_ += len;
+        seen_ = false;
+    }
+
+    /**
+     * @brief Mark the bytes in the window as looked at and found not to be
+     * enough
+     *
+     * @note The mark is lifted as soon as bytes are appended or dropped.
+     */
+    void mark_seen() { seen_ = true; }
+    bool is_seen() const { return seen_; }
+
+   private:
+    std::vector<char> storage_{};
+    size_t begin_ = 0;
+    size_t end_ = 0;
+
+    bool seen_ = false;
+};
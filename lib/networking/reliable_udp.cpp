@@ -0,0 +1,418 @@
+#include "reliable_udp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+static const uint8_t PACKET_DATA = 0xd1;
+static const uint8_t PACKET_ACK = 0xac;
+
+static const size_t ACK_HEADER_SIZE = 1 + 2 * sizeof(uint32_t) + 1;
+static const size_t SACK_BLOCK_SIZE = 2 * sizeof(uint32_t);
+
+static const size_t MAX_DATAGRAM_SIZE = 65536;  // bytes
+
+static void put_seq(char* output, uint32_t seq) {
+    seq = htonl(seq);
+    memcpy(output, &seq, sizeof(seq));
+}
+
+static uint32_t get_seq(const char* input) {
+    uint32_t seq = 0;
+    memcpy(&seq, input, sizeof(seq));
+    return ntohl(seq);
+}
+
+// Datagrams dropped by the local stack are as good as lost on the way.
+static bool is_transient_error() {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ||
+           errno == ENOMEM;
+}
+
+bool ReliableUdp::send(int sock, sockaddr_in* peer, const void* buffer,
+                       size_t len) {
+    while (in_flight() >= (size_t)window_ ||
+           unacked_.size() >= RELIABLE_MAX_WINDOW) {
+        if (!pump(sock, peer, Clock::time_point::max())) return false;
+    }
+
+    Outgoing& outgoing = unacked_.emplace_back();
+    outgoing.seq = next_seq_++;
+
+    outgoing.packet.resize(RELIABLE_DATA_HEADER_SIZE + len);
+    outgoing.packet[0] = (char)PACKET_DATA;
+    put_seq(outgoing.packet.data() + 1, outgoing.seq);
+    memcpy(outgoing.packet.data() + RELIABLE_DATA_HEADER_SIZE, buffer, len);
+
+    return transmit(sock, *peer, outgoing);
+}
+
+ssize_t ReliableUdp::recv(int sock, sockaddr_in* peer, void* buffer,
+                          size_t len) {
+    bool blocking = !(fcntl(sock, F_GETFL) & O_NONBLOCK);
+
+    // Non-blocking sockets get one look at what has already arrived.
+    Clock::time_point until =
+        blocking ? Clock::time_point::max() : Clock::now();
+
+    while (ready_.empty()) {
+        if (!pump(sock, peer, until)) return -1;
+
+        if (!blocking && ready_.empty()) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    std::vector<char>& datagram = ready_.front();
+
+    size_t size = std::min(len, datagram.size());
+    memcpy(buffer, datagram.data(), size);
+
+    ready_.pop_front();
+
+    return (ssize_t)size;
+}
+
+bool ReliableUdp::flush(int sock, sockaddr_in* peer, int timeout_ms) {
+    Clock::time_point until = timeout_ms < 0
+                                  ? Clock::time_point::max()
+                                  : Clock::now() + Milliseconds(timeout_ms);
+
+    while (!unacked_.empty()) {
+        if (Clock::now() >= until) {
+            errno = ETIMEDOUT;
+            return false;
+        }
+
+        if (!pump(sock, peer, until)) return false;
+    }
+
+    return !unacked_data_ || send_ack(sock, *peer);
+}
+
+bool ReliableUdp::pump(int sock, sockaddr_in* peer, Clock::time_point until) {
+    Clock::time_point deadline = until;
+    if (timer_running_) deadline = std::min(deadline, timer_deadline_);
+
+    int timeout_ms = -1;
+    if (deadline != Clock::time_point::max()) {
+        auto left = std::chrono::ceil<Milliseconds>(deadline - Clock::now());
+        timeout_ms = (int)std::max(left.count(), (Milliseconds::rep)0);
+    }
+
+    int ready = wait_readable(sock, timeout_ms);
+
+    if (ready < 0 && errno != EINTR) return false;
+    errno = 0;
+
+    if (ready > 0) {
+        receive_buffer_.resize(MAX_DATAGRAM_SIZE);
+
+        while (true) {
+            ssize_t received = receive_datagram(sock, peer);
+            if (received < 0) break;
+
+            handle_packet(receive_buffer_.data(), (size_t)received);
+
+            if (unacked_data_ >= RELIABLE_ACK_FREQUENCY &&
+                !send_ack(sock, *peer)) {
+                return false;
+            }
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+        errno = 0;
+
+        if (unacked_data_ && !send_ack(sock, *peer)) return false;
+
+        detect_losses();
+        if (!retransmit_lost(sock, *peer)) return false;
+    }
+
+    if (timer_running_ && Clock::now() >= timer_deadline_) {
+        return on_timeout(sock, *peer);
+    }
+
+    return true;
+}
+
+int ReliableUdp::wait_readable(int sock, int timeout_ms) {
+    if (demux_) return demux_->wait(demux_slot_, timeout_ms) ? 1 : 0;
+
+    pollfd request = {.fd = sock, .events = POLLIN, .revents = 0};
+    return ::poll(&request, 1, timeout_ms);
+}
+
+ssize_t ReliableUdp::receive_datagram(int sock, sockaddr_in* peer) {
+    // The demultiplexer only queues datagrams coming from the peer.
+    if (demux_) {
+        return demux_->receive(demux_slot_, receive_buffer_.data(),
+                               receive_buffer_.size(), MSG_DONTWAIT);
+    }
+
+    socklen_t addr_len = sizeof(*peer);
+    return recvfrom(sock, receive_buffer_.data(), receive_buffer_.size(),
+                    MSG_DONTWAIT, (sockaddr*)peer, &addr_len);
+}
+
+void ReliableUdp::handle_packet(const char* packet, size_t len) {
+    if (len >= RELIABLE_DATA_HEADER_SIZE && (uint8_t)packet[0] == PACKET_DATA) {
+        handle_data(get_seq(packet + 1), packet + RELIABLE_DATA_HEADER_SIZE,
+                    len - RELIABLE_DATA_HEADER_SIZE);
+        return;
+    }
+
+    if (len < ACK_HEADER_SIZE || (uint8_t)packet[0] != PACKET_ACK) return;
+
+    size_t count = (uint8_t)packet[ACK_HEADER_SIZE - 1];
+    if (len < ACK_HEADER_SIZE + count * SACK_BLOCK_SIZE) return;
+
+    handle_ack(get_seq(packet + 1), get_seq(packet + 1 + sizeof(uint32_t)),
+               packet + ACK_HEADER_SIZE, count);
+}
+
+void ReliableUdp::handle_data(uint32_t seq, const char* payload, size_t len) {
+    // Duplicates are acknowledged again, the previous ACK may have been lost.
+    ++unacked_data_;
+    last_received_seq_ = seq;
+
+    if (seq < expected_seq_ || seq - expected_seq_ >= RELIABLE_MAX_WINDOW) {
+        return;
+    }
+
+    if (seq != expected_seq_) {
+        out_of_order_.try_emplace(seq, payload, payload + len);
+        return;
+    }
+
+    ready_.emplace_back(payload, payload + len);
+    ++expected_seq_;
+
+    auto next = out_of_order_.begin();
+    while (next != out_of_order_.end() && next->first == expected_seq_) {
+        ready_.push_back(std::move(next->second));
+        ++expected_seq_;
+
+        next = out_of_order_.erase(next);
+    }
+}
+
+void ReliableUdp::handle_ack(uint32_t next_seq, uint32_t echoed_seq,
+                             const char* blocks, size_t count) {
+    Clock::time_point now = Clock::now();
+
+    bool progress = false;
+    while (!unacked_.empty() && unacked_.front().seq < next_seq) {
+        acknowledge(unacked_.front(), echoed_seq, now);
+        unacked_.pop_front();
+
+        progress = true;
+    }
+
+    for (size_t block_id = 0; block_id < count; ++block_id) {
+        uint32_t start = get_seq(blocks + block_id * SACK_BLOCK_SIZE);
+        uint32_t end = get_seq(blocks + block_id * SACK_BLOCK_SIZE +
+                               sizeof(uint32_t));
+
+        for (Outgoing& outgoing : unacked_) {
+            if (outgoing.seq >= start && outgoing.seq < end) {
+                acknowledge(outgoing, echoed_seq, now);
+            }
+        }
+    }
+
+    if (in_recovery_ && next_seq >= recovery_end_) in_recovery_ = false;
+
+    if (!progress) return;
+
+    // The timer follows the oldest unacknowledged datagram.
+    timer_running_ = !unacked_.empty();
+    timer_deadline_ = now + rto_;
+}
+
+void ReliableUdp::acknowledge(Outgoing& outgoing, uint32_t echoed_seq,
+                              Clock::time_point now) {
+    if (outgoing.sacked) return;
+
+    outgoing.sacked = true;
+
+    // Karn's algorithm: retransmitted datagrams give ambiguous samples.
+    if (outgoing.transmissions == 1) {
+        latest_delivered_ = std::max(latest_delivered_, outgoing.sent_at);
+
+        // Older datagrams may have waited for an ACK that got lost, only the
+        // one that triggered this ACK is timed.
+        if (outgoing.seq == echoed_seq) update_rtt(now - outgoing.sent_at);
+    }
+
+    if (in_recovery_) return;
+
+    if (window_ < slow_start_threshold_) {
+        window_ += 1;
+    } else {
+        window_ += 1 / window_;
+    }
+
+    window_ = std::min(window_, (double)RELIABLE_MAX_WINDOW);
+}
+
+bool ReliableUdp::send_ack(int sock, const sockaddr_in& peer) {
+    char packet[ACK_HEADER_SIZE + RELIABLE_MAX_SACK_BLOCKS * SACK_BLOCK_SIZE] =
+        {};
+
+    packet[0] = (char)PACKET_ACK;
+    put_seq(packet + 1, expected_seq_);
+    put_seq(packet + 1 + sizeof(uint32_t), last_received_seq_);
+
+    size_t len = ACK_HEADER_SIZE;
+    size_t count = 0;
+
+    auto block = out_of_order_.begin();
+    while (block != out_of_order_.end() && count < RELIABLE_MAX_SACK_BLOCKS) {
+        uint32_t start = block->first;
+        uint32_t end = start;
+
+        for (; block != out_of_order_.end() && block->first == end; ++block) {
+            ++end;
+        }
+
+        put_seq(packet + len, start);
+        put_seq(packet + len + sizeof(uint32_t), end);
+
+        len += SACK_BLOCK_SIZE;
+        ++count;
+    }
+
+    packet[ACK_HEADER_SIZE - 1] = (char)count;
+
+    unacked_data_ = 0;
+
+    if (sendto(sock, packet, len, 0, (const sockaddr*)&peer, sizeof(peer)) >=
+        0) {
+        return true;
+    }
+
+    if (!is_transient_error()) return false;
+
+    errno = 0;
+    return true;
+}
+
+bool ReliableUdp::transmit(int sock, const sockaddr_in& peer,
+                           Outgoing& outgoing) {
+    Clock::time_point now = Clock::now();
+
+    outgoing.sent_at = now;
+    ++outgoing.transmissions;
+
+    if (!timer_running_) {
+        timer_running_ = true;
+        timer_deadline_ = now + rto_;
+    }
+
+    if (sendto(sock, outgoing.packet.data(), outgoing.packet.size(), 0,
+               (const sockaddr*)&peer, sizeof(peer)) >= 0) {
+        return true;
+    }
+
+    if (!is_transient_error()) return false;
+
+    errno = 0;
+    return true;
+}
+
+void ReliableUdp::detect_losses() {
+    // A datagram is lost once one sent noticeably later gets through, which
+    // also catches lost retransmissions.
+    Clock::duration reordering = srtt_ / 4;
+
+    for (Outgoing& outgoing : unacked_) {
+        if (outgoing.sacked || (outgoing.lost && !outgoing.retransmitted)) {
+            continue;
+        }
+
+        if (outgoing.sent_at + reordering >= latest_delivered_) continue;
+
+        // One window reduction per loss event.
+        if (!in_recovery_) {
+            slow_start_threshold_ = std::max((double)in_flight() / 2, 2.0);
+            window_ = slow_start_threshold_;
+
+            in_recovery_ = true;
+            recovery_end_ = next_seq_;
+        }
+
+        outgoing.lost = true;
+        outgoing.retransmitted = false;
+    }
+}
+
+bool ReliableUdp::retransmit_lost(int sock, const sockaddr_in& peer) {
+    for (Outgoing& outgoing : unacked_) {
+        if (in_flight() >= (size_t)window_) break;
+
+        if (!outgoing.lost || outgoing.sacked || outgoing.retransmitted) {
+            continue;
+        }
+
+        outgoing.retransmitted = true;
+
+        if (!transmit(sock, peer, outgoing)) return false;
+    }
+
+    return true;
+}
+
+bool ReliableUdp::on_timeout(int sock, const sockaddr_in& peer) {
+    timer_running_ = false;
+
+    if (unacked_.empty()) return true;
+
+    if (unacked_.front().transmissions >= RELIABLE_MAX_TRANSMISSIONS) {
+        errno = ETIMEDOUT;
+        return false;
+    }
+
+    slow_start_threshold_ = std::max((double)in_flight() / 2, 2.0);
+    window_ = 1;
+    in_recovery_ = false;
+
+    // Everything in flight is presumed lost and resent as the window opens.
+    for (Outgoing& outgoing : unacked_) {
+        outgoing.lost = !outgoing.sacked;
+        outgoing.retransmitted = false;
+    }
+
+    rto_ = std::min(rto_ * 2, Milliseconds(RELIABLE_MAX_RTO_MS));
+
+    return retransmit_lost(sock, peer);
+}
+
+void ReliableUdp::update_rtt(Clock::duration sample) {
+    if (!has_rtt_) {
+        srtt_ = sample;
+        rttvar_ = sample / 2;
+        has_rtt_ = true;
+    } else {
+        rttvar_ = (3 * rttvar_ + std::chrono::abs(srtt_ - sample)) / 4;
+        srtt_ = (7 * srtt_ + sample) / 8;
+    }
+
+    auto rto = std::chrono::ceil<Milliseconds>(srtt_ + 4 * rttvar_);
+    rto_ = std::clamp(rto, Milliseconds(RELIABLE_MIN_RTO_MS),
+                      Milliseconds(RELIABLE_MAX_RTO_MS));
+}
+
+size_t ReliableUdp::in_flight() const {
+    return (size_t)std::count_if(
+        unacked_.begin(), unacked_.end(), [](const Outgoing& outgoing) {
+            return !outgoing.sacked &&
+                   (!outgoing.lost || outgoing.retransmitted);
+        });
+}
@@ -0,0 +1,205 @@
+/**
+ * @file reliable_udp.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Sequencing, selective acknowledgements and congestion control for
+ * UDP datagrams.
+ * @version 0.1
+ * @date 2024-11-23
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "udp_demux.h"
+
+/*
+ * Every datagram of a reliable connection starts with a type byte:
+ *  - DATA: uint32_t sequence number, then the payload;
+ *  - ACK: uint32_t next expected sequence number, uint32_t sequence number
+ *    of the datagram that triggered the ACK, uint8_t block count and up to
+ *    RELIABLE_MAX_SACK_BLOCKS [start, end) pairs of uint32_t sequence numbers
+ *    received above the expected one.
+ * All numbers are big-endian. Sequence numbers start at 0 on both sides and
+ * are not expected to wrap around.
+ */
+
+static const size_t RELIABLE_MAX_WINDOW = 256;      // datagrams
+static const size_t RELIABLE_INITIAL_WINDOW = 4;    // datagrams
+static const size_t RELIABLE_MAX_SACK_BLOCKS = 4;
+static const size_t RELIABLE_ACK_FREQUENCY = 2;  // datagrams per ACK
+static const unsigned RELIABLE_MAX_TRANSMISSIONS = 10;
+
+static const int RELIABLE_INITIAL_RTO_MS = 250;
+static const int RELIABLE_MIN_RTO_MS = 50;
+static const int RELIABLE_MAX_RTO_MS = 4000;
+
+// How long a closing connection waits for its last datagrams to be acked.
+static const int RELIABLE_LINGER_MS = 1000;
+
+static const size_t RELIABLE_DATA_HEADER_SIZE = 1 + sizeof(uint32_t);
+
+/**
+ * @brief Reliable, ordered datagram channel on top of a UDP socket
+ *
+ * @note A datagram is declared lost when the selective acknowledgements show
+ * that a datagram sent after it has arrived, or when the retransmission timer
+ * estimated as in RFC 6298 expires. The send window follows
+ * slow start and AIMD: it grows by a datagram per acknowledged datagram up to
+ * the threshold, by one datagram per window after it, halves on a loss and
+ * collapses to one datagram on a timeout.
+ *
+ * The channel only makes progress inside its own calls, send(), recv() and
+ * flush() process acknowledgements and retransmissions while they wait.
+ * Functions follow the send()/recv() convention: false or -1 is returned and
+ * errno is set on failure, ETIMEDOUT meaning the peer stopped answering.
+ */
+struct ReliableUdp {
+    /**
+     * @brief Send a datagram
+     *
+     * @note Blocks while the send window is full.
+     *
+     * @param sock socket descriptor
+     * @param peer peer address, updated by datagrams received while waiting
+     * @param buffer datagram contents
+     * @param len datagram length
+     * @return true if the datagram was queued
+     */
+    bool send(int sock, sockaddr_in* peer, const void* buffer, size_t len);
+
+    /**
+     * @brief Receive the next datagram in order
+     *
+     * @param sock socket descriptor
+     * @param peer peer address, updated on every received datagram
+     * @param buffer destination, a longer datagram is truncated
+     * @param len buffer size
+     * @return datagram length, or -1 on failure
+     */
+    ssize_t recv(int sock, sockaddr_in* peer, void* buffer, size_t len);
+
+    /**
+     * @brief Wait until the peer acknowledges everything sent so far
+     *
+     * @param sock socket descriptor
+     * @param peer peer address
+     * @param timeout_ms maximum waiting time, negative to wait until the
+     * peer answers or is declared lost
+     * @return true if nothing is left unacknowledged
+     */
+    bool flush(int sock, sockaddr_in* peer, int timeout_ms);
+
+    /**
+     * @brief Process acknowledgements, retransmissions and datagrams that
+     * already arrived, without waiting
+     *
+     * @param sock socket descriptor
+     * @param peer peer address
+     * @return true unless the peer is declared lost or the socket fails
+     */
+    bool poll(int sock, sockaddr_in* peer) {
+        return pump(sock, peer, Clock::now());
+    }
+
+    /**
+     * @brief Check whether received datagrams are waiting to be read
+     *
+     * @note Such datagrams have already been taken off the socket.
+     */
+    bool has_ready() const { return !ready_.empty(); }
+
+    /**
+     * @brief Take incoming datagrams from a demultiplexer slot instead of
+     * reading the socket, which other peers share
+     *
+     * @param demux demultiplexer of the socket, has to outlive the channel
+     * @param slot slot of the peer
+     */
+    void set_demux(UdpDemux* demux, int slot) {
+        demux_ = demux;
+        demux_slot_ = slot;
+    }
+
+    size_t get_window() const { return (size_t)window_; }
+    int get_rto_ms() const { return (int)rto_.count(); }
+
+   private:
+    using Clock = std::chrono::steady_clock;
+    using Milliseconds = std::chrono::milliseconds;
+
+    struct Outgoing {
+        uint32_t seq = 0;
+        std::vector<char> packet{};
+        Clock::time_point sent_at{};
+        unsigned transmissions = 0;
+        bool sacked = false;
+        bool lost = false;
+        bool retransmitted = false;  // since it was declared lost
+    };
+
+    bool pump(int sock, sockaddr_in* peer, Clock::time_point until);
+    int wait_readable(int sock, int timeout_ms);
+    ssize_t receive_datagram(int sock, sockaddr_in* peer);
+
+    void handle_packet(const char* packet, size_t len);
+    void handle_data(uint32_t seq, const char* payload, size_t len);
+    void handle_ack(uint32_t next_seq, uint32_t echoed_seq,
+                    const char* blocks, size_t count);
+    void acknowledge(Outgoing& outgoing, uint32_t echoed_seq,
+                     Clock::time_point now);
+
+    bool send_ack(int sock, const sockaddr_in& peer);
+    bool transmit(int sock, const sockaddr_in& peer, Outgoing& outgoing);
+
+    void detect_losses();
+    bool retransmit_lost(int sock, const sockaddr_in& peer);
+    bool on_timeout(int sock, const sockaddr_in& peer);
+
+    void update_rtt(Clock::duration sample);
+    size_t in_flight() const;
+
+    // Sender
+    std::deque<Outgoing> unacked_{};
+    uint32_t next_seq_ = 0;
+
+    double window_ = RELIABLE_INITIAL_WINDOW;
+    double slow_start_threshold_ = RELIABLE_MAX_WINDOW;
+
+    bool in_recovery_ = false;
+    uint32_t recovery_end_ = 0;
+
+    Milliseconds rto_{RELIABLE_INITIAL_RTO_MS};
+    Clock::duration srtt_{};
+    Clock::duration rttvar_{};
+    bool has_rtt_ = false;
+
+    // Send time of the newest datagram known to have arrived.
+    Clock::time_point latest_delivered_{};
+
+    bool timer_running_ = false;
+    Clock::time_point timer_deadline_{};
+
+    // Receiver
+    uint32_t expected_seq_ = 0;
+    uint32_t last_received_seq_ = 0;
+    std::map<uint32_t, std::vector<char>> out_of_order_{};
+    std::deque<std::vector<char>> ready_{};
+    size_t unacked_data_ = 0;  // datagrams received since the last ACK
+
+    std::vector<char> receive_buffer_{};
+
+    UdpDemux* demux_ = nullptr;
+    int demux_slot_ = -1;
+};
@@ -0,0 +1,486 @@
+/**
+ * @file serialization.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Compile-time generic encoding of composite values.
+ * @version 0.1
+ * @date 2024-11-21
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <array>
+#include <bit>
+#include <concepts>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "protocols.h"
+
+/*
+ * Encoding rules:
+ *  - integers, enums, floats and bools: big-endian, full width;
+ *  - strings: length followed by the bytes;
+ *  - std::vector: element count followed by the elements;
+ *  - std::array, std::tuple, std::pair and aggregates (up to
+ *    MAX_WIRE_FIELDS fields): members in declaration order;
+ *  - std::optional: uint8_t presence flag followed by the value;
+ *  - types exposing wire_encoded(version): those bytes, verbatim (encode
+ *    only).
+ *
+ * Lengths and counts are uint32_t in the first wire version and unsigned
+ * LEB128 in the later ones.
+ *
+ * Arrays of scalars are copied in bulk and byte-swapped in place.
+ */
+
+static const size_t MAX_WIRE_FIELDS = 8;
+
+static const size_t MAX_VARINT_SIZE = 10;  // bytes
+
+/**
+ * @brief Encode the value as unsigned LEB128
+ *
+ * @param value value to encode
+ * @param output destination, at least MAX_VARINT_SIZE bytes
+ * @return number of bytes written
+ */
+inline size_t encode_varint(uint64_t value, char* output) {
+    size_t size = 0;
+
+    while (value >= 0x80) {
+        output[size++] = (char)(uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    output[size++] = (char)(uint8_t)value;
+
+    return size;
+}
+
+/**
+ * @brief Decode an unsigned LEB128 value from the start of the input
+ *
+ * @param input encoded bytes
+ * @param value decoding destination
+ * @return number of bytes taken, 0 if the input is cut short or the value
+ * does not fit in 64 bits
+ */
+inline size_t decode_varint(std::string_view input, uint64_t* value) {
+    *value = 0;
+
+    for (size_t size = 0; size < input.size() && size < MAX_VARINT_SIZE;
+         ++size) {
+        uint8_t byte = (uint8_t)input[size];
+
+        // The tenth byte only has room for the top bit.
+        if (size == MAX_VARINT_SIZE - 1 && byte > 1) return 0;
+
+        *value |= (uint64_t)(byte & 0x7f) << (7 * size);
+
+        if (!(byte & 0x80)) return size + 1;
+    }
+
+    return 0;
+}
+
+template <class T>
+constexpr bool is_wire_scalar_v = std::is_arithmetic_v<T> || std::is_enum_v<T>;
+
+template <class T, template <class...> class Template>
+struct is_specialization : std::false_type {};
+
+template <template <class...> class Template, class... Args>
+struct is_specialization<Template<Args...>, Template> : std::true_type {};
+
+template <class T>
+struct is_std_array : std::false_type {};
+
+template <class T, size_t Size>
+struct is_std_array<std::array<T, Size>> : std::true_type {};
+
+template <size_t Size>
+using WireWord = std::conditional_t<
+    Size == 1, uint8_t,
+    std::conditional_t<Size == 2, uint16_t,
+                       std::conditional_t<Size == 4, uint32_t, uint64_t>>>;
+
+/**
+ * @brief Convert scalars between host and network byte order in place
+ *
+ * @tparam Size scalar size
+ * @param data first scalar
+ * @param count scalar count
+ */
+template <size_t Size>
+inline void swap_wire_bytes(char* data, size_t count) {
+    if constexpr (Size == 1 || std::endian::native == std::endian::big) {
+        return;
+    } else {
+        static_assert(Size == 2 || Size == 4 || Size == 8,
+                      "Unsupported scalar size");
+
+        // Plain loop over a byte buffer, vectorized by the compiler.
+        for (size_t id = 0; id < count; ++id) {
+            WireWord<Size> word = 0;
+            memcpy(&word, data + id * Size, Size);
+
+            if constexpr (Size == 2) word = __builtin_bswap16(word);
+            if constexpr (Size == 4) word = __builtin_bswap32(word);
+            if constexpr (Size == 8) word = __builtin_bswap64(word);
+
+            memcpy(data + id * Size, &word, Size);
+        }
+    }
+}
+
+/**
+ * @brief Placeholder convertible to any field type, used to count fields
+ *
+ */
+struct WireAnyField {
+    template <class T>
+    operator T() const;
+};
+
+template <class T, class... Fields>
+consteval size_t wire_field_count() {
+    if constexpr (requires { T{Fields{}..., WireAnyField{}}; }) {
+        return wire_field_count<T, Fields..., WireAnyField>();
+    } else {
+        return sizeof...(Fields);
+    }
+}
+
+/**
+ * @brief Tie aggregate fields into a tuple of references
+ *
+ * @warning C-style array members are not supported, use std::array.
+ *
+ * @param value aggregate
+ * @return tuple of references to the fields
+ */
+template <class T>
+auto wire_fields(T& value) {
+    constexpr size_t count = wire_field_count<std::remove_const_t<T>>();
+    static_assert(count <= MAX_WIRE_FIELDS, "Too many fields to serialize");
+
+    // clang-format off
+    if constexpr (count == 0) {
+        return std::tie();
+    } else if constexpr (count == 1) {
+        auto& [f0] = value;
+        return std::tie(f0);
+    } else if constexpr (count == 2) {
+        auto& [f0, f1] = value;
+        return std::tie(f0, f1);
+    } else if constexpr (count == 3) {
+        auto& [f0, f1, f2] = value;
+        return std::tie(f0, f1, f2);
+    } else if constexpr (count == 4) {
+        auto& [f0, f1, f2, f3] = value;
+        return std::tie(f0, f1, f2, f3);
+    } else if constexpr (count == 5) {
+        auto& [f0, f1, f2, f3, f4] = value;
+        return std::tie(f0, f1, f2, f3, f4);
+    } else if constexpr (count == 6) {
+        auto& [f0, f1, f2, f3, f4, f5] = value;
+        return std::tie(f0, f1, f2, f3, f4, f5);
+    } else if constexpr (count == 7) {
+        auto& [f0, f1, f2, f3, f4, f5, f6] = value;
+        return std::tie(f0, f1, f2, f3, f4, f5, f6);
+    } else {
+        auto& [f0, f1, f2, f3, f4, f5, f6, f7] = value;
+        return std::tie(f0, f1, f2, f3, f4, f5, f6, f7);
+    }
+    // clang-format on
+}
+
+/**
+ * @brief Type that keeps its value in the wire encoding
+ *
+ */
+template <class T>
+concept WirePreEncoded = requires(const T& value) {
+    {
+        value.wire_encoded(WireVersion::V1)
+    } -> std::convertible_to<std::string_view>;
+};
+
+template <class T>
+constexpr bool is_wire_serializable_v =
+    is_wire_scalar_v<T> || WirePreEncoded<T> ||
+    std::is_same_v<T, std::string> ||
+    std::is_same_v<T, std::string_view> ||
+    is_specialization<T, std::vector>::value || is_std_array<T>::value ||
+    is_specialization<T, std::optional>::value ||
+    is_specialization<T, std::tuple>::value ||
+    is_specialization<T, std::pair>::value ||
+    (std::is_aggregate_v<T> && !std::is_array_v<T>);
+
+/**
+ * @brief Encoder appending values to a byte buffer
+ *
+ */
+struct WireWriter {
+    explicit WireWriter(std::vector<char>& output,
+                        WireVersion version = WireVersion::V1)
+        : output_(output), version_(version) {}
+
+    template <class T>
+    WireWriter& put(const T& value);
+
+   private:
+    template <class T>
+    void put_scalars(const T* values, size_t count);
+
+    template <class T>
+    void put_range(const T* values, size_t count);
+
+    void put_length(size_t length);
+
+    std::vector<char>& output_;
+    WireVersion version_ = WireVersion::V1;
+};
+
+/**
+ * @brief Decoder reading values from a byte range
+ *
+ * @note std::string_view values are decoded as views into the input and
+ * share its lifetime.
+ */
+struct WireReader {
+    explicit WireReader(std::string_view input,
+                        WireVersion version = WireVersion::V1)
+        : input_(input), version_(version) {}
+
+    /**
+     * @brief Decode the next value
+     *
+     * @param value decoding destination
+     * @return false if the input is truncated or malformed
+     */
+    template <class T>
+    bool get(T& value);
+
+    bool is_done() const { return input_.empty(); }
+
+   private:
+    template <class T>
+    bool get_scalars(T* values, size_t count);
+
+    template <class T>
+    bool get_range(T* values, size_t count);
+
+    bool get_length(size_t& length);
+
+    std::string_view input_;
+    WireVersion version_ = WireVersion::V1;
+};
+
+/**
+ * @brief Encode values into the buffer
+ *
+ * @param version wire version the lengths are encoded for
+ * @param output destination buffer, the encoding is appended to it
+ * @param contents values to encode
+ */
+template <class... Ts>
+void wire_encode(WireVersion version, std::vector<char>& output,
+                 const Ts&... contents) {
+    WireWriter writer(output, version);
+    (writer.put(contents), ...);
+}
+
+/**
+ * @brief Encode values into the buffer the first wire version's way
+ *
+ * @param output destination buffer, the encoding is appended to it
+ * @param contents values to encode
+ */
+template <class... Ts>
+void wire_encode(std::vector<char>& output, const Ts&... contents) {
+    wire_encode(WireVersion::V1, output, contents...);
+}
+
+/**
+ * @brief Decode a value that occupies the whole input
+ *
+ * @param input encoded value
+ * @param version wire version the lengths are encoded for
+ * @return the value, or nothing if the input does not hold exactly one
+ */
+template <class T>
+std::optional<T> wire_decode(std::string_view input,
+                             WireVersion version = WireVersion::V1) {
+    WireReader reader(input, version);
+
+    T value{};
+    if (!reader.get(value) || !reader.is_done()) return {};
+
+    return value;
+}
+
+template <class T>
+inline WireWriter& WireWriter::put(const T& value) {
+    static_assert(is_wire_serializable_v<T>, "Type can not be serialized");
+
+    if constexpr (is_wire_scalar_v<T>) {
+        put_scalars(&value, 1);
+    } else if constexpr (WirePreEncoded<T>) {
+        std::string_view encoded = value.wire_encoded(version_);
+        output_.insert(output_.end(), encoded.begin(), encoded.end());
+    } else if constexpr (std::is_same_v<T, std::string> ||
+                         std::is_same_v<T, std::string_view>) {
+        put_length(value.size());
+        output_.insert(output_.end(), value.begin(), value.end());
+    } else if constexpr (is_specialization<T, std::vector>::value) {
+        put_length(value.size());
+        put_range(value.data(), value.size());
+    } else if constexpr (is_std_array<T>::value) {
+        put_range(value.data(), value.size());
+    } else if constexpr (is_specialization<T, std::optional>::value) {
+        put((uint8_t)value.has_value());
+        if (value) put(*value);
+    } else if constexpr (is_specialization<T, std::tuple>::value ||
+                         is_specialization<T, std::pair>::value) {
+        std::apply([this](const auto&... fields) { (put(fields), ...); },
+                   value);
+    } else {
+        put(wire_fields(value));
+    }
+
+    return *this;
+}
+
+template <class T>
+inline void WireWriter::put_scalars(const T* values, size_t count) {
+    size_t start = output_.size();
+    output_.resize(start + count * sizeof(T));
+
+    memcpy(output_.data() + start, values, count * sizeof(T));
+    swap_wire_bytes<sizeof(T)>(output_.data() + start, count);
+}
+
+template <class T>
+inline void WireWriter::put_range(const T* values, size_t count) {
+    if constexpr (is_wire_scalar_v<T>) {
+        put_scalars(values, count);
+    } else {
+        for (size_t id = 0; id < count; ++id) put(values[id]);
+    }
+}
+
+inline void WireWriter::put_length(size_t length) {
+    if (version_ == WireVersion::V1) {
+        put((uint32_t)length);
+        return;
+    }
+
+    char encoded[MAX_VARINT_SIZE] = {};
+    size_t size = encode_varint(length, encoded);
+
+    output_.insert(output_.end(), encoded, encoded + size);
+}
+
+template <class T>
+inline bool WireReader::get(T& value) {
+    static_assert(is_wire_serializable_v<T>, "Type can not be serialized");
+    static_assert(!WirePreEncoded<T>, "Pre-encoded types are write-only");
+
+    if constexpr (is_wire_scalar_v<T>) {
+        return get_scalars(&value, 1);
+    } else if constexpr (std::is_same_v<T, std::string> ||
+                         std::is_same_v<T, std::string_view>) {
+        size_t length = 0;
+        if (!get_length(length) || length > input_.size()) return false;
+
+        value = T(input_.data(), length);
+        input_.remove_prefix(length);
+
+        return true;
+    } else if constexpr (is_specialization<T, std::vector>::value) {
+        size_t count = 0;
+        if (!get_length(count)) return false;
+
+        // Every element but an empty one takes at least a byte.
+        if (count > input_.size()) return false;
+
+        value.resize(count);
+        return get_range(value.data(), value.size());
+    } else if constexpr (is_std_array<T>::value) {
+        return get_range(value.data(), value.size());
+    } else if constexpr (is_specialization<T, std::optional>::value) {
+        uint8_t present = 0;
+        if (!get(present) || present > 1) return false;
+
+        if (!present) {
+            value.reset();
+            return true;
+        }
+
+        return get(value.emplace());
+    } else if constexpr (is_specialization<T, std::tuple>::value ||
+                         is_specialization<T, std::pair>::value) {
+        return std::apply(
+            [this](auto&... fields) { return (get(fields) && ...); }, value);
+    } else {
+        auto fields = wire_fields(value);
+        return get(fields);
+    }
+}
+
+template <class T>
+inline bool WireReader::get_scalars(T* values, size_t count) {
+    if (input_.size() < count * sizeof(T)) return false;
+
+    memcpy((void*)values, input_.data(), count * sizeof(T));
+    swap_wire_bytes<sizeof(T)>((char*)values, count);
+
+    input_.remove_prefix(count * sizeof(T));
+
+    return true;
+}
+
+template <class T>
+inline bool WireReader::get_range(T* values, size_t count) {
+    if constexpr (is_wire_scalar_v<T>) {
+        return get_scalars(values, count);
+    } else {
+        for (size_t id = 0; id < count; ++id) {
+            if (!get(values[id])) return false;
+        }
+
+        return true;
+    }
+}
+
+inline bool WireReader::get_length(size_t& length) {
+    if (version_ == WireVersion::V1) {
+        uint32_t fixed = 0;
+        if (!get(fixed)) return false;
+
+        length = fixed;
+        return true;
+    }
+
+    uint64_t value = 0;
+    size_t size = decode_varint(input_, &value);
+    if (size == 0 || value > UINT32_MAX) return false;
+
+    input_.remove_prefix(size);
+    length = value;
+
+    return true;
+}
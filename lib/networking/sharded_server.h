@@ -0,0 +1,221 @@
+/**
+ * @file sharded_server.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Group of event-driven servers sharing one port (SO_REUSEPORT).
+ * @version 0.1
+ * @date 2024-11-14
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "basic_server.h"
+
+/**
+ * @brief Set of servers, each owning its own listener, client table and
+ * worker thread
+ *
+ * @tparam Server NetworkServer descendant constructed with reuse_port = true
+ */
+template <class Server>
+struct ServerShards {
+    using Factory = std::function<std::unique_ptr<Server>(size_t shard_id)>;
+
+    /**
+     * @brief Picks the shard a freshly accepted client should be served by
+     *
+     * @param client accepted client
+     * @param accepted_on shard whose listener accepted the client
+     * @return target shard id
+     */
+    using Selector = std::function<size_t(const NetworkClientInfo& client,
+                                          size_t accepted_on)>;
+
+    /**
+     * @brief One iteration of a worker's loop
+     *
+     * @note Has to return once the shard is woken up.
+     *
+     * @param server shard served by the worker
+     */
+    using Step = std::function<void(Server& server)>;
+
+    ServerShards(size_t shard_count, const Factory& factory);
+    ~ServerShards() { stop(); }
+
+    ServerShards(const ServerShards&) = delete;
+    ServerShards& operator=(const ServerShards&) = delete;
+
+    /**
+     * @brief Route accepted clients through the selector
+     *
+     * @param selector shard selector
+     */
+    void set_selector(Selector selector) { selector_ = std::move(selector); }
+
+    /**
+     * @brief Replace the poll every worker repeats, say to run the timers of
+     * the server itself
+     *
+     * @param step loop iteration, polls the shard by default
+     */
+    void set_step(Step step) { step_ = std::move(step); }
+
+    /**
+     * @brief Pin worker threads to CPUs (shard_id modulo CPU count)
+     *
+     * @param pin true to pin workers started after the call
+     */
+    void set_pinning(bool pin) { pin_ = pin; }
+
+    /**
+     * @brief Start worker threads, each polling its own shard
+     *
+     */
+    void start();
+
+    /**
+     * @brief Stop and join worker threads
+     *
+     */
+    void stop();
+
+    size_t size() const { return shards_.size(); }
+
+    Server& operator[](size_t shard_id) { return *shards_[shard_id]; }
+
+    /**
+     * @brief Number of clients routed to the shard that have not left yet
+     *
+     * @param shard_id shard id
+     * @return client count
+     */
+    size_t assigned_count(size_t shard_id) const {
+        return assigned_[shard_id].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Run the functor on every shard, each in its worker thread
+     *
+     * @warning Workers have to be stopped.
+     *
+     * @param action functor called as action(server, shard_id)
+     */
+    template <class Action>
+    void run_on_each(const Action& action);
+
+   private:
+    bool route(const NetworkClientInfo& client, size_t accepted_on);
+    void pin_current_thread(size_t shard_id) const;
+
+    std::vector<std::unique_ptr<Server>> shards_{};
+    std::unique_ptr<std::atomic<size_t>[]> assigned_{};
+
+    std::vector<std::jthread> workers_{};
+
+    Selector selector_{};
+    Step step_{};
+    bool pin_ = false;
+};
+
+template <class Server>
+inline ServerShards<Server>::ServerShards(size_t shard_count,
+                                          const Factory& factory)
+    : assigned_(new std::atomic<size_t>[shard_count]) {
+    for (size_t shard_id = 0; shard_id < shard_count; ++shard_id) {
+        shards_.push_back(factory(shard_id));
+        assigned_[shard_id] = 0;
+
+        shards_[shard_id]->enable_event_loop();
+        shards_[shard_id]->set_accept_redirect(
+            [this, shard_id](const NetworkClientInfo& client) {
+                return route(client, shard_id);
+            });
+        shards_[shard_id]->set_leave_notice(
+            [this, shard_id](typename Server::ClientId) {
+                assigned_[shard_id].fetch_sub(1, std::memory_order_relaxed);
+            });
+    }
+}
+
+template <class Server>
+inline void ServerShards<Server>::start() {
+    for (size_t shard_id = 0; shard_id < shards_.size(); ++shard_id) {
+        workers_.emplace_back([this, shard_id](std::stop_token stop) {
+            if (pin_) pin_current_thread(shard_id);
+
+            while (!stop.stop_requested()) {
+                if (step_) {
+                    step_(*shards_[shard_id]);
+                } else {
+                    shards_[shard_id]->poll_events(-1);
+                }
+            }
+        });
+    }
+}
+
+template <class Server>
+inline void ServerShards<Server>::stop() {
+    for (size_t shard_id = 0; shard_id < workers_.size(); ++shard_id) {
+        workers_[shard_id].request_stop();
+        shards_[shard_id]->wake();
+    }
+
+    workers_.clear();
+}
+
+template <class Server>
+template <class Action>
+inline void ServerShards<Server>::run_on_each(const Action& action) {
+    assert(workers_.empty());
+
+    std::vector<std::jthread> runners{};
+
+    for (size_t shard_id = 0; shard_id < shards_.size(); ++shard_id) {
+        runners.emplace_back([this, shard_id, &action]() {
+            if (pin_) pin_current_thread(shard_id);
+
+            action(*shards_[shard_id], shard_id);
+        });
+    }
+}
+
+template <class Server>
+inline bool ServerShards<Server>::route(const NetworkClientInfo& client,
+                                        size_t accepted_on) {
+    size_t target = accepted_on;
+
+    if (selector_) target = selector_(client, accepted_on) % shards_.size();
+
+    assigned_[target].fetch_add(1, std::memory_order_relaxed);
+
+    if (target == accepted_on) return false;
+
+    shards_[target]->post_client(client);
+
+    return true;
+}
+
+template <class Server>
+inline void ServerShards<Server>::pin_current_thread(size_t shard_id) const {
+    unsigned cpu_count = std::thread::hardware_concurrency();
+    if (cpu_count == 0) return;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(shard_id % cpu_count, &cpus);
+
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
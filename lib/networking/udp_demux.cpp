@@ -0,0 +1,260 @@
+#include "udp_demux.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+static const size_t INITIAL_TABLE_SIZE = 64;
+
+// Fits any datagram, coalesced ones included.
+static const size_t SLOT_SIZE = 65536;  // bytes
+
+static bool same_address(const sockaddr_in& left, const sockaddr_in& right) {
+    return left.sin_addr.s_addr == right.sin_addr.s_addr &&
+           left.sin_port == right.sin_port;
+}
+
+int UdpDemux::attach(const sockaddr_in& address) {
+    int known = find(address);
+    if (known >= 0) return known;
+
+    // The table is kept at most half full.
+    if (2 * (attached_count_ + 1) > table_.size()) grow_table();
+
+    int slot = (int)inboxes_.size();
+    if (free_slots_.empty()) {
+        inboxes_.emplace_back();
+    } else {
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+    }
+
+    Inbox& inbox = inboxes_[(size_t)slot];
+    inbox.address = address;
+    inbox.attached = true;
+
+    table_[locate(address)] = slot;
+    ++attached_count_;
+
+    return slot;
+}
+
+void UdpDemux::detach(int slot) {
+    Inbox& inbox = inboxes_[(size_t)slot];
+    if (!inbox.attached) return;
+
+    size_t mask = table_.size() - 1;
+    size_t hole = locate(inbox.address);
+    table_[hole] = EMPTY_ENTRY;
+
+    // Entries after the hole move back unless their home lies past it, so
+    // lookups never stop early and no tombstones are needed.
+    for (size_t next = (hole + 1) & mask; table_[next] != EMPTY_ENTRY;
+         next = (next + 1) & mask) {
+        size_t home = home_of(inboxes_[(size_t)table_[next]].address);
+
+        bool stays = hole <= next ? hole < home && home <= next
+                                  : hole < home || home <= next;
+        if (stays) continue;
+
+        table_[hole] = table_[next];
+        table_[next] = EMPTY_ENTRY;
+        hole = next;
+    }
+
+    inbox = Inbox{};
+    free_slots_.push_back(slot);
+    --attached_count_;
+}
+
+int UdpDemux::find(const sockaddr_in& address) const {
+    if (table_.empty()) return -1;
+
+    return table_[locate(address)];
+}
+
+size_t UdpDemux::pump() {
+    size_t batch = DEFAULT_DATAGRAM_BATCH;
+
+    if (batch_headers_.empty()) {
+        batch_buffer_.resize(batch * SLOT_SIZE);
+        batch_parts_.resize(batch);
+        batch_headers_.resize(batch);
+        batch_sources_.resize(batch);
+    }
+
+    size_t routed = 0;
+
+    while (true) {
+        for (size_t message_id = 0; message_id < batch; ++message_id) {
+            batch_parts_[message_id] = {
+                .iov_base = batch_buffer_.data() + message_id * SLOT_SIZE,
+                .iov_len = SLOT_SIZE,
+            };
+
+            msghdr& message = batch_headers_[message_id].msg_hdr;
+            message = {};
+            message.msg_name = &batch_sources_[message_id];
+            message.msg_namelen = sizeof(sockaddr_in);
+            message.msg_iov = &batch_parts_[message_id];
+            message.msg_iovlen = 1;
+        }
+
+        int count = recvmmsg(sock_, batch_headers_.data(), (unsigned)batch,
+                             MSG_DONTWAIT, nullptr);
+
+        if (count <= 0) break;
+
+        for (size_t message_id = 0; message_id < (size_t)count; ++message_id) {
+            size_t dropped = dropped_;
+
+            route(batch_sources_[message_id],
+                  (const char*)batch_parts_[message_id].iov_base,
+                  batch_headers_[message_id].msg_len);
+
+            if (dropped_ == dropped) ++routed;
+        }
+
+        if ((size_t)count < batch) break;
+    }
+
+    errno = 0;
+
+    return routed;
+}
+
+bool UdpDemux::wait(int slot, int timeout_ms) {
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point until = Clock::now() +
+                              std::chrono::milliseconds(timeout_ms);
+
+    while (!has_pending(slot)) {
+        int left_ms = -1;
+        if (timeout_ms >= 0) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                until - Clock::now());
+            if (left.count() <= 0) return false;
+
+            left_ms = (int)left.count();
+        }
+
+        pollfd request = {.fd = sock_, .events = POLLIN, .revents = 0};
+        int ready = poll(&request, 1, left_ms);
+
+        if (ready < 0 && errno != EINTR) return false;
+        errno = 0;
+
+        if (ready > 0) pump();
+    }
+
+    return true;
+}
+
+ssize_t UdpDemux::receive(int slot, void* buffer, size_t len, int flags) {
+    Inbox& inbox = inboxes_[(size_t)slot];
+
+    if (!inbox.attached) {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    if (!has_pending(slot)) pump();
+
+    bool blocking =
+        !(flags & MSG_DONTWAIT) && !(fcntl(sock_, F_GETFL) & O_NONBLOCK);
+
+    if (!has_pending(slot) && !(blocking && wait(slot, -1))) {
+        if (errno == 0) errno = EAGAIN;
+        return -1;
+    }
+
+    size_t datagram_len = inbox.lengths.front();
+    size_t size = std::min(len, datagram_len);
+
+    memcpy(buffer, inbox.bytes.data() + inbox.head, size);
+
+    inbox.head += datagram_len;
+    inbox.lengths.pop_front();
+
+    // The queue restarts from the front once it is empty or half consumed.
+    if (inbox.lengths.empty()) {
+        inbox.bytes.clear();
+        inbox.head = 0;
+    } else if (inbox.head > inbox.bytes.size() / 2) {
+        inbox.bytes.erase(inbox.bytes.begin(),
+                          inbox.bytes.begin() + (ptrdiff_t)inbox.head);
+        inbox.head = 0;
+    }
+
+    return (ssize_t)size;
+}
+
+void UdpDemux::take_ready(std::vector<int>& ready) {
+    ready.clear();
+    ready.swap(ready_);
+
+    for (int slot : ready) inboxes_[(size_t)slot].listed = false;
+}
+
+size_t UdpDemux::home_of(const sockaddr_in& address) const {
+    uint64_t key = (uint64_t)address.sin_addr.s_addr << 16 | address.sin_port;
+
+    // Fibonacci hashing spreads consecutive ports and addresses.
+    return ((key * 0x9e3779b97f4a7c15ull) >> 32) & (table_.size() - 1);
+}
+
+size_t UdpDemux::locate(const sockaddr_in& address) const {
+    size_t mask = table_.size() - 1;
+
+    size_t position = home_of(address);
+    while (table_[position] != EMPTY_ENTRY &&
+           !same_address(inboxes_[(size_t)table_[position]].address,
+                         address)) {
+        position = (position + 1) & mask;
+    }
+
+    return position;
+}
+
+void UdpDemux::grow_table() {
+    size_t size = std::max(table_.size() * 2, INITIAL_TABLE_SIZE);
+
+    table_.assign(size, EMPTY_ENTRY);
+
+    for (size_t slot = 0; slot < inboxes_.size(); ++slot) {
+        if (!inboxes_[slot].attached) continue;
+
+        table_[locate(inboxes_[slot].address)] = (int)slot;
+    }
+}
+
+void UdpDemux::route(const sockaddr_in& source, const char* datagram,
+                     size_t len) {
+    int slot = find(source);
+
+    if (slot < 0) {
+        ++dropped_;
+        return;
+    }
+
+    Inbox& inbox = inboxes_[(size_t)slot];
+
+    if (inbox.bytes.size() - inbox.head + len > UDP_DEMUX_MAX_QUEUED) {
+        ++dropped_;
+        return;
+    }
+
+    inbox.bytes.insert(inbox.bytes.end(), datagram, datagram + len);
+    inbox.lengths.push_back(len);
+
+    if (!inbox.listed) {
+        inbox.listed = true;
+        ready_.push_back(slot);
+    }
+}
@@ -0,0 +1,154 @@
+/**
+ * @file udp_demux.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Routing of datagrams arriving at a shared UDP socket to per-peer
+ * queues.
+ * @version 0.1
+ * @date 2024-11-25
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <deque>
+#include <vector>
+
+#include "protocols.h"
+
+// Datagrams queued for a peer that does not read them get dropped past this.
+static const size_t UDP_DEMUX_MAX_QUEUED = 4 << 20;  // bytes
+
+/**
+ * @brief Demultiplexer of a UDP socket shared by many peers
+ *
+ * @note Every attached peer gets a slot, a small integer reused after the
+ * peer is detached. Datagrams are read in batches with recvmmsg() and
+ * appended to the queue of the slot their source address is attached to,
+ * the slot is found through an open-addressing hash table keyed by address
+ * and port. Datagrams from unknown addresses are dropped.
+ *
+ * Functions follow the recv() convention: -1 is returned and errno is set on
+ * failure.
+ */
+struct UdpDemux {
+    /**
+     * @param sock shared socket, stays owned by the caller
+     */
+    explicit UdpDemux(int sock) : sock_(sock) {}
+
+    UdpDemux(const UdpDemux&) = delete;
+    UdpDemux& operator=(const UdpDemux&) = delete;
+
+    /**
+     * @brief Start routing datagrams from the address
+     *
+     * @param address peer address
+     * @return slot of the peer, the existing one if it is already attached
+     */
+    int attach(const sockaddr_in& address);
+
+    /**
+     * @brief Stop routing datagrams to the slot and drop its queue
+     *
+     * @param slot peer slot
+     */
+    void detach(int slot);
+
+    /**
+     * @brief Find the slot of an attached address
+     *
+     * @param address peer address
+     * @return slot, or -1 if the address is not attached
+     */
+    int find(const sockaddr_in& address) const;
+
+    /**
+     * @brief Route every datagram waiting in the socket, without blocking
+     *
+     * @return number of datagrams routed to a slot
+     */
+    size_t pump();
+
+    /**
+     * @brief Wait for a datagram addressed to the slot, routing the others
+     *
+     * @param slot peer slot
+     * @param timeout_ms maximum time to wait, -1 to wait indefinitely
+     * @return true if a datagram is queued for the slot
+     */
+    bool wait(int slot, int timeout_ms);
+
+    /**
+     * @brief Take the next datagram queued for the slot
+     *
+     * @note Blocks until one arrives unless the socket is non-blocking or
+     * MSG_DONTWAIT is given.
+     *
+     * @param slot peer slot
+     * @param buffer destination, a longer datagram is truncated
+     * @param len buffer size
+     * @param flags 0 or MSG_DONTWAIT
+     * @return datagram length, or -1 on failure
+     */
+    ssize_t receive(int slot, void* buffer, size_t len, int flags);
+
+    bool has_pending(int slot) const {
+        return !inboxes_[(size_t)slot].lengths.empty();
+    }
+
+    /**
+     * @brief Take the list of slots that got datagrams since the last call
+     *
+     * @param ready destination, every slot is listed once
+     */
+    void take_ready(std::vector<int>& ready);
+
+    int get_socket() const { return sock_; }
+    size_t get_dropped() const { return dropped_; }
+
+   private:
+    struct Inbox {
+        sockaddr_in address{};
+        bool attached = false;
+        bool listed = false;  // in ready_
+
+        // Queued datagrams, back to back, starting at head.
+        std::vector<char> bytes{};
+        size_t head = 0;
+        std::deque<size_t> lengths{};
+    };
+
+    static constexpr int EMPTY_ENTRY = -1;
+
+    size_t home_of(const sockaddr_in& address) const;
+    size_t locate(const sockaddr_in& address) const;
+    void grow_table();
+
+    void route(const sockaddr_in& source, const char* datagram, size_t len);
+
+    int sock_ = -1;
+
+    std::vector<Inbox> inboxes_{};
+    std::vector<int> free_slots_{};
+    size_t attached_count_ = 0;
+
+    // Slot ids, probed linearly, the size is a power of two.
+    std::vector<int> table_{};
+
+    std::vector<int> ready_{};
+    size_t dropped_ = 0;
+
+    std::vector<char> batch_buffer_{};
+    std::vector<iovec> batch_parts_{};
+    std::vector<mmsghdr> batch_headers_{};
+    std::vector<sockaddr_in> batch_sources_{};
+};
@@ -0,0 +1,345 @@
+#include "uring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+static const uint64_t RECV_TAG = ~0ULL;
+
+static int uring_setup(unsigned entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                        IORING_ENTER_GETEVENTS, nullptr, 0);
+}
+
+static int uring_register(int ring_fd, unsigned opcode, const void* arg,
+                          unsigned arg_count) {
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg,
+                        arg_count);
+}
+
+template <class T>
+static T* ring_field(void* ring, unsigned offset) {
+    return (T*)((char*)ring + offset);
+}
+
+UringQueue::UringQueue(unsigned entries) {
+    io_uring_params params{};
+
+    ring_fd_ = uring_setup(entries, &params);
+
+    if (ring_fd_ < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        if (ring_fd_ >= 0) close(ring_fd_);
+        ring_fd_ = -1;
+        errno = 0;
+        return;
+    }
+
+    sq_entries_ = params.sq_entries;
+
+    ring_size_ = std::max(
+        params.sq_off.array + params.sq_entries * sizeof(unsigned),
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+
+    if (ring_ == MAP_FAILED || sqes == MAP_FAILED) {
+        if (ring_ != MAP_FAILED) munmap(ring_, ring_size_);
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size_);
+        ring_ = nullptr;
+        close(ring_fd_);
+        ring_fd_ = -1;
+        errno = 0;
+        return;
+    }
+
+    sqes_ = (io_uring_sqe*)sqes;
+
+    sq_tail_ = ring_field<unsigned>(ring_, params.sq_off.tail);
+    sq_mask_ = ring_field<unsigned>(ring_, params.sq_off.ring_mask);
+    sq_array_ = ring_field<unsigned>(ring_, params.sq_off.array);
+
+    cq_head_ = ring_field<unsigned>(ring_, params.cq_off.head);
+    cq_tail_ = ring_field<unsigned>(ring_, params.cq_off.tail);
+    cq_mask_ = ring_field<unsigned>(ring_, params.cq_off.ring_mask);
+    cqes_ = ring_field<io_uring_cqe>(ring_, params.cq_off.cqes);
+
+    arena_ = (char*)aligned_alloc(4096, ARENA_SIZE);
+
+    iovec arena_vec = {.iov_base = arena_, .iov_len = ARENA_SIZE};
+    fixed_buffer_ =
+        uring_register(ring_fd_, IORING_REGISTER_BUFFERS, &arena_vec, 1) == 0;
+
+    messages_ = new msghdr[sq_entries_]{};
+    vectors_ = new iovec[sq_entries_]{};
+    addresses_ = new sockaddr_in[sq_entries_]{};
+
+    errno = 0;
+}
+
+UringQueue::~UringQueue() {
+    if (!is_valid()) return;
+
+    flush();
+    errno = 0;
+
+    delete[] messages_;
+    delete[] vectors_;
+    delete[] addresses_;
+
+    munmap(sqes_, sqes_size_);
+    munmap(ring_, ring_size_);
+    close(ring_fd_);
+    free(arena_);
+}
+
+void UringQueue::attach(int sock_fd) {
+    assert(errno == 0);
+
+    sock_fd_ = sock_fd;
+
+    if (fixed_file_) {
+        uring_register(ring_fd_, IORING_UNREGISTER_FILES, nullptr, 0);
+    }
+
+    fixed_file_ =
+        uring_register(ring_fd_, IORING_REGISTER_FILES, &sock_fd_, 1) == 0;
+
+    errno = 0;
+}
+
+ssize_t UringQueue::send(const void* buffer, size_t len, int flags,
+                         const sockaddr_in* address) {
+    assert(errno == 0);
+
+    if (failure_) return take_failure();
+
+    if (len > ARENA_SIZE) {
+        // Too large to be copied, send from the caller's memory right away.
+        if (!flush()) return -1;
+
+        prepare_send(buffer, len, flags, address);
+        end_send_chain();
+
+        if (!submit_and_wait(1)) return -1;
+
+        pending_sends_ = 0;
+        if (failure_) return take_failure();
+
+        return (ssize_t)len;
+    }
+
+    if (arena_used_ + len > ARENA_SIZE || pending_sends_ + 1 >= sq_entries_) {
+        if (!flush()) return -1;
+    }
+
+    char* copy = arena_ + arena_used_;
+    memcpy(copy, buffer, len);
+    arena_used_ += len;
+
+    prepare_send(copy, len, flags, address);
+
+    return (ssize_t)len;
+}
+
+ssize_t UringQueue::recv(void* buffer, size_t len, int flags,
+                         sockaddr_in* address) {
+    assert(errno == 0);
+
+    if (failure_) return take_failure();
+
+    end_send_chain();
+
+    io_uring_sqe* sqe = next_sqe();
+
+    if (address) {
+        msghdr& message = messages_[sq_entries_ - 1];
+        iovec& vector = vectors_[sq_entries_ - 1];
+
+        vector = {.iov_base = buffer, .iov_len = len};
+        message = {};
+        message.msg_name = address;
+        message.msg_namelen = sizeof(*address);
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->addr = (uint64_t)&message;
+        sqe->len = 1;
+    } else {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->addr = (uint64_t)buffer;
+        sqe->len = (uint32_t)len;
+    }
+
+    sqe->msg_flags = (uint32_t)flags;
+    sqe->user_data = RECV_TAG;
+
+    if (!submit_and_wait(pending_sends_ + 1)) return -1;
+
+    pending_sends_ = 0;
+    arena_used_ = 0;
+
+    if (failure_) return take_failure();
+
+    if (recv_result_ < 0) {
+        errno = -recv_result_;
+        return -1;
+    }
+
+    return recv_result_;
+}
+
+bool UringQueue::flush() {
+    assert(errno == 0);
+
+    if (pending_sends_ == 0) return take_failure() == 0;
+
+    end_send_chain();
+
+    if (!submit_and_wait(pending_sends_)) return false;
+
+    pending_sends_ = 0;
+    arena_used_ = 0;
+
+    return take_failure() == 0;
+}
+
+io_uring_sqe* UringQueue::next_sqe() {
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    if (fixed_file_) {
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = sock_fd_;
+    }
+
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+    ++unsubmitted_;
+
+    return sqe;
+}
+
+void UringQueue::prepare_send(const void* buffer, size_t len, int flags,
+                              const sockaddr_in* address) {
+    io_uring_sqe* sqe = next_sqe();
+
+    const char* bytes = (const char*)buffer;
+    bool in_arena = bytes >= arena_ && bytes < arena_ + ARENA_SIZE;
+
+    if (address) {
+        msghdr& message = messages_[pending_sends_];
+        iovec& vector = vectors_[pending_sends_];
+        addresses_[pending_sends_] = *address;
+
+        vector = {.iov_base = (void*)buffer, .iov_len = len};
+        message = {};
+        message.msg_name = &addresses_[pending_sends_];
+        message.msg_namelen = sizeof(*address);
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = (uint64_t)&message;
+        sqe->len = 1;
+        sqe->msg_flags = (uint32_t)flags;
+    } else if (flags == 0 && fixed_buffer_ && in_arena) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = (uint64_t)buffer;
+        sqe->len = (uint32_t)len;
+        sqe->buf_index = 0;
+    } else {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64_t)buffer;
+        sqe->len = (uint32_t)len;
+        sqe->msg_flags = (uint32_t)flags;
+    }
+
+    // Sends to the same socket have to reach the wire in order.
+    sqe->flags = (uint8_t)(sqe->flags | IOSQE_IO_LINK);
+    sqe->user_data = len;
+
+    last_send_ = sqe;
+    ++pending_sends_;
+}
+
+void UringQueue::end_send_chain() {
+    if (last_send_) {
+        last_send_->flags = (uint8_t)(last_send_->flags & ~IOSQE_IO_LINK);
+    }
+
+    last_send_ = nullptr;
+}
+
+bool UringQueue::submit_and_wait(unsigned wait_count) {
+    unsigned completed = 0;
+
+    while (completed < wait_count) {
+        int status = uring_enter(ring_fd_, unsubmitted_, 1);
+
+        if (status < 0) {
+            if (errno == EINTR) {
+                errno = 0;
+                continue;
+            }
+            return false;
+        }
+
+        unsubmitted_ = 0;
+
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; ++head, ++completed) {
+            reap(&cqes_[head & *cq_mask_]);
+        }
+
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+void UringQueue::reap(io_uring_cqe* cqe) {
+    if (cqe->user_data == RECV_TAG) {
+        recv_result_ = cqe->res;
+        return;
+    }
+
+    if (failure_) return;
+
+    if (cqe->res < 0) {
+        failure_ = -cqe->res;
+    } else if ((uint64_t)cqe->res < cqe->user_data) {
+        failure_ = EIO;
+    }
+}
+
+ssize_t UringQueue::take_failure() {
+    if (!failure_) return 0;
+
+    errno = failure_;
+    failure_ = 0;
+
+    return -1;
+}
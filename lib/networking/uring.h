@@ -0,0 +1,122 @@
+/**
+ * @file uring.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Batched io_uring transport for a single socket.
+ * @version 0.1
+ * @date 2024-11-12
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * @brief Submission/completion ring bound to one socket
+ *
+ * @note Sends are copied into a registered buffer and only queued, they reach
+ * the kernel in one io_uring_enter() call on the next flush() or recv(). Send
+ * errors are therefore reported by the call that submits the batch.
+ *
+ * Functions follow the send()/recv() convention: -1 is returned and errno is
+ * set on failure.
+ */
+struct UringQueue {
+    explicit UringQueue(unsigned entries = DEFAULT_ENTRIES);
+    ~UringQueue();
+
+    UringQueue(const UringQueue&) = delete;
+    UringQueue& operator=(const UringQueue&) = delete;
+
+    bool is_valid() const { return ring_fd_ >= 0; }
+
+    /**
+     * @brief Bind the queue to the socket (registered as a fixed file)
+     *
+     * @param sock_fd socket descriptor
+     */
+    void attach(int sock_fd);
+
+    /**
+     * @brief Queue the message for sending
+     *
+     * @param buffer message contents (copied, may be reused right away)
+     * @param len message length
+     * @param flags send() flags
+     * @param address destination address, nullptr for connected sockets
+     * @return len, or -1 if the previous batch failed
+     */
+    ssize_t send(const void* buffer, size_t len, int flags,
+                 const sockaddr_in* address);
+
+    /**
+     * @brief Submit queued sends together with a receive and wait for all of
+     * them to complete
+     *
+     * @param buffer receive buffer
+     * @param len buffer length
+     * @param flags recv() flags
+     * @param address sender address output, nullptr for connected sockets
+     * @return number of bytes received, -1 on failure
+     */
+    ssize_t recv(void* buffer, size_t len, int flags, sockaddr_in* address);
+
+    /**
+     * @brief Submit queued sends and wait for their completion
+     *
+     * @return true if every queued send succeeded
+     */
+    bool flush();
+
+   private:
+    static const unsigned DEFAULT_ENTRIES = 32;
+    static const size_t ARENA_SIZE = 16384;  // bytes
+
+    io_uring_sqe* next_sqe();
+    void prepare_send(const void* buffer, size_t len, int flags,
+                      const sockaddr_in* address);
+    void end_send_chain();
+    bool submit_and_wait(unsigned wait_count);
+    void reap(io_uring_cqe* cqe);
+    ssize_t take_failure();
+
+    int ring_fd_ = -1;
+    int sock_fd_ = -1;
+    bool fixed_file_ = false;
+    bool fixed_buffer_ = false;
+
+    void* ring_ = nullptr;
+    size_t ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_entries_ = 0;
+
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+
+    char* arena_ = nullptr;
+    size_t arena_used_ = 0;
+
+    io_uring_sqe* last_send_ = nullptr;
+    unsigned unsubmitted_ = 0;
+    unsigned pending_sends_ = 0;
+    int failure_ = 0;
+    int recv_result_ = 0;
+
+    msghdr* messages_ = nullptr;
+    iovec* vectors_ = nullptr;
+    sockaddr_in* addresses_ = nullptr;
+};
@@ -0,0 +1,171 @@
+/**
+ * @file wire_format.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Message header encoding for every wire version.
+ * @version 0.1
+ * @date 2024-11-22
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "compression/lz.h"
+#include "protocols.h"
+#include "serialization.h"
+
+/**
+ * @brief V2 message type tag, the first byte of every message
+ *
+ */
+enum WireTag : uint8_t {
+    WIRE_TAG_UINT = 0x01,
+    WIRE_TAG_SINT = 0x02,
+    WIRE_TAG_STRING = 0x03,
+    WIRE_TAG_FRAME = 0x04,  // value encoded by WireWriter
+
+    // Set on frame tags whose body is LZ-compressed.
+    WIRE_TAG_COMPRESSED = 0x80,
+
+    // Set on UDP frame tags whose body is sent in chunks of a stated size.
+    WIRE_TAG_CHUNKED = 0x40,
+};
+
+static const size_t MAX_WIRE_HEADER_SIZE = 1 + MAX_VARINT_SIZE;  // bytes
+
+// Compressed frames also carry the decompressed length, chunked ones the
+// chunk size.
+static const size_t MAX_FRAME_HEADER_SIZE =
+    MAX_WIRE_HEADER_SIZE + 2 * MAX_VARINT_SIZE;  // bytes
+
+// Frames announcing a longer body kill the connection.
+static const size_t DEFAULT_MAX_FRAME_SIZE = 1 << 24;  // bytes
+
+/**
+ * @brief Everything that decides how a connection encodes its messages
+ *
+ */
+struct WireEncoding {
+    WireVersion version = WireVersion::V1;
+
+    // Frames of at least this size get compressed (V2 only), 0 disables
+    // compression.
+    size_t compression_threshold = 0;
+
+    // Shared LZ dictionary, has to outlive the connection.
+    std::string_view dictionary{};
+
+    bool operator==(const WireEncoding& other) const {
+        return version == other.version &&
+               compression_threshold == other.compression_threshold &&
+               dictionary.data() == other.dictionary.data() &&
+               dictionary.size() == other.dictionary.size();
+    }
+};
+
+inline uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * @brief Encode an integer message
+ *
+ * @param version wire version
+ * @param value integer to encode
+ * @param output destination, at least MAX_WIRE_HEADER_SIZE bytes
+ * @return number of bytes written
+ */
+template <class T>
+size_t encode_wire_integer(WireVersion version, T value, char* output) {
+    if (version == WireVersion::V1) {
+        memcpy(output, &value, sizeof(value));
+        swap_wire_bytes<sizeof(T)>(output, 1);
+        return sizeof(value);
+    }
+
+    if constexpr (std::is_signed_v<T>) {
+        output[0] = (char)WIRE_TAG_SINT;
+        return 1 + encode_varint(zigzag_encode(value), output + 1);
+    } else {
+        output[0] = (char)WIRE_TAG_UINT;
+        return 1 + encode_varint(value, output + 1);
+    }
+}
+
+/**
+ * @brief Encode the header preceding a string or a serialized value
+ *
+ * @param version wire version
+ * @param tag WIRE_TAG_STRING or WIRE_TAG_FRAME
+ * @param len body length
+ * @param output destination, at least MAX_WIRE_HEADER_SIZE bytes
+ * @return number of bytes written
+ */
+inline size_t encode_frame_header(WireVersion version, WireTag tag,
+                                  size_t len, char* output) {
+    if (version == WireVersion::V1) {
+        return encode_wire_integer(version, (uint32_t)len, output);
+    }
+
+    output[0] = (char)tag;
+    return 1 + encode_varint(len, output + 1);
+}
+
+/**
+ * @brief Encode the header of a string or serialized value, compressing the
+ * body if the encoding asks for it
+ *
+ * @param encoding connection encoding
+ * @param tag WIRE_TAG_STRING or WIRE_TAG_FRAME
+ * @param body body to send, replaced with the compressed body if that one
+ * is shorter
+ * @param scratch storage for the compressed body
+ * @param output header destination, at least MAX_FRAME_HEADER_SIZE bytes
+ * @param chunk_size size of the UDP chunks carrying the body (V2 only), 0
+ * if the receiver can assume UDP_OPTIMAL_SIZE
+ * @return header length
+ */
+inline size_t encode_frame(const WireEncoding& encoding, WireTag tag,
+                           std::string_view* body, std::vector<char>& scratch,
+                           char* output, size_t chunk_size = 0) {
+    bool compress = encoding.version != WireVersion::V1 &&
+                    encoding.compression_threshold > 0 &&
+                    body->size() >= encoding.compression_threshold;
+
+    if (compress) {
+        scratch.clear();
+        lz_compress(*body, encoding.dictionary, scratch);
+        compress = scratch.size() < body->size();
+    }
+
+    bool chunked = encoding.version != WireVersion::V1 && chunk_size > 0;
+
+    size_t raw_len = body->size();
+    if (compress) {
+        *body = std::string_view(scratch.data(), scratch.size());
+        tag = (WireTag)(tag | WIRE_TAG_COMPRESSED);
+    }
+
+    if (chunked) tag = (WireTag)(tag | WIRE_TAG_CHUNKED);
+
+    size_t len =
+        encode_frame_header(encoding.version, tag, body->size(), output);
+
+    if (compress) len += encode_varint(raw_len, output + len);
+    if (chunked) len += encode_varint(chunk_size, output + len);
+
+    return len;
+}
@@ -8,47 +8,69 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "config.h"
 #include "logger/debug.h"
 #include "logger/logger.h"
 #include "networking/basic_client.h"
+#include "networking/coroutine.h"
+#include "vocabulary.h"
 
 static in_addr_t get_address();
 
 template <NetworkProtocol Protocol>
 struct GameClient : public NetworkClient<Protocol> {
-    GameClient();
+    explicit GameClient(const ClientSettings& settings);
 
-    void provide_credentials(const std::string& name);
+    void provide_credentials(const std::string& name,
+                             const std::string& room = {});
 
     void make_turn();
 
+    /**
+     * @brief Same turn as make_turn(), played as a coroutine
+     *
+     * @param scheduler scheduler the turn runs on
+     */
+    Task<void> make_turn_async(Scheduler& scheduler);
+
     void display_story();
+
+   private:
+    bool compression_ = false;
+    bool reliable_ = false;
 };
 
 template <NetworkProtocol Protocol>
-int as_client() {
+int as_client(const ClientSettings& settings) {
     std::string name;
     std::cout << "Your display name:" << std::endl << INPUT_PREFIX;
     std::cin >> name;
 
-    GameClient<Protocol> client;
+    GameClient<Protocol> client(settings);
 
-    client.provide_credentials(name);
+    client.provide_credentials(name, settings.room);
 
     std::cout << "Waiting for other players..." << std::endl;
 
-    client.make_turn();
+    if (settings.coroutines) {
+        Scheduler scheduler;
+        scheduler.spawn(client.make_turn_async(scheduler));
+        scheduler.run();
+    } else {
+        client.make_turn();
+    }
 
     client.display_story();
 
     return EXIT_SUCCESS;
 }
 
-template int as_client<NetworkProtocol::TCP>();
+template int as_client<NetworkProtocol::TCP>(const ClientSettings& settings);
 
-template int as_client<NetworkProtocol::UDP>();
+template int as_client<NetworkProtocol::UDP>(const ClientSettings& settings);
 
 static in_addr_t get_address() {
     in_addr_t address = 0;
@@ -74,12 +96,65 @@ static in_addr_t get_address() {
 }
 
 template <NetworkProtocol Protocol>
-GameClient<Protocol>::GameClient()
-    : NetworkClient<Protocol>(get_address(), CONN_PORT) {}
+GameClient<Protocol>::GameClient(const ClientSettings& settings)
+    : NetworkClient<Protocol>(get_address(), CONN_PORT),
+      compression_(settings.compression),
+      reliable_(settings.reliable) {
+    GameClient<Protocol>::set_backend(settings.backend);
+    GameClient<Protocol>::set_output_buffering(OUTPUT_FLUSH_THRESHOLD);
+    GameClient<Protocol>::set_datagram_batching(settings.datagram_batch,
+                                                settings.datagram_batch);
+
+    if (settings.segmentation_offload) {
+        GameClient<Protocol>::set_segmentation_offload(true);
+    }
+}
 
 template <NetworkProtocol Protocol>
-void GameClient<Protocol>::provide_credentials(const std::string& name) {
-    GameClient<Protocol>::send(name);
+void GameClient<Protocol>::provide_credentials(const std::string& name,
+                                               const std::string& room) {
+    uint8_t request = (uint8_t)LATEST_WIRE_VERSION;
+    if (compression_) request |= WIRE_HELLO_COMPRESSION;
+    if (reliable_) request |= WIRE_HELLO_RELIABLE;
+
+    std::string hello = {WIRE_HELLO_MARKER, (char)request};
+    hello += name;
+
+    if (!room.empty()) {
+        hello += WIRE_HELLO_ROOM_SEPARATOR;
+        hello += room;
+    }
+
+    GameClient<Protocol>::send(hello);
+
+    // The server answers with the version both sides switch to.
+    auto reply = GameClient<Protocol>::template receive<uint16_t>();
+    if (!reply) return;
+
+    auto version = (WireVersion)(*reply & WIRE_HELLO_VERSION_MASK);
+    uint16_t granted = *reply & (uint16_t)~WIRE_HELLO_VERSION_MASK;
+
+    // Only what was asked for can be granted.
+    if (version < WireVersion::V1 || version > LATEST_WIRE_VERSION ||
+        (granted & ~(uint16_t)(request & ~WIRE_HELLO_VERSION_MASK))) {
+        log_printf(ERROR_REPORTS, "error",
+                   "Server answered the hello with %hu, which was not "
+                   "offered.\n",
+                   *reply);
+        GameClient<Protocol>::die();
+        return;
+    }
+
+    GameClient<Protocol>::set_wire_version(version);
+
+    if (*reply & WIRE_HELLO_COMPRESSION) {
+        GameClient<Protocol>::set_compression(COMPRESSION_THRESHOLD,
+                                              vocabulary_dictionary());
+    }
+
+    if (*reply & WIRE_HELLO_RELIABLE) GameClient<Protocol>::set_reliable(true);
+
+    GameClient<Protocol>::discover_path_mtu();
 }
 
 template <NetworkProtocol Protocol>
@@ -99,20 +174,69 @@ void GameClient<Protocol>::make_turn() {
     std::cin >> reply;
 
     GameClient<Protocol>::send(reply);
+    GameClient<Protocol>::flush();
+}
+
+// Coroutine bodies trip -Wswitch-default with GCC 12.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+template <NetworkProtocol Protocol>
+Task<void> GameClient<Protocol>::make_turn_async(Scheduler& scheduler) {
+    auto first_word = co_await GameClient<Protocol>::template async_receive<
+        std::string>(scheduler);
+    if (!first_word) co_return;
+
+    auto second_word = co_await GameClient<Protocol>::template async_receive<
+        std::string>(scheduler);
+    if (!second_word) co_return;
+
+    std::cout << "Story prefix:\n"
+              << *first_word << " " << *second_word << std::endl
+              << INPUT_PREFIX;
+
+    // Input the stream has buffered already never shows up as readiness.
+    if (std::cin.rdbuf()->in_avail() <= 0) {
+        co_await scheduler.readable(STDIN_FILENO);
+    }
+
+    std::string reply;
+
+    std::cin >> reply;
+
+    co_await GameClient<Protocol>::async_send(scheduler, reply);
+    GameClient<Protocol>::flush();
 }
 
+#pragma GCC diagnostic pop
+
 template <NetworkProtocol Protocol>
 void GameClient<Protocol>::display_story() {
-    auto length = GameClient<Protocol>::template receive<uint32_t>();
-    if (!length) return;
+    // First version servers send the part count, then every part.
+    if (GameClient<Protocol>::wire_version() == WireVersion::V1) {
+        auto length = GameClient<Protocol>::template receive<uint32_t>();
+        if (!length) return;
 
-    std::cout << "Final story:" << std::endl;
+        std::cout << "Final story:" << std::endl;
+
+        for (size_t part_id = 0; part_id < *length; ++part_id) {
+            auto part = GameClient<Protocol>::receive_view();
+            if (!part) break;
 
-    for (size_t part_id = 0; part_id < *length; ++part_id) {
-        auto part = GameClient<Protocol>::template receive<std::string>();
+            std::cout << *part << " ";
+        }
 
-        std::cout << *part << " ";
+        std::cout << std::endl;
+        return;
     }
 
+    auto story = GameClient<Protocol>::template receive<
+        std::vector<std::string_view>>();
+    if (!story) return;
+
+    std::cout << "Final story:" << std::endl;
+
+    for (std::string_view part : *story) std::cout << part << " ";
+
     std::cout << std::endl;
 }
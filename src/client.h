@@ -11,7 +11,26 @@
 
 #pragma once
 
+#include <string>
+
 #include "networking/protocols.h"
 
+/**
+ * @brief Client launch parameters
+ *
+ */
+struct ClientSettings {
+    NetworkBackend backend = NetworkBackend::SYSCALL;
+    bool compression = false;
+    bool reliable = false;
+
+    size_t datagram_batch = DEFAULT_DATAGRAM_BATCH;  // UDP datagrams per call
+    bool segmentation_offload = false;               // UDP GSO/GRO
+
+    std::string room{};  // room to join on a multi-room server
+
+    bool coroutines = false;  // play the turn as a coroutine
+};
+
 template <NetworkProtocol Protocol>
-int as_client();
+int as_client(const ClientSettings& settings);
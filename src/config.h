@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <stdlib.h>
 
 static const char PROGRAM_VERSION[] = "v0.1";
@@ -40,6 +41,38 @@ static const double CMP_EPS = 1e-5;
 static const unsigned CONN_PORT = 8080;
 
 static const size_t MAX_CLIENT_COUNT = 1024;
-static const size_t MAX_PACKAGE_SIZE = 128;
+static const size_t MAX_ROOM_CLIENT_COUNT = 16384;  // multi-room server
+
+// Players sending a longer frame are dropped.
+static const size_t MAX_PACKAGE_SIZE = 128;  // bytes
+
+static const size_t OUTPUT_FLUSH_THRESHOLD = 4096;  // bytes
+
+// Version-aware clients send MARKER, their wire version, the name and then,
+// optionally, the room separator followed by the room name.
+static const char WIRE_HELLO_MARKER = '\0';
+
+// Set in the hello version byte to ask for a feature, and in the server reply
+// to grant it.
+static const uint8_t WIRE_HELLO_COMPRESSION = 0x80;
+static const uint8_t WIRE_HELLO_RELIABLE = 0x40;  // UDP only
+static const uint8_t WIRE_HELLO_VERSION_MASK = 0x3f;
+
+// Separates the player name from the room name in the hello.
+static const char WIRE_HELLO_ROOM_SEPARATOR = '\0';
+
+static const size_t COMPRESSION_THRESHOLD = 256;  // bytes
+
+// Connections that do not say hello in time are dropped.
+static const int HELLO_TIMEOUT_MS = 5000;
+
+// A lobby without an event loop looks for hellos this often.
+static const int LOBBY_HELLO_POLL_MS = 50;
+
+// A room that has not filled up plays with whoever joined by then.
+static const int ROOM_LOBBY_TIMEOUT_MS = 30000;
+
+// Rooms advanced between two polls of the sockets.
+static const size_t ROOM_STEPS_PER_POLL = 64;
 
 static const char INPUT_PREFIX[] = ">>> ";
@@ -0,0 +1,106 @@
+/**
+ * @file handshake.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Server side of the hello every player starts with
+ * @version 0.1
+ * @date 2024-11-28
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <optional>
+#include <string>
+
+#include "config.h"
+#include "networking/basic_server.h"
+#include "vocabulary.h"
+
+/**
+ * @brief Contents of a player hello
+ *
+ */
+struct PlayerHello {
+    std::string name{};
+    std::string room{};  // empty for the default room
+
+    std::optional<uint8_t> request{};  // absent for first version clients
+};
+
+/**
+ * @brief Parse the hello of a freshly connected player
+ *
+ * @note Version-aware clients send WIRE_HELLO_MARKER, the request byte, the
+ * name and, optionally, WIRE_HELLO_ROOM_SEPARATOR followed by the room name.
+ *
+ * @param message hello as received
+ * @return hello
+ */
+inline PlayerHello parse_hello(std::string message) {
+    PlayerHello hello{};
+
+    // Clients without the marker only speak the first wire version.
+    if (message.size() < 2 || message[0] != WIRE_HELLO_MARKER) {
+        hello.name = std::move(message);
+        return hello;
+    }
+
+    hello.request = (uint8_t)message[1];
+
+    size_t separator = message.find(WIRE_HELLO_ROOM_SEPARATOR, 2);
+
+    hello.name = message.substr(2, separator - 2);
+    if (separator != std::string::npos) {
+        hello.room = message.substr(separator + 1);
+    }
+
+    return hello;
+}
+
+/**
+ * @brief Answer the hello with the features both sides agree on and switch
+ * the connection to them
+ *
+ * @param server server the player connected to
+ * @param client player id
+ * @param request request byte of the hello
+ * @param compression whether the server grants compression
+ * @param reliable whether the server grants reliable UDP
+ */
+template <NetworkProtocol Protocol>
+void grant_hello(NetworkServer<Protocol>& server,
+                 typename NetworkServer<Protocol>::ClientId client,
+                 uint8_t request, bool compression, bool reliable) {
+    // Requests below the first version come from broken clients, they get
+    // the first one.
+    auto version = std::clamp((WireVersion)(request & WIRE_HELLO_VERSION_MASK),
+                              WireVersion::V1, LATEST_WIRE_VERSION);
+
+    compression = compression && (request & WIRE_HELLO_COMPRESSION) &&
+                  version != WireVersion::V1;
+
+    reliable = reliable && (request & WIRE_HELLO_RELIABLE) &&
+               Protocol == NetworkProtocol::UDP;
+
+    uint16_t reply = (uint16_t)version;
+    if (compression) reply |= WIRE_HELLO_COMPRESSION;
+    if (reliable) reply |= WIRE_HELLO_RELIABLE;
+
+    server.send_to(client, reply);
+    server.flush_to(client);
+    server.set_wire_version(client, version);
+
+    if (compression) {
+        server.set_compression(client, COMPRESSION_THRESHOLD,
+                               vocabulary_dictionary());
+    }
+
+    if (reliable) server.set_reliable(client, true);
+
+    server.discover_path_mtu(client);
+}
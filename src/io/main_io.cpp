@@ -1,5 +1,7 @@
 #include "main_io.h"
 
+#include <stdlib.h>
+
 #include "lib/logger/logger.h"
 
 static const char OWL_TEXT[] = R"""(You let the owls out!
@@ -23,6 +25,54 @@ error_t parse(int key, char* arg, struct argp_state* state) {
         case 'u':
             options->use_udp();
             break;
+        case 'e':
+            options->use_epoll();
+            break;
+        case OPT_IO_URING:
+            options->use_io_uring();
+            break;
+        case OPT_SHARDS:
+            options->set_shard_count(strtoul(arg, NULL, 10));
+            break;
+        case OPT_PIN:
+            options->pin_shards();
+            break;
+        case OPT_CONCURRENT:
+            options->use_concurrent();
+            break;
+        case OPT_DEADLINE:
+            options->set_deadline(atoi(arg));
+            break;
+        case OPT_IDLE:
+            options->set_idle_timeout(atoi(arg));
+            break;
+        case OPT_ASYNC_LOG:
+            options->use_async_log();
+            break;
+        case OPT_BINARY_LOG:
+            options->use_binary_log();
+            break;
+        case OPT_COMPRESS:
+            options->use_compression();
+            break;
+        case OPT_RELIABLE:
+            options->use_reliable();
+            break;
+        case OPT_BATCH:
+            options->set_datagram_batch(strtoul(arg, NULL, 10));
+            break;
+        case OPT_GSO:
+            options->use_offload();
+            break;
+        case OPT_ROOMS:
+            options->set_room_size(strtoul(arg, NULL, 10));
+            break;
+        case OPT_ROOM:
+            options->set_room(arg);
+            break;
+        case OPT_COROUTINES:
+            options->use_coroutines();
+            break;
         case ARGP_KEY_ARG:
         default:
             break;
@@ -14,6 +14,9 @@
 
 #include <argp.h>
 
+#include <string>
+
+#include "networking/protocols.h"
 #include "src/config.h"
 
 static const char ARGS_DOC[] = "";
@@ -21,12 +24,56 @@ static const char ARGS_DOC[] = "";
 enum OptCodeKey {
     _OPT_CUSTOM_KEYS_SHIFT = 500,
     OPT_OWL,
+    OPT_IO_URING,
+    OPT_SHARDS,
+    OPT_PIN,
+    OPT_CONCURRENT,
+    OPT_DEADLINE,
+    OPT_COMPRESS,
+    OPT_RELIABLE,
+    OPT_BATCH,
+    OPT_GSO,
+    OPT_ROOMS,
+    OPT_ROOM,
+    OPT_COROUTINES,
+    OPT_IDLE,
+    OPT_ASYNC_LOG,
+    OPT_BINARY_LOG,
 };
 
 static const argp_option PARSER_OPTIONS[] = {
     {"owl", OPT_OWL, NULL, 0, "Lets the owls out"},
     {"server", 's', NULL, 0, "Runs the program in server mode"},
     {"udp", 'u', NULL, 0, "Forces the program to use UDP"},
+    {"epoll", 'e', NULL, 0, "Serves all clients from a single event loop"},
+    {"io-uring", OPT_IO_URING, NULL, 0,
+     "Batches socket operations through io_uring"},
+    {"shards", OPT_SHARDS, "COUNT", 0,
+     "Splits the server into COUNT tables, each with its own thread"},
+    {"pin", OPT_PIN, NULL, 0, "Pins server shards to CPU cores"},
+    {"concurrent", OPT_CONCURRENT, NULL, 0,
+     "Prompts all players at once and collects replies as they arrive"},
+    {"deadline", OPT_DEADLINE, "MS", 0,
+     "Skips players who take longer than MS milliseconds to reply"},
+    {"compress", OPT_COMPRESS, NULL, 0,
+     "Compresses large messages if the other side agrees"},
+    {"reliable", OPT_RELIABLE, NULL, 0,
+     "Retransmits lost UDP datagrams if the other side agrees"},
+    {"batch", OPT_BATCH, "COUNT", 0,
+     "Moves up to COUNT UDP datagrams per syscall (1 disables batching)"},
+    {"gso", OPT_GSO, NULL, 0,
+     "Lets the kernel split and coalesce UDP chunks where supported"},
+    {"rooms", OPT_ROOMS, "SIZE", 0,
+     "Hosts many rooms at once, each playing a round once SIZE players join"},
+    {"room", OPT_ROOM, "NAME", 0, "Joins the room NAME on a multi-room server"},
+    {"coroutines", OPT_COROUTINES, NULL, 0,
+     "Plays every turn as a coroutine, all of them interleaved on one thread"},
+    {"idle", OPT_IDLE, "MS", 0,
+     "Drops players the event loop hears nothing from for MS milliseconds"},
+    {"async-log", OPT_ASYNC_LOG, NULL, 0,
+     "Writes the log from a background thread"},
+    {"binary-log", OPT_BINARY_LOG, NULL, 0,
+     "Writes log messages unformatted to log.bin, for the log decoder to read"},
     {}  // <-- NULL-terminator
 };
 
@@ -37,9 +84,75 @@ struct Options {
     bool is_udp() const { return udp_; }
     void use_udp() { udp_ = true; }
 
+    bool is_epoll() const { return epoll_; }
+    void use_epoll() { epoll_ = true; }
+
+    bool is_io_uring() const { return io_uring_; }
+    void use_io_uring() { io_uring_ = true; }
+
+    size_t get_shard_count() const { return shard_count_; }
+    void set_shard_count(size_t count) { shard_count_ = count ? count : 1; }
+
+    bool is_pinned() const { return pinned_; }
+    void pin_shards() { pinned_ = true; }
+
+    bool is_concurrent() const { return concurrent_; }
+    void use_concurrent() { concurrent_ = true; }
+
+    int get_deadline() const { return deadline_; }
+    void set_deadline(int deadline) { deadline_ = deadline; }
+
+    bool is_compressed() const { return compressed_; }
+    void use_compression() { compressed_ = true; }
+
+    bool is_reliable() const { return reliable_; }
+    void use_reliable() { reliable_ = true; }
+
+    bool is_offloaded() const { return offloaded_; }
+    void use_offload() { offloaded_ = true; }
+
+    size_t get_room_size() const { return room_size_; }
+    void set_room_size(size_t size) { room_size_ = size; }
+
+    const std::string& get_room() const { return room_; }
+    void set_room(const char* room) { room_ = room; }
+
+    bool is_coroutine() const { return coroutine_; }
+    void use_coroutines() { coroutine_ = true; }
+
+    int get_idle_timeout() const { return idle_timeout_; }
+    void set_idle_timeout(int timeout) { idle_timeout_ = timeout; }
+
+    bool is_log_async() const { return log_async_; }
+    void use_async_log() { log_async_ = true; }
+
+    bool is_log_binary() const { return log_binary_; }
+    void use_binary_log() { log_binary_ = true; }
+
+    size_t get_datagram_batch() const { return datagram_batch_; }
+    void set_datagram_batch(size_t count) {
+        datagram_batch_ = count ? count : 1;
+    }
+
    private:
     bool server_ = false;
     bool udp_ = false;
+    bool epoll_ = false;
+    bool io_uring_ = false;
+    size_t shard_count_ = 1;
+    bool pinned_ = false;
+    bool concurrent_ = false;
+    int deadline_ = 0;
+    bool compressed_ = false;
+    bool reliable_ = false;
+    size_t datagram_batch_ = DEFAULT_DATAGRAM_BATCH;
+    bool offloaded_ = false;
+    size_t room_size_ = 0;
+    std::string room_{};
+    bool coroutine_ = false;
+    int idle_timeout_ = 0;
+    bool log_async_ = false;
+    bool log_binary_ = false;
 };
 
 /**
@@ -43,17 +43,47 @@ int main(const int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
+    if (options.is_log_async()) set_async_logging(true);
+    if (options.is_log_binary()) set_binary_logging(true);
+
+    NetworkBackend backend = options.is_io_uring() ? NetworkBackend::IO_URING
+                                                   : NetworkBackend::SYSCALL;
+
     if (options.is_server()) {
+        ServerSettings settings{};
+        settings.event_driven = options.is_epoll();
+        settings.backend = backend;
+        settings.shard_count = options.get_shard_count();
+        settings.pin_shards = options.is_pinned();
+        settings.concurrent_replies = options.is_concurrent();
+        settings.reply_deadline_ms = options.get_deadline();
+        settings.idle_timeout_ms = options.get_idle_timeout();
+        settings.compression = options.is_compressed();
+        settings.reliable = options.is_reliable();
+        settings.datagram_batch = options.get_datagram_batch();
+        settings.segmentation_offload = options.is_offloaded();
+        settings.room_size = options.get_room_size();
+        settings.coroutines = options.is_coroutine();
+
         if (options.is_udp()) {
-            as_server<NetworkProtocol::UDP>();
+            as_server<NetworkProtocol::UDP>(settings);
         } else {
-            as_server<NetworkProtocol::TCP>();
+            as_server<NetworkProtocol::TCP>(settings);
         }
     } else {
+        ClientSettings settings{};
+        settings.backend = backend;
+        settings.compression = options.is_compressed();
+        settings.reliable = options.is_reliable();
+        settings.datagram_batch = options.get_datagram_batch();
+        settings.segmentation_offload = options.is_offloaded();
+        settings.room = options.get_room();
+        settings.coroutines = options.is_coroutine();
+
         if (options.is_udp()) {
-            as_client<NetworkProtocol::UDP>();
+            as_client<NetworkProtocol::UDP>(settings);
         } else {
-            as_client<NetworkProtocol::TCP>();
+            as_client<NetworkProtocol::TCP>(settings);
         }
     }
 
@@ -0,0 +1,567 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+#include "console/io.h"
+#include "containers/client_table.h"
+#include "containers/string_arena.h"
+#include "containers/timer_wheel.h"
+#include "handshake.h"
+#include "logger/logger.h"
+#include "networking/basic_server.h"
+#include "server.h"
+#include "story.h"
+#include "vocabulary.h"
+
+enum RoomCommand {
+    ROOM_LIST,
+    ROOM_STOP,
+};
+
+static const Options<int> ROOM_COMMANDS{
+    {"rooms", ROOM_LIST},
+    {"stop", ROOM_STOP},
+};
+
+static const std::string ROOM_HELP =
+    "help - show this message,\n"
+    "rooms - show how many rooms and players there are,\n"
+    "stop - stop the server.";
+
+/**
+ * @brief Server hosting many independent rooms from one event loop
+ *
+ * @note Every room goes through its own lobby, round and reveal. Rooms with
+ * something to do are queued and advanced a few at a time between socket
+ * polls, so a burst of rounds starting does not hold up the others. Room
+ * deadlines sit in a single timing wheel. Messages are only taken once they
+ * have fully arrived, a slow player never holds up the loop.
+ */
+template <NetworkProtocol Protocol>
+struct RoomServer : public NetworkServer<Protocol> {
+    explicit RoomServer(const ServerSettings& settings);
+
+    /**
+     * @brief Serve rooms until the operator stops the server
+     *
+     */
+    void run();
+
+    using PlayerId = NetworkServer<Protocol>::ClientId;
+
+   protected:
+    virtual void on_client_connect(PlayerId client) override;
+    virtual void on_client_disconnect(PlayerId client) override;
+    virtual void on_client_readable(PlayerId client) override;
+    virtual void on_external_event(int fd, uint32_t events) override;
+
+   private:
+    using Clock = std::chrono::steady_clock;
+    using RoomId = uint32_t;
+
+    enum class RoomState : uint8_t {
+        FREE,       // waiting in free_rooms_ to be reused
+        LOBBY,      // accepting players
+        GATHERING,  // waiting for replies
+    };
+
+    struct Room {
+        std::string name{};
+        RoomState state = RoomState::FREE;
+
+        // Changes with the state, queued steps and timers of an earlier
+        // epoch are ignored.
+        uint32_t epoch = 0;
+        bool scheduled = false;
+        uint64_t timer = 0;  // lobby or reply deadline
+
+        std::vector<PlayerId> players{};
+        size_t awaited = 0;
+        bool timed_out = false;
+
+        StringArena story{};
+    };
+
+    struct Player {
+        RoomId room = 0;
+        std::string name{};
+        bool awaited = false;
+
+        // Players join a room once their hello has arrived.
+        bool greeted = false;
+        uint64_t hello_timer = 0;
+    };
+
+    struct RoomEvent {
+        RoomId room = 0;
+        uint32_t epoch = 0;
+    };
+
+    RoomId open_room(const std::string& name);
+    void close_room(RoomId room_id);
+    void seal_lobby(RoomId room_id);
+
+    void greet(PlayerId player_id);
+    void join_room(PlayerId player_id, const std::string& room_name);
+    void leave_room(PlayerId player_id);
+
+    void schedule(RoomId room_id);
+    void set_timer(RoomId room_id, Clock::duration delay);
+    void fire_timers();
+    void run_rooms();
+    void step(RoomId room_id);
+
+    void start_round(RoomId room_id);
+    void reveal_story(RoomId room_id);
+
+    int poll_timeout() const;
+    void list_rooms() const;
+
+    size_t room_size_ = 0;
+    std::chrono::milliseconds reply_deadline_{};
+    bool compression_ = false;
+    bool reliable_ = false;
+
+    bool running_ = false;
+
+    ClientTable<Player> players_{MAX_ROOM_CLIENT_COUNT};
+
+    std::vector<Room> rooms_{};
+    std::vector<RoomId> free_rooms_{};
+    size_t open_count_ = 0;
+
+    // Rooms still accepting players, by name.
+    std::unordered_map<std::string, RoomId> lobbies_{};
+
+    TimerWheel<RoomEvent> timers_{};
+    TimerWheel<PlayerId> hello_timers_{};
+    std::deque<RoomEvent> runnable_{};
+
+    // Copy of a player list that may shrink while it is walked.
+    std::vector<PlayerId> recipients_{};
+};
+
+template <NetworkProtocol Protocol>
+int as_room_server(const ServerSettings& settings) {
+    RoomServer<Protocol> server(settings);
+
+    server.run();
+
+    return EXIT_SUCCESS;
+}
+
+template int as_room_server<NetworkProtocol::TCP>(
+    const ServerSettings& settings);
+
+template int as_room_server<NetworkProtocol::UDP>(
+    const ServerSettings& settings);
+
+template <NetworkProtocol Protocol>
+RoomServer<Protocol>::RoomServer(const ServerSettings& settings)
+    : NetworkServer<Protocol>(CONN_PORT),
+      room_size_(settings.room_size),
+      reply_deadline_(settings.reply_deadline_ms),
+      compression_(settings.compression),
+      reliable_(settings.reliable) {
+    RoomServer<Protocol>::set_client_limit(MAX_ROOM_CLIENT_COUNT);
+    RoomServer<Protocol>::set_client_backend(settings.backend);
+    RoomServer<Protocol>::set_client_buffering(OUTPUT_FLUSH_THRESHOLD);
+    RoomServer<Protocol>::set_client_max_frame_size(MAX_PACKAGE_SIZE);
+    RoomServer<Protocol>::set_client_datagram_batching(
+        settings.datagram_batch, settings.datagram_batch);
+    RoomServer<Protocol>::set_client_segmentation_offload(
+        settings.segmentation_offload);
+
+    RoomServer<Protocol>::enable_event_loop();
+    RoomServer<Protocol>::set_idle_timeout(
+        std::chrono::milliseconds(settings.idle_timeout_ms));
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::run() {
+    std::cout << "Server is hosting rooms of " << room_size_
+              << " players. (rooms / stop / help)" << std::endl
+              << INPUT_PREFIX << std::flush;
+
+    RoomServer<Protocol>::watch_external(STDIN_FILENO);
+
+    running_ = true;
+
+    while (running_) {
+        RoomServer<Protocol>::poll_events(poll_timeout());
+
+        fire_timers();
+        run_rooms();
+    }
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::on_client_connect(PlayerId client) {
+    assert(errno == 0);
+
+    auto [player, inserted] = players_.try_emplace(client);
+
+    if (!player) {
+        RoomServer<Protocol>::drop_client(client);
+        return;
+    }
+
+    player->hello_timer = hello_timers_.arm(
+        Clock::now() + std::chrono::milliseconds(HELLO_TIMEOUT_MS), client);
+
+    // The hello may have arrived together with the connection.
+    greet(client);
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::on_client_disconnect(PlayerId client) {
+    Player* player = players_.find(client);
+    if (!player) return;
+
+    hello_timers_.cancel(player->hello_timer);
+
+    if (player->greeted) {
+        leave_room(client);
+    } else {
+        players_.erase(client);
+    }
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::on_client_readable(PlayerId client) {
+    Player* player = players_.find(client);
+
+    if (player && !player->greeted) {
+        greet(client);
+        return;
+    }
+
+    // A reply that is still arriving waits in the connection.
+    if (!RoomServer<Protocol>::template poll_message_from<std::string>(
+            client)) {
+        return;
+    }
+
+    auto reply = RoomServer<Protocol>::receive_view_from(client);
+
+    player = players_.find(client);
+    if (!reply || !player || !player->awaited) return;
+
+    Room& room = rooms_[player->room];
+
+    player->awaited = false;
+    --room.awaited;
+
+    room.story.append(*reply);
+
+    if (room.awaited == 0) schedule(player->room);
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::on_external_event(int fd, uint32_t events) {
+    if (fd != STDIN_FILENO) return;
+
+    std::string input;
+    std::cin >> input;
+
+    if (!std::cin) {
+        running_ = false;
+        return;
+    }
+
+    const int* command = match_command(ROOM_COMMANDS, input, ROOM_HELP);
+
+    if (command && *command == ROOM_STOP) running_ = false;
+    if (command && *command == ROOM_LIST) list_rooms();
+
+    if (running_) std::cout << INPUT_PREFIX << std::flush;
+}
+
+template <NetworkProtocol Protocol>
+typename RoomServer<Protocol>::RoomId RoomServer<Protocol>::
+    open_room(const std::string& name) {
+    RoomId room_id = (RoomId)rooms_.size();
+
+    if (free_rooms_.empty()) {
+        rooms_.emplace_back();
+    } else {
+        room_id = free_rooms_.back();
+        free_rooms_.pop_back();
+    }
+
+    Room& room = rooms_[room_id];
+    room.name = name;
+    room.state = RoomState::LOBBY;
+    ++room.epoch;
+
+    lobbies_[name] = room_id;
+    ++open_count_;
+
+    return room_id;
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::close_room(RoomId room_id) {
+    seal_lobby(room_id);
+
+    Room& room = rooms_[room_id];
+
+    // Memory of the room is kept for the next one.
+    room.name.clear();
+    room.state = RoomState::FREE;
+    ++room.epoch;
+    timers_.cancel(std::exchange(room.timer, 0));
+    room.scheduled = false;
+    room.players.clear();
+    room.awaited = 0;
+    room.timed_out = false;
+    room.story.clear();
+
+    free_rooms_.push_back(room_id);
+    --open_count_;
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::seal_lobby(RoomId room_id) {
+    auto lobby = lobbies_.find(rooms_[room_id].name);
+
+    if (lobby != lobbies_.end() && lobby->second == room_id) {
+        lobbies_.erase(lobby);
+    }
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::greet(PlayerId player_id) {
+    if (!RoomServer<Protocol>::template poll_message_from<std::string>(
+            player_id)) {
+        return;
+    }
+
+    auto message =
+        RoomServer<Protocol>::template receive_from<std::string>(player_id);
+
+    if (!message) {
+        RoomServer<Protocol>::drop_client(player_id);
+        return;
+    }
+
+    PlayerHello hello = parse_hello(std::move(*message));
+
+    Player& player = players_[player_id];
+    hello_timers_.cancel(std::exchange(player.hello_timer, 0));
+    player.greeted = true;
+    player.name = std::move(hello.name);
+
+    if (hello.request) {
+        grant_hello(*this, player_id, *hello.request, compression_,
+                    reliable_);
+    }
+
+    // Players whose socket failed during the answer are already gone.
+    if (!players_.contains(player_id)) return;
+
+    join_room(player_id, hello.room);
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::join_room(PlayerId player_id,
+                                     const std::string& room_name) {
+    auto lobby = lobbies_.find(room_name);
+    RoomId room_id =
+        lobby != lobbies_.end() ? lobby->second : open_room(room_name);
+
+    Room& room = rooms_[room_id];
+
+    room.players.push_back(player_id);
+    players_[player_id].room = room_id;
+
+    if (room.players.size() == 1) {
+        set_timer(room_id, std::chrono::milliseconds(ROOM_LOBBY_TIMEOUT_MS));
+    }
+
+    // Latecomers get a fresh room of the same name.
+    if (room.players.size() >= room_size_) {
+        seal_lobby(room_id);
+        schedule(room_id);
+    }
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::leave_room(PlayerId player_id) {
+    Player& player = players_[player_id];
+    RoomId room_id = player.room;
+    Room& room = rooms_[room_id];
+
+    auto seat = std::find(room.players.begin(), room.players.end(), player_id);
+    if (seat != room.players.end()) {
+        *seat = room.players.back();
+        room.players.pop_back();
+    }
+
+    if (player.awaited && --room.awaited == 0) schedule(room_id);
+
+    players_.erase(player_id);
+
+    if (room.players.empty()) close_room(room_id);
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::schedule(RoomId room_id) {
+    Room& room = rooms_[room_id];
+
+    if (room.scheduled) return;
+
+    room.scheduled = true;
+    runnable_.push_back({.room = room_id, .epoch = room.epoch});
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::set_timer(RoomId room_id, Clock::duration delay) {
+    Room& room = rooms_[room_id];
+
+    // A room waits for one deadline at a time.
+    timers_.cancel(room.timer);
+    room.timer = timers_.arm(Clock::now() + delay,
+                             {.room = room_id, .epoch = room.epoch});
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::fire_timers() {
+    // Players silent for too long after connecting are turned away.
+    hello_timers_.advance(Clock::now(), [this](uint64_t, PlayerId player_id) {
+        RoomServer<Protocol>::drop_client(player_id);
+    });
+
+    timers_.advance(Clock::now(), [this](uint64_t, RoomEvent timer) {
+        Room& room = rooms_[timer.room];
+        if (room.epoch != timer.epoch) return;
+
+        room.timer = 0;
+
+        if (room.state == RoomState::LOBBY) {
+            // Whoever joined by now plays.
+            seal_lobby(timer.room);
+        } else if (room.state == RoomState::GATHERING) {
+            room.timed_out = true;
+        }
+
+        schedule(timer.room);
+    });
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::run_rooms() {
+    for (size_t steps = 0; steps < ROOM_STEPS_PER_POLL && !runnable_.empty();
+         ++steps) {
+        RoomEvent event = runnable_.front();
+        runnable_.pop_front();
+
+        Room& room = rooms_[event.room];
+        if (room.epoch != event.epoch) continue;
+
+        room.scheduled = false;
+        step(event.room);
+    }
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::step(RoomId room_id) {
+    Room& room = rooms_[room_id];
+
+    switch (room.state) {
+        case RoomState::LOBBY:
+            start_round(room_id);
+            break;
+        case RoomState::GATHERING:
+            if (room.awaited == 0 || room.timed_out) reveal_story(room_id);
+            break;
+        case RoomState::FREE:
+        default:
+            break;
+    }
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::start_round(RoomId room_id) {
+    Room& room = rooms_[room_id];
+
+    room.state = RoomState::GATHERING;
+    ++room.epoch;
+
+    room.story.clear();
+    room.story.append(OBJECTIVES[(size_t)rand() % OBJECTIVES.size()]);
+    room.story.append(NOUNS[(size_t)rand() % NOUNS.size()]);
+
+    std::string first_word(room.story[0]);
+    std::string second_word(room.story[1]);
+
+    // Players that turn out to be gone leave the room during the walk.
+    recipients_ = room.players;
+
+    for (PlayerId player_id : recipients_) {
+        RoomServer<Protocol>::send_all_to(player_id, first_word, second_word);
+        RoomServer<Protocol>::flush_to(player_id);
+
+        Player* player = players_.find(player_id);
+        if (!player) continue;
+
+        player->awaited = true;
+        ++room.awaited;
+    }
+
+    if (room.state != RoomState::GATHERING) return;
+
+    if (reply_deadline_.count() > 0) set_timer(room_id, reply_deadline_);
+
+    if (room.awaited == 0) schedule(room_id);
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::reveal_story(RoomId room_id) {
+    Room& room = rooms_[room_id];
+
+    reveal_story_to(*this, room.players, room.story);
+
+    log_printf(STATUS_REPORTS, "status",
+               "Room \"%s\" finished a round of %zu players.\n",
+               room.name.c_str(), room.players.size());
+
+    // Players leave with the story, the last one closes the room.
+    recipients_ = room.players;
+
+    for (PlayerId player_id : recipients_) {
+        RoomServer<Protocol>::flush_to(player_id);
+        RoomServer<Protocol>::drop_client(player_id);
+    }
+}
+
+template <NetworkProtocol Protocol>
+int RoomServer<Protocol>::poll_timeout() const {
+    if (!runnable_.empty()) return 0;
+
+    int timeout_ms = timers_.timeout_ms();
+
+    int hello_ms = hello_timers_.timeout_ms();
+    if (hello_ms >= 0 && (timeout_ms < 0 || hello_ms < timeout_ms)) {
+        timeout_ms = hello_ms;
+    }
+
+    return timeout_ms;
+}
+
+template <NetworkProtocol Protocol>
+void RoomServer<Protocol>::list_rooms() const {
+    printf("Rooms: %zu, %zu of them accepting players. Players: %zu\n",
+           open_count_, lobbies_.size(), players_.size());
+}
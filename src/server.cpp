@@ -7,6 +7,8 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <future>
 #include <iostream>
 #include <optional>
@@ -14,20 +16,77 @@
 #include <vector>
 
 #include "config.h"
+#include "handshake.h"
 #include "console/io.h"
+#include "containers/client_table.h"
+#include "containers/string_arena.h"
+#include "containers/timer_wheel.h"
 #include "logger/debug.h"
 #include "logger/logger.h"
 #include "networking/basic_server.h"
+#include "networking/coroutine.h"
+#include "networking/sharded_server.h"
+#include "story.h"
+#include "vocabulary.h"
+
+enum LobbyCommand {
+    LOBBY_START,
+    LOBBY_PARTICIPANTS,
+};
+
+static const Options<int> LOBBY_COMMANDS{
+    {"start", LOBBY_START},
+    {"participants", LOBBY_PARTICIPANTS},
+};
+
+static const std::string LOBBY_HELP =
+    "help - show this message,\n"
+    "start - start the game,\n"
+    "participants - show the list of participants.";
+
 template <NetworkProtocol Protocol>
 struct GameServer : public NetworkServer<Protocol> {
-    GameServer();
+    explicit GameServer(const ServerSettings& settings);
 
     void accept_players();
 
+    /**
+     * @brief Poll the event loop once and turn away players who have not
+     * said hello in time
+     *
+     * @param timeout_ms longest wait, -1 to wait for an event
+     */
+    void serve_lobby(int timeout_ms);
+
+    /**
+     * @brief Stop seating players, turning away those who have not said
+     * hello yet
+     *
+     */
+    void close_lobby();
+
     void start_round();
 
     void gather_replies();
 
+    /**
+     * @brief Prompt every player at once and collect replies as they arrive
+     *
+     * @note All players get the same two-word prefix, replies are appended to
+     * the story in the order they arrive. Players who do not answer before
+     * their deadline are skipped.
+     */
+    void gather_replies_concurrently();
+
+    /**
+     * @brief Play every player's turn as a coroutine, all of them interleaved
+     * on the calling thread
+     *
+     * @note All players get the same two-word prefix, replies are appended to
+     * the story in the order they arrive.
+     */
+    void gather_replies_interleaved();
+
     void reveal_story();
 
     void list_players() const;
@@ -39,121 +98,516 @@ struct GameServer : public NetworkServer<Protocol> {
                                        ClientId client) override {
         assert(errno == 0);
 
-        auto name = GameServer<Protocol>::
-            template receive_from<std::string>(client);
-        if (!name) return;
+        // Players joining once the lobby has closed are turned away.
+        Player* player =
+            seating_ ? players_.try_emplace(client).first : nullptr;
+
+        if (!player) {
+            GameServer<Protocol>::drop_client(client);
+            return;
+        }
+
+        player->hello_timer = hello_timers_.arm(
+            Clock::now() + std::chrono::milliseconds(HELLO_TIMEOUT_MS),
+            client);
 
-        players_[client] = *name;
+        // The hello may have arrived together with the connection.
+        greet(client);
     }
 
     virtual void on_client_disconnect(NetworkServer<Protocol>::
                                           ClientId client) override {
-        if (players_.contains(client)) return;
+        Player* player = players_.find(client);
+        if (!player) return;
+
+        if (player->awaited) --awaited_count_;
+        round_deadlines_.cancel(player->deadline_timer);
+        hello_timers_.cancel(player->hello_timer);
 
         players_.erase(client);
     }
 
+    virtual void on_client_readable(NetworkServer<Protocol>::
+                                        ClientId client) override {
+        Player* player = players_.find(client);
+
+        if (player && !player->greeted) {
+            greet(client);
+            return;
+        }
+
+        // A reply that is still arriving waits in the connection, the other
+        // players are served meanwhile.
+        if (!GameServer<Protocol>::template poll_message_from<std::string>(
+                client)) {
+            return;
+        }
+
+        auto reply = GameServer<Protocol>::receive_view_from(client);
+
+        player = players_.find(client);
+        if (!reply || !player || !player->awaited) return;
+
+        player->awaited = false;
+        --awaited_count_;
+        round_deadlines_.cancel(player->deadline_timer);
+
+        printf("%s's addition: %.*s\n", player->name.c_str(),
+               (int)reply->size(), reply->data());
+
+        story_.append(*reply);
+    }
+
+    virtual void on_external_event(int fd, uint32_t events) override {
+        if (fd != STDIN_FILENO) return;
+
+        std::string input;
+        std::cin >> input;
+
+        if (!std::cin) {
+            accepting_ = false;
+            return;
+        }
+
+        const int* command = match_command(LOBBY_COMMANDS, input, LOBBY_HELP);
+
+        if (command && *command == LOBBY_START) accepting_ = false;
+        if (command && *command == LOBBY_PARTICIPANTS) list_players();
+
+        if (accepting_) std::cout << INPUT_PREFIX << std::flush;
+    }
+
    private:
-    std::vector<std::string> story_{};
-    std::map<PlayerId, std::string> players_{};
+    using Clock = std::chrono::steady_clock;
+
+    void greet(PlayerId player_id);
+    void greet_pending();
+    void expire_hellos();
+    int lobby_timeout() const;
+
+    Task<void> play_turn(PlayerId player_id, const std::string& first_word,
+                         const std::string& second_word);
+
+    bool accepting_ = false;
+    bool seating_ = true;  // players who connect now may join the round
+
+    std::chrono::milliseconds reply_deadline_{};
+    bool compression_ = false;
+    bool reliable_ = false;
+
+    struct Player {
+        std::string name{};
+
+        // Players take part once their hello has arrived.
+        bool greeted = false;
+        uint64_t hello_timer = 0;
+
+        bool awaited = false;  // for a reply in the current round
+        uint64_t deadline_timer = 0;
+    };
+
+    // Released as a whole by start_round(), sent as is by reveal_story().
+    StringArena story_{};
+
+    // Indexed by the same ids as the connections.
+    ClientTable<Player> players_{MAX_CLIENT_COUNT};
+    size_t awaited_count_ = 0;
+
+    TimerWheel<PlayerId> round_deadlines_{};
+    TimerWheel<PlayerId> hello_timers_{};
+
+    // Players yet to say hello, looked at by greet_pending().
+    std::vector<PlayerId> strangers_{};
+
+    Scheduler turns_{};
 };
 
 template <NetworkProtocol Protocol>
-int as_server() {
-    GameServer<Protocol> server;
+static int as_sharded_server(const ServerSettings& settings) {
+    using Table = GameServer<Protocol>;
+
+    ServerShards<Table> tables(settings.shard_count, [&settings](size_t) {
+        return std::make_unique<Table>(settings);
+    });
+
+    // Every new player takes a seat at the least crowded table.
+    tables.set_selector([&tables](const NetworkClientInfo&,
+                                  size_t accepted_on) {
+        size_t target = accepted_on;
+
+        for (size_t table_id = 0; table_id < tables.size(); ++table_id) {
+            if (tables.assigned_count(table_id) <
+                tables.assigned_count(target)) {
+                target = table_id;
+            }
+        }
+
+        return target;
+    });
+
+    // Tables turn away players who do not say hello in time.
+    tables.set_step([](Table& table) { table.serve_lobby(-1); });
+
+    tables.set_pinning(settings.pin_shards);
+    tables.start();
+
+    std::cout << "Server is accepting players at " << tables.size()
+              << " tables. (start / help)" << std::endl;
+
+    while (receive_command(LOBBY_COMMANDS, INPUT_PREFIX, LOBBY_HELP) !=
+           LOBBY_START) {
+        for (size_t table_id = 0; table_id < tables.size(); ++table_id) {
+            printf("Table %zu: %zu players\n", table_id,
+                   tables.assigned_count(table_id));
+        }
+    }
+
+    tables.stop();
+
+    tables.run_on_each([&settings](Table& table, size_t) {
+        table.close_lobby();
+        table.start_round();
+
+        if (settings.coroutines) {
+            table.gather_replies_interleaved();
+        } else if (settings.concurrent_replies) {
+            table.gather_replies_concurrently();
+        } else {
+            table.gather_replies();
+        }
+
+        table.reveal_story();
+    });
+
+    return EXIT_SUCCESS;
+}
+
+template <NetworkProtocol Protocol>
+int as_server(const ServerSettings& settings) {
+    if (settings.room_size > 0) return as_room_server<Protocol>(settings);
+    if (settings.shard_count > 1) return as_sharded_server<Protocol>(settings);
+
+    GameServer<Protocol> server(settings);
 
     server.accept_players();
 
     server.start_round();
 
-    server.gather_replies();
+    if (settings.coroutines) {
+        server.gather_replies_interleaved();
+    } else if (settings.concurrent_replies) {
+        server.gather_replies_concurrently();
+    } else {
+        server.gather_replies();
+    }
 
     server.reveal_story();
 
     return EXIT_SUCCESS;
 }
 
-template int as_server<NetworkProtocol::TCP>();
+template int as_server<NetworkProtocol::TCP>(const ServerSettings& settings);
 
-template int as_server<NetworkProtocol::UDP>();
+template int as_server<NetworkProtocol::UDP>(const ServerSettings& settings);
 
 template <NetworkProtocol Protocol>
-GameServer<Protocol>::GameServer() : NetworkServer<Protocol>(CONN_PORT) {}
+GameServer<Protocol>::GameServer(const ServerSettings& settings)
+    : NetworkServer<Protocol>(CONN_PORT, settings.shard_count > 1),
+      reply_deadline_(settings.reply_deadline_ms),
+      compression_(settings.compression),
+      reliable_(settings.reliable) {
+    GameServer<Protocol>::set_client_limit(MAX_CLIENT_COUNT);
+    GameServer<Protocol>::set_client_backend(settings.backend);
+    GameServer<Protocol>::set_client_buffering(OUTPUT_FLUSH_THRESHOLD);
+    GameServer<Protocol>::set_client_max_frame_size(MAX_PACKAGE_SIZE);
+    GameServer<Protocol>::set_client_datagram_batching(
+        settings.datagram_batch, settings.datagram_batch);
+    GameServer<Protocol>::set_client_segmentation_offload(
+        settings.segmentation_offload);
+
+    // Replies are collected concurrently from the event loop.
+    if (settings.event_driven || settings.concurrent_replies ||
+        settings.coroutines) {
+        GameServer<Protocol>::enable_event_loop();
+    }
+
+    GameServer<Protocol>::set_idle_timeout(
+        std::chrono::milliseconds(settings.idle_timeout_ms));
+}
 
 template <NetworkProtocol Protocol>
 void GameServer<Protocol>::accept_players() {
-    GameServer<Protocol>::start_accepting(8888 + (uint16_t)rand() % 100);
+    // Lobby commands are polled for, none may wait in the stdio buffer.
+    setvbuf(stdin, nullptr, _IONBF, 0);
+
+    if (GameServer<Protocol>::is_event_driven()) {
+        std::cout << "Server is accepting players. (start / help)" << std::endl
+                  << INPUT_PREFIX << std::flush;
+
+        GameServer<Protocol>::watch_external(STDIN_FILENO);
 
-    std::cout << "Server is accepting players. (start / help)" << std::endl;
+        accepting_ = true;
+        while (accepting_) serve_lobby(-1);
 
-    receive_command((Options<int>){{"start", 0}}, INPUT_PREFIX,
-                    "help - show this message,\n"
-                    "start - start the game,\n"
-                    "participants - show the list of participants.");
+        close_lobby();
+
+        return;
+    }
+
+    GameServer<Protocol>::start_accepting();
+
+    std::cout << "Server is accepting players. (start / help)" << std::endl
+              << INPUT_PREFIX << std::flush;
+
+    // Players are registered as they join, so the lobby can list them.
+    accepting_ = true;
+    while (accepting_) {
+        bool command = GameServer<Protocol>::check_new_connections(
+            lobby_timeout(), STDIN_FILENO);
+
+        greet_pending();
+        expire_hellos();
+
+        if (command) on_external_event(STDIN_FILENO, REACTOR_READABLE);
+    }
 
     GameServer<Protocol>::check_new_connections();
 
+    close_lobby();
+
     GameServer<Protocol>::stop_accepting();
 }
 
-static const std::vector<std::string> OBJECTIVES{
-    "Stinky", "Humble",   "Brave",    "Golden", "Stupid",      "Shy",
-    "Naive",  "Northern", "Southern", "Polar",  "Adventurous", "Fat",
-    "Skinny", "Strong",   "Weak",     "Smart",  "Dumb",        "Controversial",
-};
+template <NetworkProtocol Protocol>
+void GameServer<Protocol>::serve_lobby(int timeout_ms) {
+    int hello_ms = hello_timers_.timeout_ms();
+    if (hello_ms >= 0 && (timeout_ms < 0 || hello_ms < timeout_ms)) {
+        timeout_ms = hello_ms;
+    }
 
-static const std::vector<std::string> NOUNS{
-    "goose",     "dwarf",      "elf",       "boy",        "girl",
-    "man",       "polar bear", "archivist", "programmer", "wizard",
-    "barbarian", "troll",      "engineer",  "mechanic",   "pilot",
-    "sailor",    "driver",     "artificer", "artist",     "dancer",
-};
+    GameServer<Protocol>::poll_events(timeout_ms);
+
+    expire_hellos();
+}
+
+template <NetworkProtocol Protocol>
+void GameServer<Protocol>::close_lobby() {
+    seating_ = false;
+
+    // Hellos that have arrived by now still count.
+    greet_pending();
+
+    for (PlayerId player_id : strangers_) {
+        const Player* player = players_.find(player_id);
+        if (player && !player->greeted) {
+            GameServer<Protocol>::drop_client(player_id);
+        }
+    }
+}
+
+template <NetworkProtocol Protocol>
+void GameServer<Protocol>::greet(PlayerId player_id) {
+    if (!GameServer<Protocol>::template poll_message_from<std::string>(
+            player_id)) {
+        return;
+    }
+
+    auto message =
+        GameServer<Protocol>::template receive_from<std::string>(player_id);
+
+    if (!message) {
+        GameServer<Protocol>::drop_client(player_id);
+        return;
+    }
+
+    PlayerHello hello = parse_hello(std::move(*message));
+
+    Player& player = players_[player_id];
+    hello_timers_.cancel(std::exchange(player.hello_timer, 0));
+    player.greeted = true;
+    player.name = std::move(hello.name);
+
+    if (hello.request) {
+        grant_hello(*this, player_id, *hello.request, compression_,
+                    reliable_);
+    }
+}
+
+template <NetworkProtocol Protocol>
+void GameServer<Protocol>::greet_pending() {
+    strangers_.clear();
+    if (hello_timers_.empty()) return;
+
+    // Greeting may drop a player, the table is not walked meanwhile.
+    for (auto [player_id, player] : players_) {
+        if (!player.greeted) strangers_.push_back(player_id);
+    }
+
+    for (PlayerId player_id : strangers_) greet(player_id);
+}
+
+template <NetworkProtocol Protocol>
+void GameServer<Protocol>::expire_hellos() {
+    hello_timers_.advance(Clock::now(), [this](uint64_t, PlayerId player_id) {
+        GameServer<Protocol>::drop_client(player_id);
+    });
+}
+
+template <NetworkProtocol Protocol>
+int GameServer<Protocol>::lobby_timeout() const {
+    int timeout_ms = hello_timers_.timeout_ms();
+
+    // Nothing tells the lobby without an event loop that a hello arrived,
+    // the players who owe one are looked at every so often.
+    if (timeout_ms < 0) return -1;
+
+    return std::min(timeout_ms, LOBBY_HELLO_POLL_MS);
+}
 
 template <NetworkProtocol Protocol>
 void GameServer<Protocol>::start_round() {
+    seating_ = false;
+
     story_.clear();
 
-    story_.push_back(OBJECTIVES[(size_t)rand() % OBJECTIVES.size()]);
-    story_.push_back(NOUNS[(size_t)rand() % NOUNS.size()]);
+    story_.append(OBJECTIVES[(size_t)rand() % OBJECTIVES.size()]);
+    story_.append(NOUNS[(size_t)rand() % NOUNS.size()]);
 }
 
 template <NetworkProtocol Protocol>
 void GameServer<Protocol>::gather_replies() {
-    for (auto& [player_id, player_name] : players_) {
-        GameServer<Protocol>::
-            template send_to<std::string>(player_id, story_[story_.size() - 2]);
-        GameServer<Protocol>::
-            template send_to<std::string>(player_id, story_[story_.size() - 1]);
+    // Every player continues from the last two words, the buffers are only
+    // refilled.
+    std::string first_word{};
+    std::string second_word{};
+
+    for (auto [player_id, player] : players_) {
+        first_word.assign(story_[story_.size() - 2]);
+        second_word.assign(story_[story_.size() - 1]);
+
+        GameServer<Protocol>::send_all_to(player_id, first_word, second_word);
 
-        auto reply = GameServer<Protocol>::
-            template receive_from<std::string>(player_id);
+        auto reply = GameServer<Protocol>::receive_view_from(player_id);
 
         if (!reply) continue;
 
-        printf("%s's addition: %s\n", player_name.c_str(), reply->c_str());
+        printf("%s's addition: %.*s\n", player.name.c_str(),
+               (int)reply->size(), reply->data());
 
-        story_.push_back(*reply);
+        story_.append(*reply);
     }
 }
 
 template <NetworkProtocol Protocol>
-void GameServer<Protocol>::reveal_story() {
-    for (auto& [player_id, player_name] : players_) {
-        GameServer<Protocol>::
-            template send_to<uint32_t>(player_id, (uint32_t)story_.size());
+void GameServer<Protocol>::gather_replies_concurrently() {
+    std::string first_word(story_[story_.size() - 2]);
+    std::string second_word(story_[story_.size() - 1]);
+
+    awaited_count_ = 0;
+
+    for (auto [player_id, player] : players_) {
+        GameServer<Protocol>::send_all_to(player_id, first_word, second_word);
+        GameServer<Protocol>::flush_to(player_id);
+
+        player.awaited = true;
+        ++awaited_count_;
+
+        if (reply_deadline_.count() > 0) {
+            player.deadline_timer = round_deadlines_.arm(
+                Clock::now() + reply_deadline_, player_id);
+        }
+    }
+
+    while (awaited_count_ > 0) {
+        GameServer<Protocol>::poll_events(round_deadlines_.timeout_ms());
+
+        round_deadlines_.advance(Clock::now(), [this](uint64_t,
+                                                      PlayerId player_id) {
+            Player* player = players_.find(player_id);
+            if (!player || !player->awaited) return;
+
+            printf("%s ran out of time.\n", player->name.c_str());
+
+            player->awaited = false;
+            --awaited_count_;
+        });
+    }
+}
+
+template <NetworkProtocol Protocol>
+void GameServer<Protocol>::gather_replies_interleaved() {
+    if (!GameServer<Protocol>::set_scheduler(turns_)) {
+        gather_replies();
+        return;
+    }
 
-        for (const std::string& part : story_) {
-            GameServer<Protocol>::
-                template send_to<std::string>(player_id, part);
+    std::string first_word(story_[story_.size() - 2]);
+    std::string second_word(story_[story_.size() - 1]);
+
+    for (auto [player_id, player] : players_) {
+        turns_.spawn(play_turn(player_id, first_word, second_word));
+    }
+
+    turns_.run();
+}
+
+// Coroutine bodies trip -Wswitch-default with GCC 12.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+template <NetworkProtocol Protocol>
+Task<void> GameServer<Protocol>::play_turn(PlayerId player_id,
+                                           const std::string& first_word,
+                                           const std::string& second_word) {
+    co_await GameServer<Protocol>::async_send_all_to(player_id, first_word,
+                                                     second_word);
+    GameServer<Protocol>::flush_to(player_id);
+
+    Clock::time_point deadline = reply_deadline_.count() > 0
+                                     ? Clock::now() + reply_deadline_
+                                     : Clock::time_point::max();
+
+    auto reply = co_await GameServer<Protocol>::template async_receive_from<
+        std::string>(player_id, deadline);
+
+    // The player may have left while the turn was suspended.
+    const Player* player = players_.find(player_id);
+    if (!player) co_return;
+
+    if (!reply) {
+        if (Clock::now() >= deadline) {
+            printf("%s ran out of time.\n", player->name.c_str());
         }
+
+        co_return;
     }
+
+    printf("%s's addition: %s\n", player->name.c_str(), reply->c_str());
+
+    story_.append(*reply);
+}
+
+#pragma GCC diagnostic pop
+
+template <NetworkProtocol Protocol>
+void GameServer<Protocol>::reveal_story() {
+    std::vector<PlayerId> recipients{};
+    for (auto [player_id, player] : players_) recipients.push_back(player_id);
+
+    reveal_story_to(*this, recipients, story_);
+
+    for (PlayerId player_id : recipients) {
+        GameServer<Protocol>::flush_to(player_id);
+    }
+
+    seating_ = true;
 }
 
 template <NetworkProtocol Protocol>
 void GameServer<Protocol>::list_players() const {
     printf("Players:\n");
 
-    for (auto& [player_id, player_name] : players_) {
-        printf("\t%s\n", player_name.c_str());
+    for (auto [player_id, player] : players_) {
+        if (player.greeted) printf("\t%s\n", player.name.c_str());
     }
 }
@@ -11,7 +11,48 @@
 
 #pragma once
 
+#include <stddef.h>
+
 #include "networking/protocols.h"
 
+/**
+ * @brief Server launch parameters
+ *
+ */
+struct ServerSettings {
+    bool event_driven = false;
+    NetworkBackend backend = NetworkBackend::SYSCALL;
+
+    size_t shard_count = 1;
+    bool pin_shards = false;
+
+    bool concurrent_replies = false;
+    int reply_deadline_ms = 0;  // 0 to wait indefinitely
+
+    int idle_timeout_ms = 0;  // event loop only, 0 to keep silent players
+
+    bool compression = false;  // grant compression to clients asking for it
+    bool reliable = false;     // grant reliable UDP to clients asking for it
+
+    size_t datagram_batch = DEFAULT_DATAGRAM_BATCH;  // UDP datagrams per call
+    bool segmentation_offload = false;               // UDP GSO/GRO
+
+    size_t room_size = 0;  // players per room, 0 to host a single game
+
+    bool coroutines = false;  // play every turn as a coroutine
+};
+
+template <NetworkProtocol Protocol>
+int as_server(const ServerSettings& settings);
+
+/**
+ * @brief Host rooms until the operator stops the server
+ *
+ * @note Players join the room named in their hello. Every room plays one
+ * round on its own once it fills up or its lobby times out.
+ *
+ * @param settings server settings, room_size has to be positive
+ * @return exit code
+ */
 template <NetworkProtocol Protocol>
-int as_server();
+int as_room_server(const ServerSettings& settings);
@@ -0,0 +1,72 @@
+/**
+ * @file story.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Final story in the shape every wire version expects
+ * @version 0.1
+ * @date 2024-11-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "containers/string_arena.h"
+#include "networking/basic_server.h"
+
+/**
+ * @brief Send the final story to the players
+ *
+ * @note First version players get the part count followed by every part as
+ * a string message, the way the story was sent before generic values. The
+ * rest get it as one std::vector<std::string> message, encoded once per
+ * encoding.
+ *
+ * @param server server the players are connected to
+ * @param recipients player ids
+ * @param story story to send
+ * @return number of players the story was sent to
+ */
+template <NetworkProtocol Protocol>
+size_t reveal_story_to(
+    NetworkServer<Protocol>& server,
+    const std::vector<typename NetworkServer<Protocol>::ClientId>& recipients,
+    const StringArena& story) {
+    using ClientId = typename NetworkServer<Protocol>::ClientId;
+
+    auto is_first_version = [&server](ClientId client) {
+        return server.get_wire_version(client) == WireVersion::V1;
+    };
+
+    if (std::none_of(recipients.begin(), recipients.end(), is_first_version)) {
+        return server.multicast(recipients, story);
+    }
+
+    std::vector<ClientId> current{};
+    size_t sent = 0;
+
+    for (ClientId client : recipients) {
+        if (!is_first_version(client)) {
+            current.push_back(client);
+            continue;
+        }
+
+        bool success = server.send_to(client, (uint32_t)story.size());
+
+        for (size_t part_id = 0; success && part_id < story.size();
+             ++part_id) {
+            success = server.send_to(client, std::string(story[part_id]));
+        }
+
+        if (success) ++sent;
+    }
+
+    return sent + server.multicast(current, story);
+}
@@ -0,0 +1,35 @@
+#include "vocabulary.h"
+
+#include "networking/serialization.h"
+
+const std::vector<std::string> OBJECTIVES{
+    "Stinky", "Humble",   "Brave",    "Golden", "Stupid",      "Shy",
+    "Naive",  "Northern", "Southern", "Polar",  "Adventurous", "Fat",
+    "Skinny", "Strong",   "Weak",     "Smart",  "Dumb",        "Controversial",
+};
+
+const std::vector<std::string> NOUNS{
+    "goose",     "dwarf",      "elf",       "boy",        "girl",
+    "man",       "polar bear", "archivist", "programmer", "wizard",
+    "barbarian", "troll",      "engineer",  "mechanic",   "pilot",
+    "sailor",    "driver",     "artificer", "artist",     "dancer",
+};
+
+std::string_view vocabulary_dictionary() {
+    static const std::vector<char> dictionary = []() {
+        std::vector<char> result{};
+
+        // Only later wire versions compress, the words are encoded their way.
+        for (const std::string& word : OBJECTIVES) {
+            wire_encode(LATEST_WIRE_VERSION, result, word);
+        }
+
+        for (const std::string& word : NOUNS) {
+            wire_encode(LATEST_WIRE_VERSION, result, word);
+        }
+
+        return result;
+    }();
+
+    return std::string_view(dictionary.data(), dictionary.size());
+}
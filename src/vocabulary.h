@@ -0,0 +1,29 @@
+/**
+ * @file vocabulary.h
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Words the story starts with, shared by the server and the clients.
+ * @version 0.1
+ * @date 2024-11-23
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+extern const std::vector<std::string> OBJECTIVES;
+extern const std::vector<std::string> NOUNS;
+
+/**
+ * @brief Compression dictionary built from the vocabulary
+ *
+ * @note Words are stored the way they appear in serialized stories, length
+ * prefix included.
+ *
+ * @return dictionary, valid for the whole program run
+ */
+std::string_view vocabulary_dictionary();
@@ -0,0 +1,57 @@
+/**
+ * @file log_decoder.cpp
+ * @author Kudryashov Ilya (kudriashov.it@phystech.edu)
+ * @brief Turns the binary log back into log.html text.
+ * @version 0.1
+ * @date 2024-11-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logger/binary_log.h"
+
+static const char USAGE[] = "Usage: %s [BINARY LOG [OUTPUT]]\n"
+                            "Decodes BINARY LOG (%s by default), appending "
+                            "the text to OUTPUT (standard output by default).\n";
+
+int main(const int argc, char** argv) {
+    if (argc > 3) {
+        fprintf(stderr, USAGE, argv[0], LOG_BINARY_NAME);
+        return EXIT_FAILURE;
+    }
+
+    const char* input_name = argc > 1 ? argv[1] : LOG_BINARY_NAME;
+
+    FILE* input = fopen(input_name, "rb");
+    if (!input) {
+        perror(input_name);
+        return EXIT_FAILURE;
+    }
+
+    FILE* output = argc > 2 ? fopen(argv[2], "a") : stdout;
+    if (!output) {
+        perror(argv[2]);
+        fclose(input);
+        return EXIT_FAILURE;
+    }
+
+    int error_code = 0;
+    size_t decoded = decode_binary_log(input, output, &error_code);
+
+    fclose(input);
+    if (output != stdout) fclose(output);
+
+    fprintf(stderr, "Decoded %zu messages.\n", decoded);
+
+    if (error_code) {
+        fprintf(stderr, "%s is damaged or cut short.\n", input_name);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}